@@ -0,0 +1,53 @@
+#pragma once
+
+// Host replacement for psyqo's bump-allocator.hh, with allocation counters.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+
+#include "psyqo/fragments.hh"
+#include "psyqo/kernel.hh"
+
+namespace psyqo {
+
+template <size_t N>
+class BumpAllocator {
+  public:
+    template <typename Primitive, typename... P>
+    Fragments::SimpleFragment<Primitive>& allocateFragment(P&&... params) {
+        return allocate<Fragments::SimpleFragment<Primitive>>(std::forward<P>(params)...);
+    }
+
+    template <typename T, typename... P>
+    T& allocate(P&&... params) {
+        size_t size = (sizeof(T) + 3) & ~size_t(3);
+        Kernel::assert(remaining() >= size, "BumpAllocator: out of memory");
+        T* ptr = new (m_current) T(std::forward<P>(params)...);
+        m_current += size;
+        m_allocations++;
+        if (used() > m_highWater) m_highWater = used();
+        return *ptr;
+    }
+
+    void reset() {
+        m_current = m_memory;
+        m_allocations = 0;
+    }
+
+    size_t remaining() const { return N - used(); }
+    size_t used() const { return m_current - m_memory; }
+
+    size_t allocations() const { return m_allocations; }
+    size_t highWater() const { return m_highWater; }
+
+  private:
+    alignas(4) uint8_t m_memory[N];
+    uint8_t* m_current = m_memory;
+    size_t m_allocations = 0;
+    size_t m_highWater = 0;
+};
+
+}  // namespace psyqo
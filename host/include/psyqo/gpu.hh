@@ -0,0 +1,97 @@
+#pragma once
+
+// Host replacement for psyqo's gpu.hh. Chained ordering tables and fragments
+// are captured into a frame log in drawing order, and VRAM uploads land in a
+// plain 1024x512 array.
+
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+
+#include "psyqo/fragments.hh"
+#include "psyqo/ordering-table.hh"
+#include "psyqo/primitives/common.hh"
+#include "psyqo/primitives/misc.hh"
+
+namespace psyqo {
+
+class GPU {
+  public:
+    struct CapturedPrimitive {
+        int32_t z;  // -1 for fragments chained outside of an ordering table
+        std::vector<uint32_t> words;
+    };
+
+    uint8_t getParity() const { return m_parity; }
+    uint32_t getFrameCount() const { return m_frameCount; }
+    unsigned getRefreshRate() const { return 60; }
+
+    uint32_t now() const {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+
+    void pumpCallbacks() {}
+
+    void getNextClear(Prim::FastFill& ff, const Color& bg) const {
+        ff.setColor(bg);
+        ff.rect = Rect{.a = {.x = 0, .y = int16_t(m_parity ? 0 : 256)}, .b = {.x = 320, .y = 240}};
+    }
+
+    template <typename Fragment>
+    void chain(Fragment& fragment) {
+        const uint32_t* words = reinterpret_cast<const uint32_t*>(&fragment.head) + 1;
+        m_captured.push_back({-1, std::vector<uint32_t>(words, words + fragment.getActualFragmentSize())});
+    }
+
+    // Drawing order of a real table: the highest z first, and within a bucket
+    // the last insertion first, since fragments are linked at the head.
+    template <size_t N>
+    void chain(OrderingTable<N>& table) {
+        std::vector<std::vector<const RecordedInsertion*>> buckets(N);
+        for (auto& insertion : table.insertions()) buckets[insertion.z].push_back(&insertion);
+        for (size_t z = N; z-- > 0;) {
+            for (auto it = buckets[z].rbegin(); it != buckets[z].rend(); ++it) {
+                auto* insertion = *it;
+                m_captured.push_back({insertion->z, std::vector<uint32_t>(insertion->words,
+                                                                         insertion->words + insertion->wordCount)});
+            }
+        }
+        // The real table is cleared once it has been sent
+        table.clear();
+    }
+
+    void uploadToVRAM(const uint16_t* data, Rect region) {
+        for (int y = 0; y < region.b.y; y++) {
+            for (int x = 0; x < region.b.x; x++) {
+                int vx = (region.a.x + x) & 1023;
+                int vy = (region.a.y + y) & 511;
+                m_vram[vy * 1024 + vx] = data[y * region.b.x + x];
+            }
+        }
+        m_uploadedBytes += uint32_t(region.b.x) * region.b.y * 2;
+    }
+
+    // Host only: ends the frame, the captured primitives stay available until the next one
+    void flip() {
+        m_lastFrame.swap(m_captured);
+        m_captured.clear();
+        m_parity ^= 1;
+        m_frameCount++;
+    }
+
+    const std::vector<CapturedPrimitive>& lastFrame() const { return m_lastFrame; }
+    const uint16_t* vram() const { return m_vram.data(); }
+    uint32_t uploadedBytes() const { return m_uploadedBytes; }
+
+  private:
+    uint8_t m_parity = 0;
+    uint32_t m_frameCount = 0;
+    uint32_t m_uploadedBytes = 0;
+    std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+    std::vector<CapturedPrimitive> m_captured, m_lastFrame;
+    std::vector<uint16_t> m_vram = std::vector<uint16_t>(1024 * 512);
+};
+
+}  // namespace psyqo
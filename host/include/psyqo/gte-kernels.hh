@@ -0,0 +1,56 @@
+#pragma once
+
+// Host replacement for psyqo's gte-kernels.hh, running the commands on the
+// software GTE instead of cop2.
+
+#include "softgte.hh"
+
+namespace psyqo {
+
+namespace GTE {
+
+namespace Kernels {
+
+enum Shift { Unshifted, Shifted };
+enum Lm { Unlimited, Limited };
+enum class MX { RT, LM, LC };
+enum class MV { V0, V1, V2, IR };
+enum class TV { TR, BK, FC, Zero };
+
+static inline void rtps() { psxsplash::softGTE().rtps(true, false); }
+static inline void rtpt() { psxsplash::softGTE().rtpt(true, false); }
+static inline void nclip() { psxsplash::softGTE().nclip(); }
+static inline void avsz3() { psxsplash::softGTE().avsz3(); }
+static inline void nccs() { psxsplash::softGTE().nccs(true, true); }
+static inline void ncct() { psxsplash::softGTE().ncct(true, true); }
+static inline void ncds() { psxsplash::softGTE().ncds(true, true); }
+static inline void ncdt() { psxsplash::softGTE().ncdt(true, true); }
+static inline void dpcs() { psxsplash::softGTE().dpcs(true, false); }
+static inline void dpct() { psxsplash::softGTE().dpct(true, false); }
+
+template <Shift sf = Shifted, Lm lm = Unlimited>
+static inline void op() {
+    psxsplash::softGTE().op(sf == Shifted, lm == Limited);
+}
+
+template <Shift sf = Shifted>
+static inline void sqr() {
+    psxsplash::softGTE().sqr(sf == Shifted, false);
+}
+
+template <Shift sf = Shifted>
+static inline void gpl() {
+    psxsplash::softGTE().gpl(sf == Shifted, false);
+}
+
+template <MX mx, MV v, TV cv = TV::Zero, Shift sf = Shifted, Lm lm = Unlimited>
+static inline void mvmva() {
+    psxsplash::softGTE().mvmva(sf == Shifted, lm == Limited, static_cast<unsigned>(mx), static_cast<unsigned>(v),
+                               static_cast<unsigned>(cv));
+}
+
+}  // namespace Kernels
+
+}  // namespace GTE
+
+}  // namespace psyqo
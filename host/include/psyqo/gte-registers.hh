@@ -0,0 +1,168 @@
+#pragma once
+
+// Host replacement for psyqo's gte-registers.hh. Same interface for the parts
+// the engine uses, but the registers live in the software GTE.
+
+#include <stdint.h>
+
+#include "psyqo/matrix.hh"
+#include "psyqo/vector.hh"
+#include "softgte.hh"
+
+namespace psyqo {
+
+namespace GTE {
+
+using PackedVec3 = Vector<3, 12, int16_t>;
+
+// Data registers are 0-31, control registers 32-63, as on the hardware
+enum class Register : unsigned {
+    VXY0, VZ0, VXY1, VZ1, VXY2, VZ2, RGB, OTZ,
+    IR0, IR1, IR2, IR3, SXY0, SXY1, SXY2, SXYP,
+    SZ0, SZ1, SZ2, SZ3, RGB0, RGB1, RGB2, RES1,
+    MAC0, MAC1, MAC2, MAC3, IRGB, ORGB, LZCS, LZCR,
+    R11R12, R13R21, R22R23, R31R32, R33, TRX, TRY, TRZ,
+    L11L12, L13L21, L22L23, L31L32, L33, RBK, GBK, BBK,
+    LR1LR2, LR3LG1, LG2LG3, LB1LB2, LB3, RFC, GFC, BFC,
+    OFX, OFY, H, DQA, DQB, ZSF3, ZSF4, FLAG,
+};
+
+// There are no hazards to wait for on the host, but keep the interface
+enum Safety { Unsafe, Safe };
+
+enum class PseudoRegister { Rotation, Light, Color, V0, V1, V2, SV, LV, Translation };
+
+template <Register reg, Safety safety = Safe>
+static inline void write(uint32_t value) {
+    constexpr unsigned index = static_cast<unsigned>(reg);
+    if constexpr (index < 32) {
+        psxsplash::softGTE().writeData(index, value);
+    } else {
+        psxsplash::softGTE().writeControl(index - 32, value);
+    }
+}
+
+template <Register reg, Safety safety = Safe>
+static inline void write(const uint32_t* ptr) {
+    write<reg, safety>(*ptr);
+}
+
+template <Register reg, Safety safety = Safe>
+static inline void clear() {
+    write<reg, safety>(uint32_t(0));
+}
+
+template <Register reg, Safety safety = Safe>
+static inline uint32_t read() {
+    constexpr unsigned index = static_cast<unsigned>(reg);
+    if constexpr (index < 32) {
+        return psxsplash::softGTE().readData(index);
+    } else {
+        return psxsplash::softGTE().readControl(index - 32);
+    }
+}
+
+template <Register reg, Safety safety = Safe>
+static inline void read(uint32_t* ptr) {
+    *ptr = read<reg, safety>();
+}
+
+namespace HostDetail {
+
+static inline uint32_t pack(int32_t lo, int32_t hi) { return uint16_t(lo) | (uint32_t(uint16_t(hi)) << 16); }
+
+template <Register first>
+static inline void writeMatrix(const Matrix33& m) {
+    constexpr unsigned base = static_cast<unsigned>(first);
+    write<Register(base + 0)>(pack(m.vs[0].x.raw(), m.vs[0].y.raw()));
+    write<Register(base + 1)>(pack(m.vs[0].z.raw(), m.vs[1].x.raw()));
+    write<Register(base + 2)>(pack(m.vs[1].y.raw(), m.vs[1].z.raw()));
+    write<Register(base + 3)>(pack(m.vs[2].x.raw(), m.vs[2].y.raw()));
+    write<Register(base + 4)>(uint32_t(int32_t(m.vs[2].z.raw())));
+}
+
+template <PseudoRegister reg, typename V>
+static inline void writeVector(const V& v) {
+    if constexpr (reg == PseudoRegister::V0) {
+        write<Register::VXY0>(pack(v.x.raw(), v.y.raw()));
+        write<Register::VZ0>(uint32_t(int32_t(v.z.raw())));
+    } else if constexpr (reg == PseudoRegister::V1) {
+        write<Register::VXY1>(pack(v.x.raw(), v.y.raw()));
+        write<Register::VZ1>(uint32_t(int32_t(v.z.raw())));
+    } else if constexpr (reg == PseudoRegister::V2) {
+        write<Register::VXY2>(pack(v.x.raw(), v.y.raw()));
+        write<Register::VZ2>(uint32_t(int32_t(v.z.raw())));
+    } else if constexpr (reg == PseudoRegister::Translation) {
+        write<Register::TRX>(uint32_t(int32_t(v.x.raw())));
+        write<Register::TRY>(uint32_t(int32_t(v.y.raw())));
+        write<Register::TRZ>(uint32_t(int32_t(v.z.raw())));
+    } else {
+        static_assert(reg == PseudoRegister::V0, "Unsupported vector pseudo register");
+    }
+}
+
+}  // namespace HostDetail
+
+template <PseudoRegister reg>
+static inline void writeSafe(const Matrix33& m) {
+    if constexpr (reg == PseudoRegister::Rotation) {
+        HostDetail::writeMatrix<Register::R11R12>(m);
+    } else if constexpr (reg == PseudoRegister::Light) {
+        HostDetail::writeMatrix<Register::L11L12>(m);
+    } else if constexpr (reg == PseudoRegister::Color) {
+        HostDetail::writeMatrix<Register::LR1LR2>(m);
+    } else {
+        static_assert(reg == PseudoRegister::Rotation, "Unsupported matrix pseudo register");
+    }
+}
+
+template <PseudoRegister reg>
+static inline void writeSafe(const Vec3& v) {
+    HostDetail::writeVector<reg>(v);
+}
+
+template <PseudoRegister reg>
+static inline void writeSafe(const PackedVec3& v) {
+    HostDetail::writeVector<reg>(v);
+}
+
+template <PseudoRegister reg>
+static inline void writeUnsafe(const Matrix33& m) {
+    writeSafe<reg>(m);
+}
+
+template <PseudoRegister reg>
+static inline void writeUnsafe(const Vec3& v) {
+    writeSafe<reg>(v);
+}
+
+template <PseudoRegister reg>
+static inline void writeUnsafe(const PackedVec3& v) {
+    writeSafe<reg>(v);
+}
+
+template <PseudoRegister reg>
+static inline Vec3 readSafe() {
+    Vec3 ret;
+    if constexpr (reg == PseudoRegister::SV) {
+        read<Register::IR1>(reinterpret_cast<uint32_t*>(&ret.x));
+        read<Register::IR2>(reinterpret_cast<uint32_t*>(&ret.y));
+        read<Register::IR3>(reinterpret_cast<uint32_t*>(&ret.z));
+    } else if constexpr (reg == PseudoRegister::LV) {
+        read<Register::MAC1>(reinterpret_cast<uint32_t*>(&ret.x));
+        read<Register::MAC2>(reinterpret_cast<uint32_t*>(&ret.y));
+        read<Register::MAC3>(reinterpret_cast<uint32_t*>(&ret.z));
+    } else {
+        static_assert(reg == PseudoRegister::SV, "Unsupported pseudo register read");
+    }
+    return ret;
+}
+
+template <PseudoRegister reg>
+static inline Vec3 readUnsafe() {
+    return readSafe<reg>();
+}
+
+}  // namespace GTE
+
+}  // namespace psyqo
@@ -0,0 +1,25 @@
+#pragma once
+
+// Host replacement for psyqo's kernel.hh, only the assertions are needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#undef assert
+
+namespace psyqo {
+
+namespace Kernel {
+
+[[noreturn]] static inline void abort(const char* msg) {
+    fprintf(stderr, "psyqo abort: %s\n", msg);
+    ::abort();
+}
+
+static inline void assert(bool condition, const char* message) {
+    if (!condition) abort(message);
+}
+
+}  // namespace Kernel
+
+}  // namespace psyqo
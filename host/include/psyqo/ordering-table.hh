@@ -0,0 +1,44 @@
+#pragma once
+
+// Host replacement for psyqo's ordering-table.hh. Instead of linking DMA
+// packets, it records every insertion so the host harness can inspect and
+// hash what the renderer produced.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace psyqo {
+
+class GPU;
+
+struct RecordedInsertion {
+    int32_t z;
+    const uint32_t* words;
+    size_t wordCount;
+};
+
+template <size_t N = 1024>
+class OrderingTable {
+  public:
+    static constexpr size_t SIZE = N;
+
+    void clear() { m_insertions.clear(); }
+
+    template <typename Fragment>
+    void insert(Fragment& fragment, int32_t z) {
+        // Same clamping as the real table
+        if (z < 0) z = 0;
+        if (z >= int32_t(N)) z = N - 1;
+        const uint32_t* words = reinterpret_cast<const uint32_t*>(&fragment.head) + 1;
+        m_insertions.push_back({z, words, fragment.getActualFragmentSize()});
+    }
+
+    const std::vector<RecordedInsertion>& insertions() const { return m_insertions; }
+
+  private:
+    std::vector<RecordedInsertion> m_insertions;
+};
+
+}  // namespace psyqo
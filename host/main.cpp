@@ -0,0 +1,827 @@
+// Host (Linux) harness for the renderer, navmesh and GTE math. It loads real
+// splashpacks from disk, renders them from a fixed set of views on top of the
+// software GTE, checks the output for consistency and times it.
+//
+//   psxsplash-host [--iterations N] [--check] [--hash] pack.bin...
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#include <psyqo/gpu.hh>
+#include <psyqo/soft-math.hh>
+#include <psyqo/trigonometry.hh>
+
+#include "broadphase.hh"
+#include "camera.hh"
+#include "gtegeometry.hh"
+#include "hierarchy.hh"
+#include "navmesh.hh"
+#include "particles.hh"
+#include "raycast.hh"
+#include "renderer.hh"
+#include "softgte.hh"
+#include "splashpack.hh"
+#include "streaming.hh"
+#include "vertexanim.hh"
+
+// EASTL routes its allocations through these
+void* operator new[](size_t size, const char*, int, unsigned, const char*, int) { return ::operator new[](size); }
+void* operator new[](size_t size, size_t alignment, size_t, const char*, int, unsigned, const char*, int) {
+    return ::operator new[](size, std::align_val_t(alignment));
+}
+
+namespace {
+
+using namespace psyqo::trig_literals;
+
+constexpr unsigned VIEW_COUNT = 8;
+
+struct PackResult {
+    uint32_t triangles = 0;
+    uint32_t drawn = 0;
+    uint32_t primitives = 0;
+    uint32_t reused = 0;
+    uint32_t bytes = 0;
+    uint64_t gteCommands = 0;
+    double renderMicros = 0;
+    double navmeshMicros = 0;
+    uint64_t navmeshCycles = 0;
+    uint64_t hash = 0;
+    unsigned failures = 0;
+};
+
+std::vector<uint32_t> readFile(const char* path) {
+    std::vector<uint32_t> buffer;
+    FILE* f = fopen(path, "rb");
+    if (!f) return buffer;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer.resize((size + 3) / 4);
+    if (fread(buffer.data(), 1, size, f) != size_t(size)) buffer.clear();
+    fclose(f);
+    return buffer;
+}
+
+// FNV-1a over the captured frame, so two builds can be compared view by view
+uint64_t hashFrame(const psyqo::GPU& gpu) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](uint32_t word) {
+        for (int i = 0; i < 4; i++) {
+            hash ^= (word >> (i * 8)) & 0xff;
+            hash *= 0x100000001b3ull;
+        }
+    };
+    for (auto& prim : gpu.lastFrame()) {
+        mix(uint32_t(prim.z));
+        for (auto word : prim.words) mix(word);
+    }
+    return hash;
+}
+
+unsigned checkFrame(const psyqo::GPU& gpu, const psxsplash::RenderStats& stats, const char* pack, unsigned view) {
+    unsigned failures = 0;
+    auto fail = [&](const char* what) {
+        fprintf(stderr, "%s view %u: %s\n", pack, view, what);
+        failures++;
+    };
+
+    uint32_t inTable = 0;
+    for (auto& prim : gpu.lastFrame()) {
+        if (prim.z < 0) continue;
+        inTable++;
+        if (prim.z >= int32_t(psxsplash::Renderer::ORDERING_TABLE_SIZE)) fail("primitive outside of the ordering table");
+    }
+    if (inTable != stats.primitivesEmitted) fail("ordering table does not match the emitted primitive count");
+    if (stats.trianglesDrawn + stats.trianglesBackfaceCulled + stats.trianglesDepthCulled != stats.trianglesTested) {
+        fail("triangle counters do not add up");
+    }
+    if (stats.bytesAllocated > psxsplash::Renderer::BUMP_ALLOCATOR_SIZE) fail("bump allocator overflow");
+    if (stats.primitivesReused > stats.primitivesEmitted) fail("more primitives reused than emitted");
+    return failures;
+}
+
+// Runs the GTE geometry kernels on random inputs, range limits included, against plain integer math
+unsigned checkGeometry() {
+    using psxsplash::GEOMETRY_RANGE;
+    using psxsplash::LongVec3;
+    using psxsplash::ShortVec3;
+    unsigned failures = 0;
+    auto fail = [&failures](const char* kernel, unsigned round) {
+        fprintf(stderr, "geometry: %s differs from the software result in round %u\n", kernel, round);
+        failures++;
+    };
+
+    uint32_t seed = 12345;
+    auto component = [&seed]() -> int16_t {
+        seed = seed * 1103515245 + 12345;
+        uint32_t bits = seed >> 8;
+        if ((bits & 7) == 0) return bits & 8 ? GEOMETRY_RANGE : -GEOMETRY_RANGE;
+        return int32_t(bits % (2 * GEOMETRY_RANGE + 1)) - GEOMETRY_RANGE;
+    };
+    auto vector = [&component]() { return ShortVec3{component(), component(), component()}; };
+    auto dot = [](const ShortVec3& a, const ShortVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; };
+    auto cross2D = [](int32_t ux, int32_t uz, int32_t vx, int32_t vz) { return ux * vz - uz * vx; };
+
+    for (unsigned round = 0; round < 1000; round++) {
+        ShortVec3 a = vector(), b = vector(), c = vector(), p = vector();
+
+        LongVec3 cross;
+        psxsplash::CrossProductsGTE(&a, &b, &cross, 1);
+        if (cross.x != a.y * b.z - a.z * b.y || cross.y != a.z * b.x - a.x * b.z || cross.z != a.x * b.y - a.y * b.x) {
+            fail("op cross product", round);
+        }
+
+        ShortVec3 rows[3] = {a, b, c};
+        LongVec3 dots;
+        psxsplash::DotProductsGTE(rows, &p, &dots, 1);
+        if (dots.x != dot(a, p) || dots.y != dot(b, p) || dots.z != dot(c, p)) fail("mvmva dot products", round);
+
+        int32_t length;
+        psxsplash::SquaredLengthsGTE(&a, &length, 1);
+        if (length != dot(a, a)) fail("sqr squared length", round);
+
+        LongVec3 edges;
+        psxsplash::EdgeFunctionsXZGTE(a, b, c, &p, &edges, 1);
+        if (edges.x != cross2D(b.x - a.x, b.z - a.z, p.x - a.x, p.z - a.z) ||
+            edges.y != cross2D(c.x - b.x, c.z - b.z, p.x - b.x, p.z - b.z) ||
+            edges.z != cross2D(a.x - c.x, a.z - c.z, p.x - c.x, p.z - c.z)) {
+            fail("mvmva edge functions", round);
+        }
+    }
+    return failures;
+}
+
+// Moves objects through the cells of a broadphase, large ones included, drops them and brings them back,
+// shifts the origin, and compares its queries and trigger events with a scan of every box
+unsigned checkBroadphase() {
+    using psxsplash::Box;
+    using psxsplash::Broadphase;
+    constexpr unsigned OBJECTS = 160;
+    constexpr unsigned TRIGGERS = 32;
+    constexpr int32_t CELL = 1 << Broadphase::CELL_SHIFT;
+    // More cells than buckets, so that cells share them
+    constexpr int32_t WORLD = 24 * CELL;
+    unsigned failures = 0;
+    auto fail = [&failures](const char* what, unsigned round) {
+        fprintf(stderr, "broadphase: %s in round %u\n", what, round);
+        failures++;
+    };
+
+    uint32_t seed = 777;
+    auto random = [&seed](int32_t low, int32_t high) {
+        seed = seed * 1103515245 + 12345;
+        return low + int32_t((seed >> 8) % uint32_t(high - low + 1));
+    };
+    auto fixed = [](int32_t raw) { return psyqo::FixedPoint<12>(raw, psyqo::FixedPoint<12>::RAW); };
+    auto randomBox = [&](int32_t halfSize) {
+        int32_t x = random(-WORLD, WORLD), y = random(-CELL, CELL), z = random(-WORLD, WORLD);
+        int32_t w = random(0, halfSize), h = random(0, halfSize), d = random(0, halfSize);
+        return Box{{fixed(x - w), fixed(y - h), fixed(z - d)}, {fixed(x + w), fixed(y + h), fixed(z + d)}};
+    };
+    auto overlaps = [](const Box& a, const Box& b) {
+        return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y &&
+               a.min.z <= b.max.z && b.min.z <= a.max.z;
+    };
+    // Large entries are the ones wider than two cells
+    auto randomRadius = [&]() { return random(1, 8) == 8 ? random(CELL + 1, 0xffff) : random(0, CELL / 2); };
+
+    static psxsplash::GameObject objects[OBJECTS];
+    std::vector<bool> present(OBJECTS, true);
+    for (auto& go : objects) {
+        go.position = {fixed(random(-WORLD, WORLD)), fixed(random(-CELL, CELL)), fixed(random(-WORLD, WORLD))};
+        go.boundingRadius = randomRadius();
+    }
+    std::vector<psxsplash::TriggerVolume> triggers(TRIGGERS);
+    for (unsigned i = 0; i < TRIGGERS; i++) {
+        triggers[i].bounds = randomBox(random(1, 4) == 4 ? 3 * CELL : CELL / 2);
+        triggers[i].id = 1000 + i;
+    }
+    psxsplash::SplashPackLoader loader;
+    loader.objectTable = objects;
+    loader.objectCount = OBJECTS;
+    loader.triggers = triggers.data();
+    loader.triggerCount = TRIGGERS;
+
+    // Dropped at the center of a trigger, to be sure to get in and out of some
+    auto aroundTrigger = [&]() {
+        const Box& bounds = triggers[random(0, TRIGGERS - 1)].bounds;
+        psyqo::FixedPoint<12> half = fixed(CELL / 4);
+        psyqo::Vec3 center = {(bounds.min.x + bounds.max.x) / 2, (bounds.min.y + bounds.max.y) / 2,
+                              (bounds.min.z + bounds.max.z) / 2};
+        return Box{{center.x - half, center.y - half, center.z - half},
+                   {center.x + half, center.y + half, center.z + half}};
+    };
+
+    Broadphase broadphase;
+    broadphase.Start(loader);
+    Box tracked = aroundTrigger();
+    std::vector<uint16_t> inside;
+
+    for (unsigned round = 0; round < 100; round++) {
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            psxsplash::GameObject& go = objects[i];
+            int32_t roll = random(0, 99);
+            if (roll < 40) {
+                go.position.x += fixed(random(-CELL / 2, CELL / 2));
+                go.position.z += fixed(random(-CELL / 2, CELL / 2));
+            } else if (roll < 45) {
+                go.position = {fixed(random(-WORLD, WORLD)), fixed(random(-CELL, CELL)), fixed(random(-WORLD, WORLD))};
+            } else if (roll < 50) {
+                go.boundingRadius = randomRadius();
+            } else if (roll < 55) {
+                present[i] = !present[i];
+            }
+        }
+        // The streamer rebases triggers and objects alike
+        if (round % 25 == 24) {
+            int32_t x = random(-4, 4) * CELL, z = random(-4, 4) * CELL;
+            broadphase.Shift(x, z);
+            for (auto& trigger : triggers) {
+                trigger.bounds.min.x += fixed(x);
+                trigger.bounds.max.x += fixed(x);
+                trigger.bounds.min.z += fixed(z);
+                trigger.bounds.max.z += fixed(z);
+            }
+            for (auto& go : objects) {
+                go.position.x += fixed(x);
+                go.position.z += fixed(z);
+            }
+        }
+        eastl::vector<psxsplash::GameObject*> active;
+        for (unsigned i = 0; i < OBJECTS; i++) {
+            if (present[i]) active.push_back(&objects[i]);
+        }
+        broadphase.Update(active);
+
+        for (unsigned query = 0; query < 16; query++) {
+            // Some cover more cells than there are buckets
+            Box box = randomBox(random(1, 8) == 8 ? 40 * CELL : random(0, 6 * CELL));
+            std::vector<uint16_t> expected[2];
+            for (unsigned i = 0; i < OBJECTS; i++) {
+                psyqo::FixedPoint<12> radius(int32_t(objects[i].boundingRadius), psyqo::FixedPoint<12>::RAW);
+                const psyqo::Vec3& p = objects[i].position;
+                Box bounds = {{p.x - radius, p.y - radius, p.z - radius}, {p.x + radius, p.y + radius, p.z + radius}};
+                if (present[i] && overlaps(bounds, box)) expected[0].push_back(i);
+            }
+            for (auto& trigger : triggers) {
+                if (overlaps(trigger.bounds, box)) expected[1].push_back(trigger.id);
+            }
+            for (unsigned kind = 0; kind < 2; kind++) {
+                uint16_t ids[Broadphase::CAPACITY];
+                uint16_t count = broadphase.Query(box, kind ? Broadphase::Kind::Trigger : Broadphase::Kind::Object,
+                                                  ids, Broadphase::CAPACITY);
+                std::vector<uint16_t> found(ids, ids + count);
+                std::sort(found.begin(), found.end());
+                std::sort(expected[kind].begin(), expected[kind].end());
+                if (found != expected[kind]) fail(kind ? "trigger query" : "object query", round);
+            }
+        }
+
+        // A small box walking around, entering and leaving triggers
+        int32_t stepX = random(-CELL / 2, CELL / 2), stepZ = random(-CELL / 2, CELL / 2);
+        tracked.min.x += fixed(stepX);
+        tracked.max.x += fixed(stepX);
+        tracked.min.z += fixed(stepZ);
+        tracked.max.z += fixed(stepZ);
+        if (round % 4 == 3) tracked = aroundTrigger();
+        std::vector<uint16_t> now;
+        for (auto& trigger : triggers) {
+            if (overlaps(trigger.bounds, tracked)) now.push_back(trigger.id);
+        }
+        const Broadphase::TriggerEvents& events = broadphase.TrackTriggers(tracked);
+        std::vector<uint16_t> current(broadphase.Inside(), broadphase.Inside() + broadphase.InsideCount());
+        std::sort(now.begin(), now.end());
+        std::sort(current.begin(), current.end());
+        // Past MAX_INSIDE, which triggers are kept is up to the broadphase
+        if (now.size() <= Broadphase::MAX_INSIDE) {
+            std::vector<uint16_t> entered(events.entered, events.entered + events.enteredCount);
+            std::vector<uint16_t> exited(events.exited, events.exited + events.exitedCount);
+            std::vector<uint16_t> expectedEntered, expectedExited;
+            std::set_difference(now.begin(), now.end(), inside.begin(), inside.end(),
+                                std::back_inserter(expectedEntered));
+            std::set_difference(inside.begin(), inside.end(), now.begin(), now.end(),
+                                std::back_inserter(expectedExited));
+            std::sort(entered.begin(), entered.end());
+            std::sort(exited.begin(), exited.end());
+            if (current != now) fail("triggers tracked", round);
+            if (entered != expectedEntered) fail("triggers entered", round);
+            if (exited != expectedExited) fail("triggers exited", round);
+        }
+        inside = current;
+    }
+    return failures;
+}
+
+struct Corners {
+    int32_t v[3][3];
+};
+
+template <uint16_t material>
+const psxsplash::CompactRun* compactCorners(const psxsplash::CompactMesh& mesh, const psxsplash::CompactRun& run,
+                                            std::vector<Corners>& out) {
+    auto records = reinterpret_cast<const psxsplash::CompactTri<material>*>(&run + 1);
+    for (uint16_t i = 0; i < run.count; i++) {
+        Corners corners;
+        for (unsigned j = 0; j < 3; j++) {
+            uint32_t vertex = mesh.Vertices()[records[i].vertices[j]];
+            corners.v[j][0] = mesh.origin.x.raw() + int32_t((vertex & 0x7ff) << mesh.shift);
+            corners.v[j][1] = mesh.origin.y.raw() + int32_t(((vertex >> 16) & 0x7ff) << mesh.shift);
+            corners.v[j][2] = mesh.origin.z.raw() + int32_t(psxsplash::CompactMesh::VertexZ(vertex) << mesh.shift);
+        }
+        out.push_back(corners);
+    }
+    return reinterpret_cast<const psxsplash::CompactRun*>(records + run.count);
+}
+
+// Object space corners of the triangles of an object, numbered like RayHit::triangle
+std::vector<Corners> objectCorners(const psxsplash::GameObject& go) {
+    using psxsplash::TriFlags::FLAT;
+    using psxsplash::TriFlags::UNTEXTURED;
+    std::vector<Corners> out;
+    if (!go.IsCompact()) {
+        for (uint16_t i = 0; i < go.TriangleCount(); i++) {
+            const psxsplash::Tri& tri = go.polygons[i];
+            const psyqo::GTE::PackedVec3* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+            Corners corners;
+            for (unsigned j = 0; j < 3; j++) {
+                corners.v[j][0] = v[j]->x.raw();
+                corners.v[j][1] = v[j]->y.raw();
+                corners.v[j][2] = v[j]->z.raw();
+            }
+            out.push_back(corners);
+        }
+        return out;
+    }
+    const psxsplash::CompactMesh& mesh = *go.compact;
+    auto run = reinterpret_cast<const psxsplash::CompactRun*>(mesh.Vertices() + mesh.vertexCount);
+    for (uint16_t i = 0; i < mesh.runCount; i++) {
+        switch (run->flags & (UNTEXTURED | FLAT)) {
+            case 0:
+                run = compactCorners<0>(mesh, *run, out);
+                break;
+            case UNTEXTURED:
+                run = compactCorners<UNTEXTURED>(mesh, *run, out);
+                break;
+            case FLAT:
+                run = compactCorners<FLAT>(mesh, *run, out);
+                break;
+            default:
+                run = compactCorners<UNTEXTURED | FLAT>(mesh, *run, out);
+                break;
+        }
+    }
+    return out;
+}
+
+// Casts random segments at the objects of a pack, some longer than RayCaster::MAX_LENGTH, and compares the
+// hits with a floating point scan of every triangle in world space. The caster works in object space with
+// integers, so the scan allows for its rounding: hits that close to a triangle border, or grazing it, may
+// go either way.
+unsigned checkRaycast(psxsplash::SplashPackLoader& loader, const char* pack) {
+    using psxsplash::RayCaster;
+    unsigned failures = 0;
+    auto fail = [&failures, pack](const char* what, unsigned round) {
+        fprintf(stderr, "%s raycast %u: %s\n", pack, round, what);
+        failures++;
+    };
+    // Past the capacity of the broadphase, objects would be missed on purpose
+    if (loader.gameObjects.size() + loader.triggerCount > psxsplash::Broadphase::CAPACITY) return 0;
+
+    struct WorldTriangle {
+        const psxsplash::GameObject* object;
+        uint16_t index;
+        double v[3][3];
+    };
+    std::vector<WorldTriangle> triangles;
+    for (auto obj : loader.gameObjects) {
+        auto corners = objectCorners(*obj);
+        const psyqo::Vec3& p = obj->position;
+        double position[3] = {double(p.x.raw()), double(p.y.raw()), double(p.z.raw())};
+        for (size_t i = 0; i < corners.size(); i++) {
+            WorldTriangle triangle = {obj, uint16_t(i), {}};
+            for (unsigned j = 0; j < 3; j++) {
+                for (unsigned row = 0; row < 3; row++) {
+                    const psyqo::Vec3& r = obj->rotation.vs[row];
+                    triangle.v[j][row] = position[row] + (r.x.raw() * double(corners[i].v[j][0]) +
+                                                          r.y.raw() * double(corners[i].v[j][1]) +
+                                                          r.z.raw() * double(corners[i].v[j][2])) / 4096.0;
+                }
+            }
+            triangles.push_back(triangle);
+        }
+    }
+    if (triangles.empty()) return 0;
+
+    psxsplash::Broadphase broadphase;
+    broadphase.Start(loader);
+    broadphase.Update(loader.gameObjects);
+    RayCaster caster;
+    caster.Start(loader);
+
+    uint32_t seed = 2024;
+    auto random = [&seed](int32_t low, int32_t high) {
+        seed = seed * 1103515245 + 12345;
+        return low + int32_t((seed >> 8) % uint32_t(high - low + 1));
+    };
+    auto fixed = [](int32_t raw) { return psyqo::FixedPoint<12>(raw, psyqo::FixedPoint<12>::RAW); };
+
+    for (unsigned round = 0; round < 200; round++) {
+        // Mostly through a triangle, otherwise anywhere around its object
+        const WorldTriangle& target = triangles[random(0, triangles.size() - 1)];
+        int32_t aim[3];
+        if (random(1, 4) < 4) {
+            double a = random(0, 100) / 100.0, b = random(0, 100) / 100.0;
+            if (a + b > 1) a = 1 - a, b = 1 - b;
+            for (unsigned i = 0; i < 3; i++) {
+                aim[i] = int32_t(target.v[0][i] + a * (target.v[1][i] - target.v[0][i]) +
+                                 b * (target.v[2][i] - target.v[0][i]));
+            }
+        } else {
+            const psyqo::Vec3& position = target.object->position;
+            int32_t spread = eastl::max(int32_t(target.object->boundingRadius), 256);
+            aim[0] = position.x.raw() + random(-spread, spread);
+            aim[1] = position.y.raw() + random(-spread, spread);
+            aim[2] = position.z.raw() + random(-spread, spread);
+        }
+        double direction[3] = {double(random(-1024, 1024)), double(random(-1024, 1024)), double(random(-1024, 1024))};
+        double norm = sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+        if (norm == 0) continue;
+        // One in four longer than what the caster tests
+        double length = random(1, 4) == 4 ? random(RayCaster::MAX_LENGTH, 3 * RayCaster::MAX_LENGTH)
+                                           : random(RayCaster::MAX_LENGTH / 16, RayCaster::MAX_LENGTH);
+        double before = length * random(20, 80) / 100;
+        int32_t from[3], to[3];
+        for (unsigned i = 0; i < 3; i++) {
+            from[i] = aim[i] - int32_t(direction[i] / norm * before);
+            to[i] = from[i] + int32_t(direction[i] / norm * length);
+        }
+        int32_t delta[3] = {to[0] - from[0], to[1] - from[1], to[2] - from[2]};
+        int32_t longest = eastl::max(eastl::max(abs(delta[0]), abs(delta[1])), abs(delta[2]));
+        double limit = longest > RayCaster::MAX_LENGTH ? double(RayCaster::MAX_LENGTH) / longest : 1.0;
+        double d[3] = {double(delta[0]), double(delta[1]), double(delta[2])};
+        double segment = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+        // Too crowded for the caster to look at every object along the segment
+        psxsplash::Box box;
+        box.min = {fixed(eastl::min(from[0], from[0] + int32_t(d[0] * limit))),
+                   fixed(eastl::min(from[1], from[1] + int32_t(d[1] * limit))),
+                   fixed(eastl::min(from[2], from[2] + int32_t(d[2] * limit)))};
+        box.max = {fixed(eastl::max(from[0], from[0] + int32_t(d[0] * limit))),
+                   fixed(eastl::max(from[1], from[1] + int32_t(d[1] * limit))),
+                   fixed(eastl::max(from[2], from[2] + int32_t(d[2] * limit)))};
+        uint16_t ids[RayCaster::MAX_OBJECTS + 1];
+        if (broadphase.Query(box, psxsplash::Broadphase::Kind::Object, ids, RayCaster::MAX_OBJECTS + 1) >
+            RayCaster::MAX_OBJECTS) {
+            continue;
+        }
+
+        psxsplash::RayHit hit;
+        psyqo::Vec3 start = {fixed(from[0]), fixed(from[1]), fixed(from[2])};
+        psyqo::Vec3 end = {fixed(to[0]), fixed(to[1]), fixed(to[2])};
+        bool found = caster.Cast(start, end, broadphase, hit, {0xffff, 0xffff});
+        if (caster.Exhausted()) fail("ran out of an unlimited budget", round);
+
+        // Closest hit clear of any border, and whether the hit reported is on its triangle
+        double closest = 2;
+        double closestTolerance = 0;
+        bool reportedMatches = false;
+        for (const WorldTriangle& triangle : triangles) {
+            double e1[3], e2[3], s[3];
+            for (unsigned i = 0; i < 3; i++) {
+                e1[i] = triangle.v[1][i] - triangle.v[0][i];
+                e2[i] = triangle.v[2][i] - triangle.v[0][i];
+                s[i] = from[i] - triangle.v[0][i];
+            }
+            double p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+            double q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+            double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            double area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (det == 0 || area == 0) continue;
+            double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+            double w = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+            double t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+
+            // The caster moves the segment by its integer rounding and by how far the stored rotation is
+            // from an orthonormal one, which grows with the distance to the object
+            const psyqo::Vec3& position = triangle.object->position;
+            double reach = 0;
+            for (const int32_t* point : {from, to}) {
+                double x = point[0] - position.x.raw(), y = point[1] - position.y.raw(),
+                       z = point[2] - position.z.raw();
+                reach = eastl::max(reach, sqrt(x * x + y * y + z * z));
+            }
+            double slack = 16 + reach / 1024;
+            double cosine = fabs(det) / (segment * area);
+            double tolerance = slack / (segment * eastl::max(cosine, 0.05)) + 2.0 / 4096;
+            double longestEdge = 0;
+            for (unsigned j = 0; j < 3; j++) {
+                const double* a = triangle.v[j];
+                const double* b = triangle.v[(j + 1) % 3];
+                double x = b[0] - a[0], y = b[1] - a[1], z = b[2] - a[2];
+                longestEdge = eastl::max(longestEdge, sqrt(x * x + y * y + z * z));
+            }
+            // Of the barycentric coordinates, slack over the smallest height of the triangle
+            double border = slack * longestEdge / area;
+
+            bool clear = cosine >= 0.05 && u >= border && w >= border && u + w <= 1 - border && t >= tolerance &&
+                         t <= limit - tolerance;
+            if (clear && t < closest) {
+                closest = t;
+                closestTolerance = tolerance;
+            }
+            bool near = u >= -border && w >= -border && u + w <= 1 + border && t >= -tolerance &&
+                        t <= limit + tolerance;
+            if (found && near && triangle.object == hit.object && triangle.index == hit.triangle &&
+                fabs(t - hit.fraction.raw() / 4096.0) <= tolerance) {
+                reportedMatches = true;
+            }
+        }
+
+        if (!found) {
+            if (closest <= 1) fail("missed a triangle", round);
+            continue;
+        }
+        double fraction = hit.fraction.raw() / 4096.0;
+        if (!reportedMatches) fail("hit is not on the triangle it reports", round);
+        if (closest <= 1 && fraction > closest + closestTolerance) fail("hit is not the closest one", round);
+        double point[3] = {double(hit.point.x.raw()), double(hit.point.y.raw()), double(hit.point.z.raw())};
+        for (unsigned i = 0; i < 3; i++) {
+            if (fabs(point[i] - (from[i] + d[i] * fraction)) > segment / 4096 + 2) {
+                fail("hit point is not at its fraction of the segment", round);
+                break;
+            }
+        }
+    }
+    return failures;
+}
+
+// Draws a pool of particles in front of the camera with budgets above and below the particles in view, and
+// checks every sprite against its particle projected here: the first ones in view are drawn, up to the
+// budget, centered on their projection and sized by their depth.
+unsigned checkParticles(psyqo::GPU& gpu) {
+    using psxsplash::ParticlePool;
+    using psxsplash::Renderer;
+    unsigned failures = 0;
+    auto fail = [&failures](const char* what, unsigned budget) {
+        fprintf(stderr, "particles: %s with a budget of %u\n", what, budget);
+        failures++;
+    };
+
+    uint32_t seed = 99;
+    auto random = [&seed](int32_t low, int32_t high) {
+        seed = seed * 1103515245 + 12345;
+        return low + int32_t((seed >> 8) % uint32_t(high - low + 1));
+    };
+    auto fixed = [](int32_t raw) { return psyqo::FixedPoint<12>(raw, psyqo::FixedPoint<12>::RAW); };
+
+    static ParticlePool pool;
+    pool.Clear();
+    pool.SetLook(0, {});
+    psxsplash::ParticleLook textured = {};
+    textured.textured = true;
+    textured.semiTrans = true;
+    textured.u1 = 15;
+    textured.v1 = 15;
+    pool.SetLook(1, textured);
+
+    struct Sprite {
+        int32_t left, top, size;
+        bool textured;
+    };
+    // In pool order, some behind the camera or too close to it
+    std::vector<Sprite> inView;
+    for (unsigned i = 0; i < 200; i++) {
+        int32_t z = random(-512, 2047);
+        int32_t spread = z > 2 ? z / 2 : 512;
+        int32_t x = random(-spread, spread), y = random(-spread, spread);
+        uint16_t size = random(1, 4096);
+        uint8_t look = random(0, 1);
+        psyqo::Color color = {.r = uint8_t(random(0, 255)), .g = uint8_t(random(0, 255)), .b = 128};
+        pool.Spawn({fixed(x), fixed(y), fixed(z)}, {}, ParticlePool::PERMANENT, size, color, look);
+        if (z < Renderer::PARTICLE_NEAR_Z) continue;
+        int32_t pixels = eastl::min(int32_t(size) * Renderer::PROJECTION_H / z, Renderer::MAX_PARTICLE_SIZE);
+        if (pixels == 0) continue;
+        int32_t centerX = Renderer::SCREEN_WIDTH / 2 + x * Renderer::PROJECTION_H / z;
+        int32_t centerY = Renderer::SCREEN_HEIGHT / 2 + y * Renderer::PROJECTION_H / z;
+        inView.push_back({centerX - pixels / 2, centerY - pixels / 2, pixels, look == 1});
+    }
+
+    psxsplash::Camera camera;
+    auto& renderer = Renderer::GetInstance();
+    renderer.SetCamera(camera);
+    renderer.SetParticles(&pool);
+    eastl::vector<psxsplash::GameObject*> none;
+    for (unsigned budget : {unsigned(ParticlePool::CAPACITY), 50u, 0u}) {
+        pool.SetBudget(budget);
+        renderer.Render(none);
+        gpu.flip();
+
+        auto& stats = renderer.GetStats();
+        size_t drawn = eastl::min(inView.size(), size_t(budget));
+        if (stats.particlesDrawn != drawn) fail("particle count", budget);
+        if (stats.primitivesEmitted != stats.particlesDrawn) fail("primitive count", budget);
+        // The GTE rounds the projection its own way
+        std::vector<Sprite> expected(inView.begin(), inView.begin() + drawn);
+        unsigned sprites = 0;
+        for (auto& prim : gpu.lastFrame()) {
+            if (prim.z < 0) continue;
+            sprites++;
+            psyqo::Vertex a, b, c;
+            a.packed = prim.words[1];
+            Sprite sprite;
+            if ((prim.words[0] >> 24 & 0xe0) == 0x60) {
+                b.packed = prim.words[2];
+                sprite = {a.x, a.y, b.w, false};
+                if (b.w != b.h) fail("rectangle is not square", budget);
+            } else {
+                b.packed = prim.words[3];
+                c.packed = prim.words[5];
+                sprite = {a.x, a.y, b.x - a.x, true};
+                if (c.y - a.y != sprite.size) fail("quad is not square", budget);
+            }
+            auto match = std::find_if(expected.begin(), expected.end(), [&sprite](const Sprite& other) {
+                return other.textured == sprite.textured && other.size == sprite.size &&
+                       abs(other.left - sprite.left) <= 1 && abs(other.top - sprite.top) <= 1;
+            });
+            if (match == expected.end()) {
+                fail("sprite of no particle in view", budget);
+            } else {
+                expected.erase(match);
+            }
+        }
+        if (sprites != drawn) fail("sprites in the ordering table", budget);
+    }
+    renderer.SetParticles(nullptr);
+    return failures;
+}
+
+// Whether the navmesh has a triangle under the point, at full precision
+bool onNavmeshSoftware(const psxsplash::Navmesh& navmesh, const psyqo::Vec3& p) {
+    for (unsigned i = 0; i < navmesh.triangleCount; i++) {
+        const psxsplash::NavMeshTri& tri = navmesh.polygons[i];
+        const psyqo::Vec3* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+        int64_t edges[3];
+        for (unsigned j = 0; j < 3; j++) {
+            const psyqo::Vec3& start = *v[j];
+            const psyqo::Vec3& end = *v[(j + 1) % 3];
+            edges[j] = int64_t(end.x.raw() - start.x.raw()) * (p.z.raw() - start.z.raw()) -
+                       int64_t(end.z.raw() - start.z.raw()) * (p.x.raw() - start.x.raw());
+        }
+        if (edges[0] + edges[1] + edges[2] == 0) continue;
+        if ((edges[0] >= 0 && edges[1] >= 0 && edges[2] >= 0) || (edges[0] <= 0 && edges[1] <= 0 && edges[2] <= 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PackResult runPack(const char* path, psyqo::GPU& gpu, unsigned iterations, bool check) {
+    PackResult result;
+    auto data = readFile(path);
+    if (data.empty()) {
+        fprintf(stderr, "%s: unable to read\n", path);
+        result.failures++;
+        return result;
+    }
+
+    psxsplash::SplashPackLoader loader;
+    loader.LoadSplashpack(reinterpret_cast<uint8_t*>(data.data()));
+    // The views are all taken from the start sector, whose surroundings Start loads right away
+    psxsplash::JobScheduler jobs;
+    psxsplash::WorldStreamer streamer;
+    streamer.Start(loader, jobs);
+    psxsplash::TransformHierarchy hierarchy;
+    hierarchy.Start(loader);
+    // Animated objects are drawn in the pose of frame 0
+    psxsplash::VertexAnimator animator;
+    animator.Start(loader);
+    animator.Update(0);
+    psxsplash::NavmeshSelector navmeshes;
+    navmeshes.Start(loader);
+    uint16_t firstNavmesh, navmeshCount;
+    streamer.CurrentNavmeshes(firstNavmesh, navmeshCount);
+    for (auto obj : loader.gameObjects) result.triangles += obj->TriangleCount();
+    if (check) result.failures += checkRaycast(loader, path);
+
+    psxsplash::Camera camera;
+    auto& renderer = psxsplash::Renderer::GetInstance();
+    renderer.SetCamera(camera);
+    renderer.SetVertexAnimator(&animator);
+
+    psyqo::Vec3 start = {psyqo::FixedPoint<12>(loader.playerStartPos.x), psyqo::FixedPoint<12>(loader.playerStartPos.y),
+                         psyqo::FixedPoint<12>(loader.playerStartPos.z)};
+    psyqo::FixedPoint<12> height(loader.playerHeight);
+
+    for (unsigned view = 0; view < VIEW_COUNT; view++) {
+        camera.SetPosition(start.x, start.y, start.z);
+        if (navmeshCount > 0) {
+            auto position = camera.GetPosition();
+            bool onNavmesh = false;
+            for (uint16_t i = firstNavmesh; i < firstNavmesh + navmeshCount; i++) {
+                onNavmesh |= onNavmeshSoftware(*loader.navmeshes[i], position);
+            }
+            uint64_t cyclesBefore = psxsplash::softGTE().cycleCount();
+            auto t0 = std::chrono::steady_clock::now();
+            auto adjusted = navmeshes.ComputePosition(position, firstNavmesh, navmeshCount, -height);
+            auto t1 = std::chrono::steady_clock::now();
+            result.navmeshMicros += std::chrono::duration<double, std::micro>(t1 - t0).count();
+            result.navmeshCycles += psxsplash::softGTE().cycleCount() - cyclesBefore;
+            // Points on the navmesh only get their height changed
+            bool moved = adjusted.x.raw() != start.x.raw() || adjusted.z.raw() != start.z.raw();
+            if (check && onNavmesh == moved) {
+                fprintf(stderr, "%s view %u: navmesh query disagrees with the software one\n", path, view);
+                result.failures++;
+            }
+            camera.SetPosition(adjusted.x, adjusted.y, adjusted.z);
+        }
+        psyqo::Angle yaw = 0.25_pi * int(view);
+        camera.SetRotation(0.0_pi, yaw, 0.0_pi);
+
+        uint64_t commandsBefore = psxsplash::softGTE().commandCount();
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            renderer.Render(loader.gameObjects);
+            gpu.flip();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        result.renderMicros += std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+        result.gteCommands += (psxsplash::softGTE().commandCount() - commandsBefore) / iterations;
+
+        auto& stats = renderer.GetStats();
+        result.drawn += stats.trianglesDrawn;
+        result.primitives += stats.primitivesEmitted;
+        result.reused += stats.primitivesReused;
+        if (stats.bytesAllocated > result.bytes) result.bytes = stats.bytesAllocated;
+        result.hash = result.hash * 31 + hashFrame(gpu);
+        if (check) result.failures += checkFrame(gpu, stats, path, view);
+    }
+
+    result.renderMicros /= VIEW_COUNT;
+    result.navmeshMicros /= VIEW_COUNT;
+    result.navmeshCycles /= VIEW_COUNT;
+    result.drawn /= VIEW_COUNT;
+    result.primitives /= VIEW_COUNT;
+    result.reused /= VIEW_COUNT;
+    result.gteCommands /= VIEW_COUNT;
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned iterations = 20;
+    bool check = false;
+    bool hash = false;
+    std::vector<const char*> packs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = strtoul(argv[++i], nullptr, 0);
+            if (iterations == 0) iterations = 1;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        } else if (strcmp(argv[i], "--hash") == 0) {
+            hash = true;
+        } else {
+            packs.push_back(argv[i]);
+        }
+    }
+    if (packs.empty()) {
+        fprintf(stderr, "usage: %s [--iterations N] [--check] [--hash] pack.bin...\n", argv[0]);
+        return 1;
+    }
+
+    psyqo::GPU gpu;
+    psxsplash::Renderer::Init(gpu);
+
+    printf("%-28s %9s %7s %7s %7s %8s %9s %10s %10s %10s", "pack", "triangles", "drawn", "prims", "reused",
+           "bytes", "gte_cmds", "render_us", "navmesh_us", "navmesh_cy");
+    if (hash) printf(" %16s", "hash");
+    printf("\n");
+
+    unsigned failures = check ? checkGeometry() + checkBroadphase() + checkParticles(gpu) : 0;
+    for (auto path : packs) {
+        auto result = runPack(path, gpu, iterations, check);
+        const char* name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        printf("%-28s %9u %7u %7u %7u %8u %9llu %10.1f %10.1f %10llu", name, result.triangles, result.drawn,
+               result.primitives, result.reused, result.bytes, (unsigned long long)result.gteCommands,
+               result.renderMicros, result.navmeshMicros, (unsigned long long)result.navmeshCycles);
+        if (hash) printf(" %016llx", (unsigned long long)result.hash);
+        printf("\n");
+        failures += result.failures;
+    }
+
+    if (check) printf("%u check failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
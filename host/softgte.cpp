@@ -0,0 +1,559 @@
+#include "softgte.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace psxsplash {
+
+namespace {
+
+// Data registers
+constexpr unsigned RGBC = 6, OTZ = 7, IR0 = 8, IR1 = 9, SXY0 = 12, SXY2 = 14, SXYP = 15, SZ0 = 16, SZ3 = 19,
+                   RGB0 = 20, RGB2 = 22, MAC0 = 24, MAC1 = 25, IRGB = 28, ORGB = 29, LZCS = 30, LZCR = 31;
+// Control registers
+constexpr unsigned TRX = 5, RBK = 13, RFC = 21, OFX = 24, OFY = 25, H = 26, DQA = 27, DQB = 28, ZSF3 = 29, FLAG = 31;
+
+// FLAG bits
+constexpr uint32_t FLAG_MAC_POSITIVE = 1u << 30;  // MAC1, MAC2 and MAC3 follow on bits 29 and 28
+constexpr uint32_t FLAG_MAC_NEGATIVE = 1u << 27;  // MAC1, MAC2 and MAC3 follow on bits 26 and 25
+constexpr uint32_t FLAG_IR = 1u << 24;            // IR1, IR2 and IR3 follow on bits 23 and 22
+constexpr uint32_t FLAG_COLOR = 1u << 21;  // G and B follow on bits 20 and 19
+constexpr uint32_t FLAG_SZ = 1u << 18;
+constexpr uint32_t FLAG_DIVIDE = 1u << 17;
+constexpr uint32_t FLAG_MAC0_POSITIVE = 1u << 16;
+constexpr uint32_t FLAG_MAC0_NEGATIVE = 1u << 15;
+constexpr uint32_t FLAG_SX = 1u << 14;
+constexpr uint32_t FLAG_SY = 1u << 13;
+constexpr uint32_t FLAG_IR0 = 1u << 12;
+constexpr uint32_t FLAG_ERROR = 1u << 31;
+constexpr uint32_t FLAG_ERROR_MASK = 0x7f87e000;
+
+int32_t signExtend16(uint32_t value) { return int16_t(value); }
+
+// Reciprocal table used by the hardware divider
+struct UnrTable {
+    uint8_t values[0x101];
+    UnrTable() {
+        for (int i = 0; i < 0x101; i++) {
+            int v = (0x40000 / (i + 0x100) + 1) / 2 - 0x101;
+            values[i] = v < 0 ? 0 : v;
+        }
+    }
+};
+const UnrTable s_unr;
+
+unsigned countLeadingZeros16(uint16_t value) {
+    unsigned count = 0;
+    for (uint16_t bit = 0x8000; bit != 0 && !(value & bit); bit >>= 1) count++;
+    return count;
+}
+
+}  // namespace
+
+SoftGTE& softGTE() {
+    static SoftGTE instance;
+    return instance;
+}
+
+void SoftGTE::reset() {
+    for (auto& reg : m_data) reg = 0;
+    for (auto& reg : m_ctrl) reg = 0;
+    m_commands = 0;
+    m_cycles = 0;
+}
+
+uint32_t SoftGTE::readData(unsigned reg) const {
+    switch (reg) {
+        case 1:
+        case 3:
+        case 5:
+        case IR0:
+        case IR1:
+        case IR1 + 1:
+        case IR1 + 2:
+            return signExtend16(m_data[reg]);
+        case OTZ:
+        case SZ0:
+        case SZ0 + 1:
+        case SZ0 + 2:
+        case SZ3:
+            return m_data[reg] & 0xffff;
+        case SXYP:
+            return m_data[SXY2];
+        case IRGB:
+        case ORGB: {
+            uint32_t result = 0;
+            for (unsigned i = 0; i < 3; i++) {
+                int32_t c = signExtend16(m_data[IR1 + i]) >> 7;
+                if (c < 0) c = 0;
+                if (c > 0x1f) c = 0x1f;
+                result |= c << (i * 5);
+            }
+            return result;
+        }
+        default:
+            return m_data[reg];
+    }
+}
+
+void SoftGTE::writeData(unsigned reg, uint32_t value) {
+    switch (reg) {
+        case SXYP:
+            m_data[SXY0] = m_data[SXY0 + 1];
+            m_data[SXY0 + 1] = m_data[SXY2];
+            m_data[SXY2] = value;
+            break;
+        case IRGB:
+            m_data[IRGB] = value & 0x7fff;
+            for (unsigned i = 0; i < 3; i++) {
+                m_data[IR1 + i] = ((value >> (i * 5)) & 0x1f) << 7;
+            }
+            break;
+        case ORGB:
+        case LZCR:
+            break;
+        case LZCS: {
+            m_data[LZCS] = value;
+            uint32_t bits = int32_t(value) < 0 ? ~value : value;
+            m_data[LZCR] = bits == 0 ? 32 : __builtin_clz(bits);
+            break;
+        }
+        default:
+            m_data[reg] = value;
+            break;
+    }
+}
+
+uint32_t SoftGTE::readControl(unsigned reg) const {
+    switch (reg) {
+        case 4:
+        case 12:
+        case 20:
+        case H:  // the hardware sign extends H when reading it back, even though it is unsigned
+        case DQA:
+        case 29:
+        case 30:
+            return signExtend16(m_ctrl[reg]);
+        case FLAG: {
+            uint32_t flag = m_ctrl[FLAG];
+            return (flag & FLAG_ERROR_MASK) ? flag | FLAG_ERROR : flag;
+        }
+        default:
+            return m_ctrl[reg];
+    }
+}
+
+void SoftGTE::writeControl(unsigned reg, uint32_t value) {
+    if (reg == FLAG) value &= 0x7ffff000;
+    m_ctrl[reg] = value;
+}
+
+void SoftGTE::execute(uint32_t command) {
+    bool sf = (command >> 19) & 1;
+    unsigned mx = (command >> 17) & 3;
+    unsigned v = (command >> 15) & 3;
+    unsigned cv = (command >> 13) & 3;
+    bool lm = (command >> 10) & 1;
+
+    switch (command & 0x3f) {
+        case 0x01:
+            rtps(sf, lm);
+            break;
+        case 0x06:
+            nclip();
+            break;
+        case 0x0c:
+            op(sf, lm);
+            break;
+        case 0x12:
+            mvmva(sf, lm, mx, v, cv);
+            break;
+        case 0x10:
+            dpcs(sf, lm);
+            break;
+        case 0x13:
+            ncds(sf, lm);
+            break;
+        case 0x16:
+            ncdt(sf, lm);
+            break;
+        case 0x1b:
+            nccs(sf, lm);
+            break;
+        case 0x28:
+            sqr(sf, lm);
+            break;
+        case 0x2a:
+            dpct(sf, lm);
+            break;
+        case 0x2d:
+            avsz3();
+            break;
+        case 0x30:
+            rtpt(sf, lm);
+            break;
+        case 0x3e:
+            gpl(sf, lm);
+            break;
+        case 0x3f:
+            ncct(sf, lm);
+            break;
+        default:
+            fprintf(stderr, "SoftGTE: unsupported command %08x\n", command);
+            abort();
+    }
+}
+
+int16_t SoftGTE::matrix(unsigned mx, unsigned row, unsigned col) const {
+    if (mx == 3) {
+        // Garbage matrix selected by mx = 3
+        int16_t red = (m_data[RGBC] & 0xff) << 4;
+        if (row == 0) return col == 0 ? -red : col == 1 ? red : signExtend16(m_data[IR0]);
+        return signExtend16(row == 1 ? m_ctrl[1] : m_ctrl[2]);
+    }
+    unsigned index = row * 3 + col;
+    uint32_t word = m_ctrl[mx * 8 + index / 2];
+    return int16_t(index & 1 ? word >> 16 : word);
+}
+
+int32_t SoftGTE::translation(unsigned cv, unsigned row) const {
+    switch (cv) {
+        case 0:
+            return m_ctrl[TRX + row];
+        case 1:
+            return m_ctrl[RBK + row];
+        case 2:
+            return m_ctrl[RFC + row];
+        default:
+            return 0;
+    }
+}
+
+int64_t SoftGTE::checkMac(unsigned index, int64_t value) {
+    if (value > 0x7ffffffffffll) {
+        setFlag(FLAG_MAC_POSITIVE >> (index - 1));
+    } else if (value < -0x80000000000ll) {
+        setFlag(FLAG_MAC_NEGATIVE >> (index - 1));
+    }
+    // The accumulator is 44 bits wide
+    return int64_t(uint64_t(value) << 20) >> 20;
+}
+
+int32_t SoftGTE::setMac(unsigned index, int64_t value, bool sf) {
+    int32_t result = int32_t(value >> (sf ? 12 : 0));
+    m_data[MAC0 + index] = result;
+    return result;
+}
+
+int32_t SoftGTE::setMac0(int64_t value) {
+    if (value > 0x7fffffffll) {
+        setFlag(FLAG_MAC0_POSITIVE);
+    } else if (value < -0x80000000ll) {
+        setFlag(FLAG_MAC0_NEGATIVE);
+    }
+    m_data[MAC0] = uint32_t(value);
+    return int32_t(value);
+}
+
+int16_t SoftGTE::saturateIR(unsigned index, int32_t value, bool lm) {
+    int32_t min = lm ? 0 : -0x8000;
+    if (value < min) {
+        setFlag(FLAG_IR >> (index - 1));
+        value = min;
+    } else if (value > 0x7fff) {
+        setFlag(FLAG_IR >> (index - 1));
+        value = 0x7fff;
+    }
+    m_data[IR0 + index] = uint32_t(value);
+    return value;
+}
+
+uint16_t SoftGTE::saturateSZ(int64_t value) {
+    if (value < 0) {
+        setFlag(FLAG_SZ);
+        return 0;
+    }
+    if (value > 0xffff) {
+        setFlag(FLAG_SZ);
+        return 0xffff;
+    }
+    return value;
+}
+
+int16_t SoftGTE::saturateSXY(unsigned axis, int64_t value) {
+    if (value < -0x400 || value > 0x3ff) {
+        setFlag(axis == 0 ? FLAG_SX : FLAG_SY);
+        return value < 0 ? -0x400 : 0x3ff;
+    }
+    return value;
+}
+
+int16_t SoftGTE::saturateIR0(int64_t value) {
+    if (value < 0 || value > 0x1000) {
+        setFlag(FLAG_IR0);
+        return value < 0 ? 0 : 0x1000;
+    }
+    return value;
+}
+
+uint32_t SoftGTE::divide(uint16_t h, uint16_t sz3) {
+    if (h >= sz3 * 2) {
+        setFlag(FLAG_DIVIDE);
+        return 0x1ffff;
+    }
+    unsigned shift = countLeadingZeros16(sz3);
+    uint64_t n = uint64_t(h) << shift;
+    uint64_t d = uint64_t(sz3) << shift;
+    uint64_t u = s_unr.values[(d - 0x7fc0) >> 7] + 0x101;
+    d = (0x2000080 - d * u) >> 8;
+    d = (0x0000080 + d * u) >> 8;
+    uint64_t result = (n * d + 0x8000) >> 16;
+    return result > 0x1ffff ? 0x1ffff : uint32_t(result);
+}
+
+void SoftGTE::begin(unsigned cycles) {
+    m_commands++;
+    m_cycles += cycles;
+    m_ctrl[FLAG] = 0;
+}
+
+void SoftGTE::pushSZ(uint16_t z) {
+    for (unsigned i = SZ0; i < SZ3; i++) m_data[i] = m_data[i + 1];
+    m_data[SZ3] = z;
+}
+
+void SoftGTE::pushSXY(int16_t x, int16_t y) {
+    m_data[SXY0] = m_data[SXY0 + 1];
+    m_data[SXY0 + 1] = m_data[SXY2];
+    m_data[SXY2] = uint16_t(x) | (uint32_t(uint16_t(y)) << 16);
+}
+
+void SoftGTE::rtp(unsigned n, bool sf, bool lm, bool last) {
+    int64_t mac[3];
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t acc = checkMac(i + 1, int64_t(int32_t(m_ctrl[TRX + i])) * 0x1000);
+        acc = checkMac(i + 1, acc + int32_t(matrix(0, i, 0)) * vx(n));
+        acc = checkMac(i + 1, acc + int32_t(matrix(0, i, 1)) * vy(n));
+        acc = checkMac(i + 1, acc + int32_t(matrix(0, i, 2)) * vz(n));
+        mac[i] = acc;
+        setMac(i + 1, acc, sf);
+    }
+
+    int32_t ir1 = saturateIR(1, int32_t(mac[0] >> (sf ? 12 : 0)), lm);
+    int32_t ir2 = saturateIR(2, int32_t(mac[1] >> (sf ? 12 : 0)), lm);
+
+    // IR3 is saturated from MAC3 as usual, but its flag only looks at MAC3 >> 12
+    int32_t mac3 = int32_t(mac[2] >> (sf ? 12 : 0));
+    int32_t ir3Min = lm ? 0 : -0x8000;
+    m_data[IR1 + 2] = uint32_t(mac3 < ir3Min ? ir3Min : mac3 > 0x7fff ? 0x7fff : mac3);
+    int64_t z = mac[2] >> 12;
+    if (z < -0x8000 || z > 0x7fff) setFlag(FLAG_IR >> 2);
+
+    uint16_t sz3 = saturateSZ(z);
+    pushSZ(sz3);
+
+    int64_t hOverZ = divide(m_ctrl[H] & 0xffff, sz3);
+    int64_t sx = int64_t(int32_t(m_ctrl[OFX])) + ir1 * hOverZ;
+    setMac0(sx);
+    int64_t sy = int64_t(int32_t(m_ctrl[OFY])) + ir2 * hOverZ;
+    setMac0(sy);
+    pushSXY(saturateSXY(0, sx >> 16), saturateSXY(1, sy >> 16));
+
+    if (last) {
+        int64_t depth = int64_t(int32_t(m_ctrl[DQB])) + signExtend16(m_ctrl[DQA]) * hOverZ;
+        setMac0(depth);
+        m_data[IR0] = uint32_t(saturateIR0(depth >> 12));
+    }
+}
+
+void SoftGTE::rtps(bool sf, bool lm) {
+    begin(15);
+    rtp(0, sf, lm, true);
+}
+
+void SoftGTE::rtpt(bool sf, bool lm) {
+    begin(23);
+    rtp(0, sf, lm, false);
+    rtp(1, sf, lm, false);
+    rtp(2, sf, lm, true);
+}
+
+void SoftGTE::nclip() {
+    begin(8);
+    int64_t sx[3], sy[3];
+    for (unsigned i = 0; i < 3; i++) {
+        sx[i] = int16_t(m_data[SXY0 + i]);
+        sy[i] = int16_t(m_data[SXY0 + i] >> 16);
+    }
+    setMac0(sx[0] * sy[1] + sx[1] * sy[2] + sx[2] * sy[0] - sx[0] * sy[2] - sx[1] * sy[0] - sx[2] * sy[1]);
+}
+
+void SoftGTE::avsz3() {
+    begin(5);
+    int64_t sum = int64_t(m_data[SZ0 + 1] & 0xffff) + (m_data[SZ0 + 2] & 0xffff) + (m_data[SZ3] & 0xffff);
+    int64_t mac0 = setMac0(signExtend16(m_ctrl[ZSF3]) * sum);
+    m_data[OTZ] = saturateSZ(mac0 >> 12);
+}
+
+// Cross product of the rotation matrix diagonal with IR
+void SoftGTE::op(bool sf, bool lm) {
+    begin(6);
+    int64_t d[3], ir[3];
+    for (unsigned i = 0; i < 3; i++) {
+        d[i] = matrix(0, i, i);
+        ir[i] = signExtend16(m_data[IR1 + i]);
+    }
+    for (unsigned i = 0; i < 3; i++) {
+        unsigned j = (i + 1) % 3, k = (i + 2) % 3;
+        int64_t acc = checkMac(i + 1, d[j] * ir[k] - d[k] * ir[j]);
+        saturateIR(i + 1, setMac(i + 1, acc, sf), lm);
+    }
+}
+
+void SoftGTE::sqr(bool sf, bool lm) {
+    begin(5);
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t ir = signExtend16(m_data[IR1 + i]);
+        saturateIR(i + 1, setMac(i + 1, checkMac(i + 1, ir * ir), sf), lm);
+    }
+}
+
+// MAC plus IR scaled by IR0, through the color FIFO like the other color commands
+void SoftGTE::gpl(bool sf, bool lm) {
+    begin(5);
+    int32_t ir0 = signExtend16(m_data[IR0]);
+    int64_t mac[3];
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t base = int64_t(int32_t(m_data[MAC1 + i])) << (sf ? 12 : 0);
+        mac[i] = checkMac(i + 1, base + int64_t(signExtend16(m_data[IR1 + i])) * ir0);
+    }
+    pushColor(mac, sf, lm, false);
+}
+
+void SoftGTE::mvmva(bool sf, bool lm, unsigned mx, unsigned v, unsigned cv) {
+    begin(8);
+
+    int32_t vec[3];
+    if (v == 3) {
+        for (unsigned i = 0; i < 3; i++) vec[i] = signExtend16(m_data[IR1 + i]);
+    } else {
+        vec[0] = vx(v);
+        vec[1] = vy(v);
+        vec[2] = vz(v);
+    }
+
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t acc;
+        if (cv == 2) {
+            // Hardware bug: the far color and first column only reach the flags
+            int64_t discarded = checkMac(i + 1, int64_t(translation(cv, i)) * 0x1000);
+            discarded = checkMac(i + 1, discarded + int32_t(matrix(mx, i, 0)) * vec[0]);
+            saturateIR(i + 1, int32_t(discarded >> (sf ? 12 : 0)), false);
+            acc = checkMac(i + 1, int32_t(matrix(mx, i, 1)) * vec[1]);
+        } else {
+            acc = checkMac(i + 1, int64_t(translation(cv, i)) * 0x1000);
+            acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 0)) * vec[0]);
+            acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 1)) * vec[1]);
+        }
+        acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 2)) * vec[2]);
+        saturateIR(i + 1, setMac(i + 1, acc, sf), lm);
+    }
+}
+
+// Matrix times vector plus translation, for the commands that don't have mvmva's far color bug
+void SoftGTE::multiply(unsigned mx, const int32_t vec[3], unsigned cv, bool sf, bool lm) {
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t acc = checkMac(i + 1, int64_t(translation(cv, i)) * 0x1000);
+        acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 0)) * vec[0]);
+        acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 1)) * vec[1]);
+        acc = checkMac(i + 1, acc + int32_t(matrix(mx, i, 2)) * vec[2]);
+        saturateIR(i + 1, setMac(i + 1, acc, sf), lm);
+    }
+}
+
+uint8_t SoftGTE::saturateColor(unsigned index, int32_t value) {
+    if (value < 0 || value > 0xff) {
+        setFlag(FLAG_COLOR >> index);
+        return value < 0 ? 0 : 0xff;
+    }
+    return value;
+}
+
+// Last steps shared by the color commands: optionally fades MAC towards the far
+// color by IR0, then shifts it and pushes it on the color FIFO
+void SoftGTE::pushColor(int64_t mac[3], bool sf, bool lm, bool depthCue) {
+    if (depthCue) {
+        int32_t ir0 = signExtend16(m_data[IR0]);
+        for (unsigned i = 0; i < 3; i++) {
+            int64_t delta = checkMac(i + 1, (int64_t(int32_t(m_ctrl[RFC + i])) << 12) - mac[i]);
+            int32_t ir = saturateIR(i + 1, int32_t(delta >> (sf ? 12 : 0)), false);
+            mac[i] = checkMac(i + 1, int64_t(ir) * ir0 + mac[i]);
+        }
+    }
+
+    uint32_t result = m_data[RGBC] & 0xff000000;
+    for (unsigned i = 0; i < 3; i++) {
+        int32_t value = setMac(i + 1, mac[i], sf);
+        saturateIR(i + 1, value, lm);
+        result |= uint32_t(saturateColor(i, value >> 4)) << (i * 8);
+    }
+
+    m_data[RGB0] = m_data[RGB0 + 1];
+    m_data[RGB0 + 1] = m_data[RGB2];
+    m_data[RGB2] = result;
+}
+
+void SoftGTE::nc(unsigned n, bool sf, bool lm, bool depthCue) {
+    int32_t normal[3] = {vx(n), vy(n), vz(n)};
+    multiply(1, normal, 3, sf, lm);
+
+    int32_t light[3];
+    for (unsigned i = 0; i < 3; i++) light[i] = signExtend16(m_data[IR1 + i]);
+    multiply(2, light, 1, sf, lm);
+
+    int64_t mac[3];
+    for (unsigned i = 0; i < 3; i++) {
+        int64_t color = (m_data[RGBC] >> (i * 8)) & 0xff;
+        mac[i] = checkMac(i + 1, (color * signExtend16(m_data[IR1 + i])) << 4);
+    }
+    pushColor(mac, sf, lm, depthCue);
+}
+
+void SoftGTE::dpc(uint32_t rgb, bool sf, bool lm) {
+    int64_t mac[3];
+    for (unsigned i = 0; i < 3; i++) mac[i] = int64_t((rgb >> (i * 8)) & 0xff) << 16;
+    pushColor(mac, sf, lm, true);
+}
+
+void SoftGTE::nccs(bool sf, bool lm) {
+    begin(17);
+    nc(0, sf, lm, false);
+}
+
+void SoftGTE::ncct(bool sf, bool lm) {
+    begin(39);
+    for (unsigned n = 0; n < 3; n++) nc(n, sf, lm, false);
+}
+
+void SoftGTE::ncds(bool sf, bool lm) {
+    begin(19);
+    nc(0, sf, lm, true);
+}
+
+void SoftGTE::ncdt(bool sf, bool lm) {
+    begin(44);
+    for (unsigned n = 0; n < 3; n++) nc(n, sf, lm, true);
+}
+
+void SoftGTE::dpcs(bool sf, bool lm) {
+    begin(8);
+    dpc(m_data[RGBC], sf, lm);
+}
+
+// Each step reads the oldest FIFO entry, so the three colors come out in order
+void SoftGTE::dpct(bool sf, bool lm) {
+    begin(17);
+    for (unsigned n = 0; n < 3; n++) dpc(m_data[RGB0], sf, lm);
+}
+
+}  // namespace psxsplash
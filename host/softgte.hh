@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace psxsplash {
+
+// Bit-accurate software implementation of the parts of the GTE the engine
+// uses, following the psx-spx description of the hardware. Registers are
+// numbered like the hardware: 0-31 for the data registers (mfc2/mtc2) and
+// 0-31 for the control registers (cfc2/ctc2).
+class SoftGTE final {
+  public:
+    SoftGTE() { reset(); }
+
+    void reset();
+
+    uint32_t readData(unsigned reg) const;
+    void writeData(unsigned reg, uint32_t value);
+    uint32_t readControl(unsigned reg) const;
+    void writeControl(unsigned reg, uint32_t value);
+
+    // Decodes and runs a cop2 command word, as psyqo's kernels would emit it
+    void execute(uint32_t command);
+
+    void rtps(bool sf, bool lm);
+    void rtpt(bool sf, bool lm);
+    void nclip();
+    void avsz3();
+    void op(bool sf, bool lm);
+    void sqr(bool sf, bool lm);
+    void gpl(bool sf, bool lm);
+    // mx: 0 = RT, 1 = LLM, 2 = LCM. v: 0-2 = V0-V2, 3 = IR. cv: 0 = TR, 1 = BK, 2 = FC, 3 = none
+    void mvmva(bool sf, bool lm, unsigned mx, unsigned v, unsigned cv);
+    void nccs(bool sf, bool lm);
+    void ncct(bool sf, bool lm);
+    void ncds(bool sf, bool lm);
+    void ncdt(bool sf, bool lm);
+    void dpcs(bool sf, bool lm);
+    void dpct(bool sf, bool lm);
+
+    // Amount of commands run since the last reset, for the host benchmarks
+    uint64_t commandCount() const { return m_commands; }
+    // Cycles the hardware would have spent on them, from the psx-spx timings
+    uint64_t cycleCount() const { return m_cycles; }
+
+  private:
+    int16_t vx(unsigned n) const { return int16_t(m_data[n * 2]); }
+    int16_t vy(unsigned n) const { return int16_t(m_data[n * 2] >> 16); }
+    int16_t vz(unsigned n) const { return int16_t(m_data[n * 2 + 1]); }
+
+    int16_t matrix(unsigned mx, unsigned row, unsigned col) const;
+    int32_t translation(unsigned cv, unsigned row) const;
+
+    int64_t checkMac(unsigned index, int64_t value);
+    int32_t setMac(unsigned index, int64_t value, bool sf);
+    int32_t setMac0(int64_t value);
+    int16_t saturateIR(unsigned index, int32_t value, bool lm);
+    uint16_t saturateSZ(int64_t value);
+    int16_t saturateSXY(unsigned axis, int64_t value);
+    int16_t saturateIR0(int64_t value);
+    uint32_t divide(uint16_t h, uint16_t sz3);
+
+    // Common start of every command
+    void begin(unsigned cycles);
+    void pushSZ(uint16_t z);
+    void pushSXY(int16_t x, int16_t y);
+    void rtp(unsigned n, bool sf, bool lm, bool last);
+    void multiply(unsigned mx, const int32_t vec[3], unsigned cv, bool sf, bool lm);
+    uint8_t saturateColor(unsigned index, int32_t value);
+    void pushColor(int64_t mac[3], bool sf, bool lm, bool depthCue);
+    void nc(unsigned n, bool sf, bool lm, bool depthCue);
+    void dpc(uint32_t rgb, bool sf, bool lm);
+
+    void setFlag(uint32_t bit) { m_ctrl[31] |= bit; }
+
+    uint32_t m_data[32];
+    uint32_t m_ctrl[32];
+    uint64_t m_commands;
+    uint64_t m_cycles;
+};
+
+// The instance the host psyqo/gte-*.hh headers talk to
+SoftGTE& softGTE();
+
+}  // namespace psxsplash
@@ -0,0 +1,109 @@
+#include "benchmark.hh"
+
+#include <common/hardware/pcsxhw.h>
+#include <common/syscalls/syscalls.h>
+
+namespace psxsplash {
+
+// The recorded path, replayed from the player start of every pack. A new one
+// can be captured with `make BENCHMARK=record` and pasted in here.
+static constexpr BenchmarkSegment s_path[] = {
+    {0, 0, 0, 0, 30},        // settle
+    {0, 0, 127, 0, 120},     // full turn to the right
+    {0, -127, 0, 0, 90},     // walk forward
+    {0, -127, -64, 0, 60},   // walk while turning left
+    {0, 0, 0, -96, 30},      // look up
+    {0, 0, 0, 96, 60},       // look down
+    {0, 0, 0, -96, 30},      // back to the horizon
+    {127, 0, 0, 0, 60},      // strafe right
+    {-127, -127, 0, 0, 60},  // diagonal forward left
+    {0, 127, 0, 0, 90},      // walk backwards
+    {0, 0, -127, 0, 120},    // full turn to the left
+    {0, 0, 0, 0, 30},        // standing still
+};
+
+static constexpr uint16_t s_pathLength = sizeof(s_path) / sizeof(s_path[0]);
+
+void Benchmark::Start(uint8_t packCount) {
+    m_pack = packCount - 1;
+    m_segment = 0;
+    m_segmentFrame = 0;
+    m_frame = 0;
+    ramsyscall_printf("BENCH_START packs=%i\n", packCount);
+}
+
+void Benchmark::BeginPack(const SplashPackLoader& loader) {
+    uint32_t triangles = 0;
+    for (auto obj : loader.gameObjects) {
+        triangles += obj->TriangleCount();
+    }
+    ramsyscall_printf("BENCH_PACK %i objects=%i triangles=%i navmeshes=%i\n", m_pack, loader.gameObjects.size(),
+                      triangles, loader.navmeshes.size());
+}
+
+bool Benchmark::NextInput(BenchmarkInput& input) {
+    while (m_segment < s_pathLength && m_segmentFrame >= s_path[m_segment].frames) {
+        m_segment++;
+        m_segmentFrame = 0;
+    }
+    if (m_segment >= s_pathLength) return false;
+
+    const BenchmarkSegment& segment = s_path[m_segment];
+    input.leftX = segment.leftX;
+    input.leftY = segment.leftY;
+    input.rightX = segment.rightX;
+    input.rightY = segment.rightY;
+    m_segmentFrame++;
+    return true;
+}
+
+bool Benchmark::NextPack() {
+    ramsyscall_printf("BENCH_END %i\n", m_pack);
+    m_segment = 0;
+    m_segmentFrame = 0;
+    m_frame = 0;
+    if (m_pack == 0) return false;
+    m_pack--;
+    return true;
+}
+
+void Benchmark::ReportFrame(uint32_t cpuTime, uint32_t renderTime, uint32_t vsyncs, const RenderStats& stats) {
+    // pack frame cpu_us render_us vsyncs tested backface depth drawn prims dropped subdiv bytes
+    ramsyscall_printf("BENCH %i %i %i %i %i %i %i %i %i %i %i %i %i\n", m_pack, m_frame, cpuTime, renderTime, vsyncs,
+                      stats.trianglesTested, stats.trianglesBackfaceCulled, stats.trianglesDepthCulled,
+                      stats.trianglesDrawn, stats.primitivesEmitted, stats.primitivesDropped, stats.subdivisions,
+                      stats.bytesAllocated);
+    m_frame++;
+}
+
+void Benchmark::Finish() {
+    m_finished = true;
+    ramsyscall_printf("BENCH_DONE\n");
+    pcsx_exit(0);
+}
+
+void Benchmark::Record(const BenchmarkInput& input, int16_t deadzone) {
+    auto quantize = [deadzone](int16_t value) -> int8_t {
+        if (__builtin_abs(value) <= deadzone) return 0;
+        if (value > 127) return 127;
+        return value;
+    };
+
+    BenchmarkSegment current = {quantize(input.leftX), quantize(input.leftY), quantize(input.rightX),
+                                quantize(input.rightY), 0};
+    bool same = current.leftX == m_recording.leftX && current.leftY == m_recording.leftY &&
+                current.rightX == m_recording.rightX && current.rightY == m_recording.rightY;
+
+    if (same && m_recording.frames < 0xffff) {
+        m_recording.frames++;
+        return;
+    }
+    if (m_recording.frames > 0) {
+        ramsyscall_printf("    {%i, %i, %i, %i, %i},\n", m_recording.leftX, m_recording.leftY, m_recording.rightX,
+                          m_recording.rightY, m_recording.frames);
+    }
+    m_recording = current;
+    m_recording.frames = 1;
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "renderer.hh"
+#include "splashpack.hh"
+
+namespace psxsplash {
+
+// One segment of a recorded input path. The stick offsets (already centered
+// around 0) are held for `frames` frames.
+struct BenchmarkSegment {
+    int8_t leftX, leftY;
+    int8_t rightX, rightY;
+    uint16_t frames;
+};
+
+struct BenchmarkInput {
+    int16_t leftX, leftY;
+    int16_t rightX, rightY;
+};
+
+// Replays the recorded input path over every embedded splashpack and prints
+// per-frame timings and renderer counters to the TTY. The output is parsed by
+// tools/benchmark.py, so keep the line formats in sync with it.
+class Benchmark final {
+  public:
+    // Starts with the pack that is loaded first (the last one in the list)
+    void Start(uint8_t packCount);
+
+    uint8_t CurrentPack() const { return m_pack; }
+
+    // Prints the pack header, call right after the pack has been loaded
+    void BeginPack(const SplashPackLoader& loader);
+
+    // Fills in the input of the current frame. Returns false once the path
+    // has been fully replayed for the current pack.
+    bool NextInput(BenchmarkInput& input);
+
+    // Moves on to the next pack. Returns false once all of them have been run.
+    bool NextPack();
+
+    // cpuTime and renderTime are in microseconds, vsyncs is the amount of
+    // vertical blanks since the previous frame.
+    void ReportFrame(uint32_t cpuTime, uint32_t renderTime, uint32_t vsyncs, const RenderStats& stats);
+
+    // Prints the end marker and exits the emulator when running under PCSX-Redux
+    void Finish();
+    bool Finished() const { return m_finished; }
+
+    // Run-length encodes the live input and prints it as BenchmarkSegment
+    // initializers, so a new path can be pasted into benchmark.cpp.
+    void Record(const BenchmarkInput& input, int16_t deadzone);
+
+  private:
+    uint8_t m_pack = 0;
+    uint16_t m_segment = 0;
+    uint16_t m_segmentFrame = 0;
+    uint32_t m_frame = 0;
+    bool m_finished = false;
+
+    BenchmarkSegment m_recording = {};
+};
+
+}  // namespace psxsplash
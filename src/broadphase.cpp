@@ -0,0 +1,198 @@
+#include "broadphase.hh"
+
+#include <psyqo/kernel.hh>
+
+#include "splashpack.hh"
+
+namespace psxsplash {
+
+static bool overlaps(const Box &a, const Box &b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y &&
+           a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+static bool contains(const uint16_t *ids, uint8_t count, uint16_t id) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (ids[i] == id) return true;
+    }
+    return false;
+}
+
+void Broadphase::Start(SplashPackLoader &loader) {
+    for (auto &bucket : m_buckets) bucket = NONE;
+    m_large = NONE;
+    m_free = NONE;
+    for (uint16_t i = CAPACITY; i-- > 0;) {
+        m_entries[i].used = false;
+        m_entries[i].next = m_free;
+        m_free = i;
+    }
+    m_objects = loader.objectTable;
+    m_entryOf.assign(loader.objectCount, NONE);
+    m_insideCount = 0;
+    m_events = {};
+
+    for (uint16_t i = 0; i < loader.triggerCount; i++) {
+        uint16_t index = allocate();
+        psyqo::Kernel::assert(index != NONE, "Splashpack has too many triggers");
+        m_entries[index].kind = Kind::Trigger;
+        m_entries[index].id = loader.triggers[i].id;
+        place(index, loader.triggers[i].bounds);
+    }
+}
+
+void Broadphase::Update(const eastl::vector<GameObject *> &objects) {
+    m_stamp++;
+    for (GameObject *go : objects) {
+        uint16_t object = go - m_objects;
+        uint16_t &index = m_entryOf[object];
+        if (index == NONE) {
+            index = allocate();
+            if (index == NONE) continue;
+            m_entries[index].kind = Kind::Object;
+            m_entries[index].id = object;
+        }
+        psyqo::FixedPoint<12> radius(int32_t(go->boundingRadius), psyqo::FixedPoint<12>::RAW);
+        Box bounds = {{go->position.x - radius, go->position.y - radius, go->position.z - radius},
+                      {go->position.x + radius, go->position.y + radius, go->position.z + radius}};
+        place(index, bounds);
+        m_entries[index].stamp = m_stamp;
+    }
+
+    // Unloaded with their sector
+    for (uint16_t i = 0; i < CAPACITY; i++) {
+        Entry &entry = m_entries[i];
+        if (!entry.used || entry.kind != Kind::Object || entry.stamp == m_stamp) continue;
+        m_entryOf[entry.id] = NONE;
+        release(i);
+    }
+}
+
+// The objects get refiled by the next Update anyway
+void Broadphase::Shift(int32_t x, int32_t z) {
+    psyqo::FixedPoint<12> shiftX(x, psyqo::FixedPoint<12>::RAW), shiftZ(z, psyqo::FixedPoint<12>::RAW);
+    for (uint16_t i = 0; i < CAPACITY; i++) {
+        Entry &entry = m_entries[i];
+        if (!entry.used || entry.kind != Kind::Trigger) continue;
+        Box bounds = entry.bounds;
+        bounds.min.x += shiftX;
+        bounds.max.x += shiftX;
+        bounds.min.z += shiftZ;
+        bounds.max.z += shiftZ;
+        place(i, bounds);
+    }
+}
+
+uint16_t Broadphase::Query(const Box &box, Kind kind, uint16_t *ids, uint16_t capacity) const {
+    uint16_t count = 0;
+    auto visit = [&](const Entry &entry) {
+        if (entry.kind == kind && count < capacity && overlaps(entry.bounds, box)) ids[count++] = entry.id;
+    };
+    for (uint16_t i = m_large; i != NONE; i = m_entries[i].next) visit(m_entries[i]);
+
+    int32_t x0 = (box.min.x.raw() >> CELL_SHIFT) - 1, x1 = (box.max.x.raw() >> CELL_SHIFT) + 1;
+    int32_t z0 = (box.min.z.raw() >> CELL_SHIFT) - 1, z1 = (box.max.z.raw() >> CELL_SHIFT) + 1;
+    // Several cells can share a bucket, an entry only counts in its own cell so it's seen once
+    auto inRange = [&](const Entry &entry) {
+        return entry.cellX >= x0 && entry.cellX <= x1 && entry.cellZ >= z0 && entry.cellZ <= z1;
+    };
+    if (x1 - x0 >= BUCKETS || z1 - z0 >= BUCKETS || (x1 - x0 + 1) * (z1 - z0 + 1) > BUCKETS) {
+        for (uint16_t bucket = 0; bucket < BUCKETS; bucket++) {
+            for (uint16_t i = m_buckets[bucket]; i != NONE; i = m_entries[i].next) {
+                if (inRange(m_entries[i])) visit(m_entries[i]);
+            }
+        }
+        return count;
+    }
+    for (int32_t cz = z0; cz <= z1; cz++) {
+        for (int32_t cx = x0; cx <= x1; cx++) {
+            for (uint16_t i = m_buckets[bucketOf(cx, cz)]; i != NONE; i = m_entries[i].next) {
+                const Entry &entry = m_entries[i];
+                if (entry.cellX == cx && entry.cellZ == cz) visit(entry);
+            }
+        }
+    }
+    return count;
+}
+
+const Broadphase::TriggerEvents &Broadphase::TrackTriggers(const Box &box) {
+    uint16_t inside[MAX_INSIDE];
+    uint8_t count = Query(box, Kind::Trigger, inside, MAX_INSIDE);
+    m_events.enteredCount = 0;
+    m_events.exitedCount = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (!contains(m_inside, m_insideCount, inside[i])) m_events.entered[m_events.enteredCount++] = inside[i];
+    }
+    for (uint8_t i = 0; i < m_insideCount; i++) {
+        if (!contains(inside, count, m_inside[i])) m_events.exited[m_events.exitedCount++] = m_inside[i];
+    }
+    __builtin_memcpy(m_inside, inside, count * sizeof(uint16_t));
+    m_insideCount = count;
+    return m_events;
+}
+
+uint16_t Broadphase::bucketOf(int32_t cellX, int32_t cellZ) {
+    return (uint32_t(cellX) * 73856093u ^ uint32_t(cellZ) * 19349663u) % BUCKETS;
+}
+
+uint16_t &Broadphase::headOf(const Entry &entry) {
+    return entry.large ? m_large : m_buckets[bucketOf(entry.cellX, entry.cellZ)];
+}
+
+uint16_t Broadphase::allocate() {
+    uint16_t index = m_free;
+    if (index == NONE) return NONE;
+    m_free = m_entries[index].next;
+    m_entries[index].used = true;
+    m_entries[index].linked = false;
+    return index;
+}
+
+void Broadphase::release(uint16_t index) {
+    Entry &entry = m_entries[index];
+    if (entry.linked) unlink(index);
+    entry.used = false;
+    entry.next = m_free;
+    m_free = index;
+}
+
+// Only touches the lists when the entry changes cell
+void Broadphase::place(uint16_t index, const Box &bounds) {
+    Entry &entry = m_entries[index];
+    entry.bounds = bounds;
+    int32_t cellSize = 1 << CELL_SHIFT;
+    bool large = (bounds.max.x - bounds.min.x).raw() > 2 * cellSize ||
+                 (bounds.max.z - bounds.min.z).raw() > 2 * cellSize;
+    int32_t cellX = ((bounds.min.x.raw() >> 1) + (bounds.max.x.raw() >> 1)) >> CELL_SHIFT;
+    int32_t cellZ = ((bounds.min.z.raw() >> 1) + (bounds.max.z.raw() >> 1)) >> CELL_SHIFT;
+    if (entry.linked && entry.large == large && (large || (entry.cellX == cellX && entry.cellZ == cellZ))) return;
+
+    if (entry.linked) unlink(index);
+    entry.large = large;
+    entry.cellX = cellX;
+    entry.cellZ = cellZ;
+    link(index);
+}
+
+void Broadphase::link(uint16_t index) {
+    Entry &entry = m_entries[index];
+    uint16_t &head = headOf(entry);
+    entry.prev = NONE;
+    entry.next = head;
+    if (head != NONE) m_entries[head].prev = index;
+    head = index;
+    entry.linked = true;
+}
+
+void Broadphase::unlink(uint16_t index) {
+    Entry &entry = m_entries[index];
+    if (entry.prev != NONE) {
+        m_entries[entry.prev].next = entry.next;
+    } else {
+        headOf(entry) = entry.next;
+    }
+    if (entry.next != NONE) m_entries[entry.next].prev = entry.prev;
+    entry.linked = false;
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <EASTL/vector.h>
+#include <psyqo/vector.hh>
+
+#include "gameobject.hh"
+
+namespace psxsplash {
+
+class SplashPackLoader;
+
+// Axis aligned box, bounds included
+struct Box {
+    psyqo::Vec3 min, max;
+};
+
+// Volume the exporter placed in the level, identified by its own id
+struct TriggerVolume {
+    Box bounds;
+    uint16_t id;
+    uint16_t pad;
+};
+static_assert(sizeof(TriggerVolume) == 28, "TriggerVolume is not 28 bytes");
+
+// Uniform spatial hash over the XZ plane holding the bounds of the objects and the trigger volumes, for
+// gameplay queries that would otherwise walk every object. Entries are filed by the cell of their center
+// only, and queries look one cell further than their box, so anything up to two cells wide is found.
+// Larger entries go to a list of their own that every query walks.
+class Broadphase final {
+  public:
+    static constexpr unsigned CELL_SHIFT = 14;
+    static constexpr uint16_t BUCKETS = 128;
+    static constexpr uint16_t CAPACITY = 256;
+    // Triggers a box is tracked inside of at once
+    static constexpr uint8_t MAX_INSIDE = 8;
+
+    enum class Kind : uint8_t { Object, Trigger };
+
+    struct TriggerEvents {
+        uint16_t entered[MAX_INSIDE];
+        uint16_t exited[MAX_INSIDE];
+        uint8_t enteredCount;
+        uint8_t exitedCount;
+    };
+
+    // Files the trigger volumes of the pack, the objects follow at the first Update. Call after
+    // LoadSplashpack.
+    void Start(SplashPackLoader &loader);
+
+    // Brings the object entries in line with objects, usually the loader's gameObjects: the ones that
+    // moved get refiled when their cell changed, the ones that are gone get dropped. Objects past the
+    // capacity are left out.
+    void Update(const eastl::vector<GameObject *> &objects);
+
+    // Follows a rebase of the origin, see WorldStreamer
+    void Shift(int32_t x, int32_t z);
+
+    // Ids of the entries of a kind overlapping box: the index in the pack's object table for objects,
+    // the exporter's id for triggers. Returns how many were written, capacity at most.
+    uint16_t Query(const Box &box, Kind kind, uint16_t *ids, uint16_t capacity) const;
+
+    // Triggers box overlaps, compared to the previous call
+    const TriggerEvents &TrackTriggers(const Box &box);
+    uint8_t InsideCount() const { return m_insideCount; }
+    const uint16_t *Inside() const { return m_inside; }
+
+  private:
+    static constexpr uint16_t NONE = 0xffff;
+
+    struct Entry {
+        Box bounds;
+        int32_t cellX, cellZ;
+        uint16_t prev, next;
+        uint16_t id;
+        Kind kind;
+        bool used;
+        bool linked;
+        bool large;
+        uint8_t stamp;
+    };
+
+    Entry m_entries[CAPACITY];
+    uint16_t m_buckets[BUCKETS];
+    uint16_t m_large = NONE;
+    uint16_t m_free = NONE;
+    uint8_t m_stamp = 0;
+
+    GameObject *m_objects = nullptr;
+    // Entry of every object of the pack's object table
+    eastl::vector<uint16_t> m_entryOf;
+
+    uint16_t m_inside[MAX_INSIDE];
+    uint8_t m_insideCount = 0;
+    TriggerEvents m_events = {};
+
+    static uint16_t bucketOf(int32_t cellX, int32_t cellZ);
+    uint16_t &headOf(const Entry &entry);
+    uint16_t allocate();
+    void release(uint16_t index);
+    void place(uint16_t index, const Box &bounds);
+    void link(uint16_t index);
+    void unlink(uint16_t index);
+};
+
+}  // namespace psxsplash
@@ -0,0 +1,87 @@
+#include "budget.hh"
+
+#include <EASTL/algorithm.h>
+#include <common/syscalls/syscalls.h>
+#include <psyqo/alloc.h>
+
+namespace psxsplash {
+
+// psyqo's double buffered 320 wide framebuffers and its system font
+static constexpr PackUsage::VramRect s_reserved[] = {{0, 0, 320, MemoryBudget::VRAM_HEIGHT}, {960, 448, 64, 64}};
+
+static uint32_t physical(const void *address) { return reinterpret_cast<uintptr_t>(address) & 0x1fffffff; }
+
+static uint32_t rectBytes(const PackUsage::VramRect &rect) { return rect.width * rect.height * sizeof(uint16_t); }
+
+static bool overlap(const PackUsage::VramRect &a, const PackUsage::VramRect &b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+void MemoryBudget::Start(uint32_t embeddedBytes) {
+    m_embeddedBytes = embeddedBytes;
+    m_heapHighWater = HeapBytes();
+    m_vramHighWater = 0;
+}
+
+uint32_t MemoryBudget::StaticBytes() const { return physical(psyqo_heap_start()) - KERNEL_SIZE; }
+
+uint32_t MemoryBudget::HeapBytes() const { return physical(psyqo_heap_end()) - physical(psyqo_heap_start()); }
+
+void MemoryBudget::BeginPack() { m_heapBeforePack = HeapBytes(); }
+
+void MemoryBudget::Update() { m_heapHighWater = eastl::max(m_heapHighWater, HeapBytes()); }
+
+void MemoryBudget::Report(const SplashPackLoader &loader, uint32_t packBytes) {
+    Update();
+    const PackUsage &usage = loader.usage;
+    // Whatever isn't accounted for is the triangles of the meshes, and the padding between the parts
+    uint32_t accounted =
+        usage.tableBytes + usage.navmeshBytes + usage.atlasBytes + usage.clutBytes + usage.sectionBytes;
+    uint32_t meshBytes = packBytes > accounted ? packBytes - accounted : 0;
+    ramsyscall_printf("BUDGET pack %i bytes: tables %i meshes %i navmeshes %i atlases %i cluts %i sections %i\n",
+                      packBytes, usage.tableBytes, meshBytes, usage.navmeshBytes, usage.atlasBytes, usage.clutBytes,
+                      usage.sectionBytes);
+    for (uint8_t i = 0; i < usage.sectionCount; i++) {
+        const PackUsage::Section &section = usage.sections[i];
+        ramsyscall_printf("BUDGET   section %c%c%c%c %i\n", section.tag[0], section.tag[1], section.tag[2],
+                          section.tag[3], section.bytes);
+    }
+
+    uint32_t heap = HeapBytes();
+    ramsyscall_printf("BUDGET ram: kernel %i static %i (packs %i) heap %i (pack %i, high %i) free %i of %i\n",
+                      KERNEL_SIZE, StaticBytes(), m_embeddedBytes, heap, int32_t(heap - m_heapBeforePack),
+                      m_heapHighWater, FreeBytes(), RAM_SIZE);
+    reportVram(usage);
+}
+
+void MemoryBudget::reportVram(const PackUsage &usage) {
+    uint32_t reserved = 0;
+    for (const auto &rect : s_reserved) reserved += rectBytes(rect);
+    m_vramBytes = reserved;
+    for (uint16_t i = 0; i < usage.atlases.size(); i++) {
+        const PackUsage::VramRect &rect = usage.atlases[i];
+        ramsyscall_printf("BUDGET   atlas %i at %i,%i %ix%i %i\n", i, rect.x, rect.y, rect.width, rect.height,
+                          rectBytes(rect));
+        m_vramBytes += rectBytes(rect);
+    }
+    for (uint16_t i = 0; i < usage.cluts.size(); i++) {
+        const PackUsage::VramRect &rect = usage.cluts[i];
+        ramsyscall_printf("BUDGET   clut %i at %i,%i %ix%i %i\n", i, rect.x, rect.y, rect.width, rect.height,
+                          rectBytes(rect));
+        m_vramBytes += rectBytes(rect);
+    }
+    m_vramHighWater = eastl::max(m_vramHighWater, m_vramBytes);
+
+    // Uploads landing on each other or on psyqo's areas, counted twice above
+    eastl::vector<PackUsage::VramRect> rects(s_reserved, s_reserved + sizeof(s_reserved) / sizeof(s_reserved[0]));
+    rects.insert(rects.end(), usage.atlases.begin(), usage.atlases.end());
+    rects.insert(rects.end(), usage.cluts.begin(), usage.cluts.end());
+    uint16_t overlaps = 0;
+    for (uint16_t i = 0; i < rects.size(); i++) {
+        for (uint16_t j = i + 1; j < rects.size(); j++) overlaps += overlap(rects[i], rects[j]);
+    }
+    ramsyscall_printf("BUDGET vram: reserved %i atlases %i cluts %i free %i of %i, %i overlaps\n", reserved,
+                      usage.atlasBytes, usage.clutBytes, int32_t(VRAM_SIZE - m_vramBytes), VRAM_SIZE, overlaps);
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "splashpack.hh"
+
+namespace psxsplash {
+
+// RAM and VRAM accounting against the console's 2 MB and 1 MB. The static part is the executable, which
+// embeds every pack, the heap is psyqo's: the renderer's ordering tables and bump allocators, the loader's
+// vectors and whatever the systems allocate in their Start. Prints a report to the TTY for every pack
+// loaded, and keeps high-water marks to size scenes against.
+class MemoryBudget final {
+  public:
+    static constexpr uint32_t RAM_SIZE = 2 * 1024 * 1024;
+    // The BIOS keeps the first 64 KB
+    static constexpr uint32_t KERNEL_SIZE = 64 * 1024;
+    static constexpr uint16_t VRAM_WIDTH = 1024, VRAM_HEIGHT = 512;
+    static constexpr uint32_t VRAM_SIZE = VRAM_WIDTH * VRAM_HEIGHT * sizeof(uint16_t);
+
+    // embeddedBytes is the size of all the packs in the executable
+    void Start(uint32_t embeddedBytes);
+
+    // Call before loading a pack, so that the report tells what it added to the heap
+    void BeginPack();
+    // Prints the report of the pack the loader just loaded, packBytes long. Call once the systems using
+    // it are started.
+    void Report(const SplashPackLoader &loader, uint32_t packBytes);
+    // Samples the heap, once per frame
+    void Update();
+
+    uint32_t StaticBytes() const;
+    uint32_t HeapBytes() const;
+    uint32_t HeapHighWater() const { return m_heapHighWater; }
+    // What is left for the stack
+    uint32_t FreeBytes() const { return RAM_SIZE - KERNEL_SIZE - StaticBytes() - HeapBytes(); }
+    // Of the last pack reported, psyqo's framebuffers and font included
+    uint32_t VramBytes() const { return m_vramBytes; }
+    uint32_t VramHighWater() const { return m_vramHighWater; }
+
+  private:
+    uint32_t m_embeddedBytes = 0;
+    uint32_t m_heapBeforePack = 0;
+    uint32_t m_heapHighWater = 0;
+    uint32_t m_vramBytes = 0;
+    uint32_t m_vramHighWater = 0;
+
+    void reportVram(const PackUsage &usage);
+};
+
+}  // namespace psxsplash
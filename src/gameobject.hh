@@ -10,14 +10,21 @@ namespace psxsplash {
 
 class GameObject final {
   public:
+    // Set in polyCount when the object points to a CompactMesh instead of Tri
+    static constexpr uint16_t COMPACT_MESH = 0x8000;
+
     union {
         Tri *polygons;
+        CompactMesh *compact;
         uint32_t polygonsOffset;
     };
     psyqo::Vec3 position;
     psyqo::Matrix33 rotation;
     uint16_t polyCount;
-    uint16_t reserved;
+    uint16_t boundingRadius;  // in object space, filled in by the loader
+
+    bool IsCompact() const { return polyCount & COMPACT_MESH; }
+    uint16_t TriangleCount() const { return polyCount & ~COMPACT_MESH; }
 };
 static_assert(sizeof(GameObject) == 56, "GameObject is not 56 bytes");
 }  // namespace psxsplash
\ No newline at end of file
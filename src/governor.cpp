@@ -0,0 +1,62 @@
+#include "governor.hh"
+
+namespace psxsplash {
+
+// From cheapest to full quality. The draw distance goes first, as the fog
+// hides it well, then the subdivision and the primitive budget. Texture LODs
+// kick in closer on the lower levels to spare the GPU texture cache.
+static constexpr QualitySettings s_levels[QualityGovernor::LEVEL_COUNT] = {
+    {0, 128, 1500, 128},
+    {0, 160, 2000, 160},
+    {0, 192, 2500, 192},
+    {1, 192, 3000, 224},
+    {1, 224, 0xffff, 256},
+    {1, QualitySettings::FULL_DRAW_DISTANCE, 0xffff, 256},
+};
+
+// Frames over 15/16 of the budget are late, frames under 5/8 of it are idle.
+// Two late frames in a row step down, 120 idle frames in a row step up.
+static constexpr uint8_t s_lateFramesToStepDown = 2;
+static constexpr uint8_t s_idleFramesToStepUp = 120;
+static constexpr uint8_t s_cooldownFrames = 30;
+
+void QualityGovernor::SetTarget(uint8_t targetFps, uint8_t refreshRate) {
+    m_targetFps = targetFps;
+    m_targetVsyncs = (refreshRate + targetFps / 2) / targetFps;
+    if (m_targetVsyncs == 0) m_targetVsyncs = 1;
+    m_budget = 1000000 * m_targetVsyncs / refreshRate;
+    m_lateFrames = m_idleFrames = 0;
+}
+
+bool QualityGovernor::Update(uint32_t vsyncs, uint32_t cpuTime) {
+    if (vsyncs > m_targetVsyncs || cpuTime > m_budget / 16 * 15) {
+        m_idleFrames = 0;
+        if (m_lateFrames < s_lateFramesToStepDown) m_lateFrames++;
+    } else if (cpuTime < m_budget / 8 * 5) {
+        m_lateFrames = 0;
+        if (m_idleFrames < s_idleFramesToStepUp) m_idleFrames++;
+    } else {
+        // In between, the current level is right
+        m_lateFrames = m_idleFrames = 0;
+    }
+
+    if (m_cooldown > 0) {
+        m_cooldown--;
+        return false;
+    }
+
+    if (m_lateFrames >= s_lateFramesToStepDown && m_level > 0) {
+        m_level--;
+    } else if (m_idleFrames >= s_idleFramesToStepUp && m_level < LEVEL_COUNT - 1) {
+        m_level++;
+    } else {
+        return false;
+    }
+    m_lateFrames = m_idleFrames = 0;
+    m_cooldown = s_cooldownFrames;
+    return true;
+}
+
+const QualitySettings& QualityGovernor::Settings() const { return s_levels[m_level]; }
+
+}  // namespace psxsplash
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "renderer.hh"
+
+namespace psxsplash {
+
+// Holds a target frame rate by trading rendering quality for time. It is fed
+// every frame with how long the frame took, steps down a quality level as
+// soon as frames run late and only steps back up after a long run of frames
+// with plenty of headroom, so the quality doesn't oscillate.
+class QualityGovernor final {
+  public:
+    static constexpr uint8_t LEVEL_COUNT = 6;
+
+    // refreshRate is the video refresh rate, as reported by psyqo::GPU
+    void SetTarget(uint8_t targetFps, uint8_t refreshRate);
+    uint8_t TargetFps() const { return m_targetFps; }
+    // Time available per frame at the target frame rate, in microseconds
+    uint32_t Budget() const { return m_budget; }
+
+    // vsyncs is the amount of vertical blanks the frame took, cpuTime the time
+    // spent in it, in microseconds. Returns true when the quality changed.
+    bool Update(uint32_t vsyncs, uint32_t cpuTime);
+
+    uint8_t Level() const { return m_level; }
+    const QualitySettings& Settings() const;
+
+  private:
+    uint8_t m_targetFps = 30;
+    uint8_t m_targetVsyncs = 2;
+    uint32_t m_budget = 33333;
+
+    uint8_t m_level = LEVEL_COUNT - 1;
+    uint8_t m_lateFrames = 0;
+    uint8_t m_idleFrames = 0;
+    uint8_t m_cooldown = 0;
+};
+
+}  // namespace psxsplash
@@ -0,0 +1,89 @@
+#include "gtegeometry.hh"
+
+#include <psyqo/gte-kernels.hh>
+#include <psyqo/gte-registers.hh>
+
+using namespace psyqo::GTE;
+
+namespace psxsplash {
+
+static uint32_t pack(int16_t lo, int16_t hi) { return uint16_t(lo) | uint32_t(uint16_t(hi)) << 16; }
+
+static void loadRows(const ShortVec3 &r0, const ShortVec3 &r1, const ShortVec3 &r2) {
+    write<Register::R11R12, Unsafe>(pack(r0.x, r0.y));
+    write<Register::R13R21, Unsafe>(pack(r0.z, r1.x));
+    write<Register::R22R23, Unsafe>(pack(r1.y, r1.z));
+    write<Register::R31R32, Unsafe>(pack(r2.x, r2.y));
+    write<Register::R33, Unsafe>(uint32_t(int32_t(r2.z)));
+}
+
+static void loadV0(const ShortVec3 &v) {
+    write<Register::VXY0, Unsafe>(pack(v.x, v.y));
+    write<Register::VZ0, Safe>(uint32_t(int32_t(v.z)));
+}
+
+static void readMAC(LongVec3 &out) {
+    read<Register::MAC1>(reinterpret_cast<uint32_t *>(&out.x));
+    read<Register::MAC2>(reinterpret_cast<uint32_t *>(&out.y));
+    read<Register::MAC3>(reinterpret_cast<uint32_t *>(&out.z));
+}
+
+// op crosses the diagonal of the rotation matrix with IR
+void CrossProductsGTE(const ShortVec3 *a, const ShortVec3 *b, LongVec3 *out, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        write<Register::R11R12, Unsafe>(pack(a[i].x, 0));
+        write<Register::R22R23, Unsafe>(pack(a[i].y, 0));
+        write<Register::R33, Unsafe>(uint32_t(int32_t(a[i].z)));
+        write<Register::IR1, Unsafe>(uint32_t(int32_t(b[i].x)));
+        write<Register::IR2, Unsafe>(uint32_t(int32_t(b[i].y)));
+        write<Register::IR3, Safe>(uint32_t(int32_t(b[i].z)));
+        Kernels::op<Kernels::Unshifted>();
+        readMAC(out[i]);
+    }
+}
+
+void DotProductsGTE(const ShortVec3 rows[3], const ShortVec3 *v, LongVec3 *out, uint32_t count) {
+    loadRows(rows[0], rows[1], rows[2]);
+    for (uint32_t i = 0; i < count; i++) {
+        loadV0(v[i]);
+        Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::Zero, Kernels::Unshifted>();
+        readMAC(out[i]);
+    }
+}
+
+void SquaredLengthsGTE(const ShortVec3 *v, int32_t *out, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        write<Register::IR1, Unsafe>(uint32_t(int32_t(v[i].x)));
+        write<Register::IR2, Unsafe>(uint32_t(int32_t(v[i].y)));
+        write<Register::IR3, Safe>(uint32_t(int32_t(v[i].z)));
+        Kernels::sqr<Kernels::Unshifted>();
+        LongVec3 squares;
+        readMAC(squares);
+        out[i] = squares.x + squares.y + squares.z;
+    }
+}
+
+// The rows are the edges turned a quarter, so that dotting them with p - a gives the 2D cross products
+// of every edge with p - a. Only ab and ca go through a, bc needs the cross product of ab and bc added
+// back, which is the same as the one of ab and ac: the doubled area.
+void EdgeFunctionsXZGTE(const ShortVec3 &a, const ShortVec3 &b, const ShortVec3 &c, const ShortVec3 *p,
+                        LongVec3 *out, uint32_t count) {
+    ShortVec3 ab = {int16_t(b.x - a.x), 0, int16_t(b.z - a.z)};
+    ShortVec3 bc = {int16_t(c.x - b.x), 0, int16_t(c.z - b.z)};
+    ShortVec3 ca = {int16_t(a.x - c.x), 0, int16_t(a.z - c.z)};
+    loadRows({int16_t(-ab.z), 0, ab.x}, {int16_t(-bc.z), 0, bc.x}, {int16_t(-ca.z), 0, ca.x});
+
+    loadV0({int16_t(c.x - a.x), 0, int16_t(c.z - a.z)});
+    Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::Zero, Kernels::Unshifted>();
+    int32_t area;
+    read<Register::MAC1>(reinterpret_cast<uint32_t *>(&area));
+
+    for (uint32_t i = 0; i < count; i++) {
+        loadV0({int16_t(p[i].x - a.x), 0, int16_t(p[i].z - a.z)});
+        Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::Zero, Kernels::Unshifted>();
+        readMAC(out[i]);
+        out[i].y += area;
+    }
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace psxsplash {
+
+// Integer vectors for the geometry kernels below. The inputs are raw 16 bits values, the results the
+// exact products, unshifted, on 32 bits.
+struct ShortVec3 {
+    int16_t x, y, z;
+};
+
+struct LongVec3 {
+    int32_t x, y, z;
+};
+
+// Inputs must stay within +/- GEOMETRY_RANGE, so that their differences still fit in 16 bits and sums of
+// three products of differences in 32 bits.
+static constexpr int32_t GEOMETRY_RANGE = 0x1fff;
+
+// Batched geometry on the GTE, for the navmesh and collision queries. These load the rotation matrix,
+// which the renderer sets again for every object anyway.
+
+// out[i] = a[i] x b[i], with op
+void CrossProductsGTE(const ShortVec3 *a, const ShortVec3 *b, LongVec3 *out, uint32_t count);
+
+// out[i] = (rows[0] . v[i], rows[1] . v[i], rows[2] . v[i]), with mvmva
+void DotProductsGTE(const ShortVec3 rows[3], const ShortVec3 *v, LongVec3 *out, uint32_t count);
+
+// out[i] = |v[i]|^2, with sqr
+void SquaredLengthsGTE(const ShortVec3 *v, int32_t *out, uint32_t count);
+
+// Edge functions of the triangle abc on the XZ plane at every point: the 2D cross products of ab and ap,
+// bc and bp, ca and cp, with mvmva. A point is inside the triangle, or on its border, when all three
+// have the same sign, and they add up to twice the signed area of the triangle.
+void EdgeFunctionsXZGTE(const ShortVec3 &a, const ShortVec3 &b, const ShortVec3 &c, const ShortVec3 *p,
+                        LongVec3 *out, uint32_t count);
+
+}  // namespace psxsplash
@@ -0,0 +1,151 @@
+#include "hierarchy.hh"
+
+#include <EASTL/algorithm.h>
+#include <psyqo/gte-kernels.hh>
+#include <psyqo/gte-registers.hh>
+#include <psyqo/kernel.hh>
+#include <psyqo/soft-math.hh>
+
+#include "gtemath.hh"
+#include "splashpack.hh"
+
+using namespace psyqo::GTE;
+
+namespace psxsplash {
+
+void TransformHierarchy::Start(SplashPackLoader &loader) {
+    m_nodes.clear();
+    m_objects = loader.objectTable;
+    m_tracks = loader.tracks;
+    if (!loader.hierarchy) return;
+
+    const HierarchyNode *nodes = loader.hierarchy;
+    uint16_t count = loader.objectCount;
+
+    // Depth of every object taking part, counting from 1 for the roots
+    eastl::vector<uint16_t> depths(count, 0);
+    uint16_t maxDepth = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (nodes[i].parent == NO_NODE && nodes[i].track == NO_NODE) continue;
+        psyqo::Kernel::assert(nodes[i].track == NO_NODE || nodes[i].track < loader.trackCount,
+                              "Splashpack object uses a missing track");
+        uint16_t depth = 1;
+        for (uint16_t at = i; nodes[at].parent != NO_NODE; at = nodes[at].parent) {
+            psyqo::Kernel::assert(nodes[at].parent < count, "Splashpack object has a missing parent");
+            depth++;
+            psyqo::Kernel::assert(depth <= count, "Splashpack hierarchy has a cycle");
+        }
+        depths[i] = depth;
+        maxDepth = eastl::max(maxDepth, depth);
+        for (uint16_t at = nodes[i].parent, parentDepth = depth - 1; at != NO_NODE; at = nodes[at].parent) {
+            depths[at] = parentDepth--;
+        }
+    }
+
+    // Parents first, the pack stores the local transforms in the objects
+    eastl::vector<uint16_t> nodeOf(count, NO_NODE);
+    for (uint16_t depth = 1; depth <= maxDepth; depth++) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (depths[i] != depth) continue;
+            GameObject *go = m_objects + i;
+            nodeOf[i] = m_nodes.size();
+            Node node;
+            node.rotation = go->rotation;
+            node.position = go->position;
+            node.object = go;
+            node.parent = nodes[i].parent == NO_NODE ? NO_NODE : nodeOf[nodes[i].parent];
+            node.track = nodes[i].track;
+            node.time = 0;
+            node.dirty = true;
+            if (node.track != NO_NODE) {
+                psyqo::Kernel::assert(m_tracks[node.track].keyCount > 0, "Splashpack has an empty track");
+            }
+            m_nodes.push_back(node);
+        }
+    }
+
+    Update(0);
+}
+
+void TransformHierarchy::Update(uint32_t frames) {
+    for (Node &node : m_nodes) {
+        if (node.track != NO_NODE && advance(node, frames)) {
+            sample(node);
+            node.dirty = true;
+        }
+        if (node.parent != NO_NODE && m_nodes[node.parent].dirty) node.dirty = true;
+        if (node.dirty) computeWorld(node);
+    }
+    for (Node &node : m_nodes) node.dirty = false;
+}
+
+uint16_t TransformHierarchy::Find(uint16_t object) const {
+    for (uint16_t i = 0; i < m_nodes.size(); i++) {
+        if (m_nodes[i].object == m_objects + object) return i;
+    }
+    return NO_NODE;
+}
+
+void TransformHierarchy::SetLocal(uint16_t node, const psyqo::Vec3 &position, const psyqo::Matrix33 &rotation) {
+    m_nodes[node].position = position;
+    m_nodes[node].rotation = rotation;
+    m_nodes[node].dirty = true;
+}
+
+// False when the pose doesn't change: single key tracks, and the ones that don't loop once over
+bool TransformHierarchy::advance(Node &node, uint32_t frames) {
+    const Track &track = m_tracks[node.track];
+    uint16_t last = track.keys[track.keyCount - 1].frame;
+    if (last == 0) return frames == 0;
+    if (track.flags & Track::LOOP) {
+        node.time = (node.time + frames) % last;
+        return true;
+    }
+    if (node.time >= last && frames > 0) return false;
+    node.time = eastl::min(uint32_t(node.time) + frames, uint32_t(last));
+    return true;
+}
+
+void TransformHierarchy::sample(Node &node) {
+    const Track &track = m_tracks[node.track];
+    const TrackKey *key = track.keys;
+    const TrackKey *end = track.keys + track.keyCount;
+    while (key + 1 < end && (key + 1)->frame <= node.time) key++;
+    const TrackKey *next = key + 1 < end ? key + 1 : key;
+
+    int32_t blend = next->frame > key->frame ? ((node.time - key->frame) << 12) / (next->frame - key->frame) : 0;
+    psyqo::FixedPoint<12> t(blend, psyqo::FixedPoint<12>::RAW);
+    node.position.x = key->translation.x + (next->translation.x - key->translation.x) * t;
+    node.position.y = key->translation.y + (next->translation.y - key->translation.y) * t;
+    node.position.z = key->translation.z + (next->translation.z - key->translation.z) * t;
+
+    psyqo::Angle angles[3];
+    for (unsigned i = 0; i < 3; i++) {
+        int32_t angle = key->rotation[i] + (((next->rotation[i] - key->rotation[i]) * blend) >> 12);
+        angles[i] = psyqo::Angle(angle, psyqo::Angle::RAW);
+    }
+    auto rotX = psyqo::SoftMath::generateRotationMatrix33(angles[0], psyqo::SoftMath::Axis::X, m_trig);
+    auto rotY = psyqo::SoftMath::generateRotationMatrix33(angles[1], psyqo::SoftMath::Axis::Y, m_trig);
+    auto rotZ = psyqo::SoftMath::generateRotationMatrix33(angles[2], psyqo::SoftMath::Axis::Z, m_trig);
+    MatrixMultiplyGTE(rotY, rotX, &node.rotation);
+    MatrixMultiplyGTE(node.rotation, rotZ, &node.rotation);
+}
+
+void TransformHierarchy::computeWorld(Node &node) {
+    GameObject *go = node.object;
+    if (node.parent == NO_NODE) {
+        go->position = node.position;
+        go->rotation = node.rotation;
+        return;
+    }
+
+    const GameObject *parent = m_nodes[node.parent].object;
+    MatrixMultiplyGTE(parent->rotation, node.rotation, &go->rotation);
+    // MatrixMultiplyGTE left the parent's rotation in RT
+    writeSafe<PseudoRegister::Translation>(parent->position);
+    writeSafe<PseudoRegister::V0>(node.position);
+    Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::TR>();
+    go->position = readSafe<PseudoRegister::LV>();
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <EASTL/vector.h>
+#include <psyqo/matrix.hh>
+#include <psyqo/trigonometry.hh>
+#include <psyqo/vector.hh>
+
+#include "gameobject.hh"
+
+namespace psxsplash {
+
+class SplashPackLoader;
+
+// Pose of a Track at a given frame. The rotation is made of XYZ Euler angles applied like
+// Camera::SetRotation, in psyqo::Angle raw units.
+struct TrackKey {
+    uint16_t frame;
+    int16_t rotation[3];
+    psyqo::Vec3 translation;
+};
+static_assert(sizeof(TrackKey) == 20, "TrackKey is not 20 bytes");
+
+// Keyframed local transform, linearly interpolated between keys sorted by frame
+struct Track {
+    static constexpr uint16_t LOOP = 1 << 0;
+
+    union {
+        TrackKey *keys;
+        uint32_t keysOffset;
+    };
+    uint16_t keyCount;
+    uint16_t flags;
+};
+
+// Parent and track of an object of the pack, NO_NODE for none
+struct HierarchyNode {
+    uint16_t parent;
+    uint16_t track;
+};
+
+static constexpr uint16_t NO_NODE = 0xffff;
+
+// Objects attached to other objects. The pack stores the transforms of children relative to their parent,
+// the hierarchy keeps them as local transforms and writes the world ones to the objects, which the
+// renderer then reads as usual. Nodes are kept parents first, so a single pass recomputes the world
+// transforms of whatever subtrees moved since the last update, on the GTE.
+class TransformHierarchy final {
+  public:
+    // Picks the objects of the pack that have a parent, children or a track, and computes all of their
+    // world transforms. Call after LoadSplashpack.
+    void Start(SplashPackLoader &loader);
+
+    // Advances the tracks by frames, then recomputes the subtrees under the nodes that moved
+    void Update(uint32_t frames);
+
+    // Node of an object of the pack's object table, NO_NODE when it isn't part of the hierarchy
+    uint16_t Find(uint16_t object) const;
+    // Moves a node relative to its parent, its subtree follows at the next Update. Nodes with a track
+    // get overwritten by it.
+    void SetLocal(uint16_t node, const psyqo::Vec3 &position, const psyqo::Matrix33 &rotation);
+
+    uint16_t Count() const { return m_nodes.size(); }
+
+  private:
+    struct Node {
+        psyqo::Matrix33 rotation;
+        psyqo::Vec3 position;
+        GameObject *object;
+        uint16_t parent;
+        uint16_t track;
+        uint16_t time;
+        bool dirty;
+    };
+
+    eastl::vector<Node> m_nodes;
+    GameObject *m_objects = nullptr;
+    const Track *m_tracks = nullptr;
+    psyqo::Trig<> m_trig;
+
+    bool advance(Node &node, uint32_t frames);
+    void sample(Node &node);
+    void computeWorld(Node &node);
+};
+
+}  // namespace psxsplash
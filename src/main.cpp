@@ -11,11 +11,21 @@
 
 
 #include "EASTL/algorithm.h"
+#include "benchmark.hh"
+#include "broadphase.hh"
+#include "budget.hh"
 #include "camera.hh"
+#include "governor.hh"
+#include "hierarchy.hh"
 #include "navmesh.hh"
+#include "particles.hh"
+#include "raycast.hh"
 #include "psyqo/vector.hh"
 #include "renderer.hh"
+#include "scheduler.hh"
 #include "splashpack.hh"
+#include "streaming.hh"
+#include "vertexanim.hh"
 #include <EASTL/vector.h>
 #include "rand.cpp"
 
@@ -24,6 +34,10 @@ extern uint8_t _binary_jesseandkalleoutput_bin_start[];
 extern uint8_t _binary_niilosnailoutput_bin_start[];
 extern uint8_t _binary_niilotoiletoutput_bin_start[];
 extern uint8_t _binary_kalle_bin_start[];
+extern uint8_t _binary_jesseandkalleoutput_bin_end[];
+extern uint8_t _binary_niilosnailoutput_bin_end[];
+extern uint8_t _binary_niilotoiletoutput_bin_end[];
+extern uint8_t _binary_kalle_bin_end[];
 
 
 // the vector has pointers to the splashpacks in the REVERSED order of how they
@@ -35,6 +49,14 @@ eastl::vector<uint8_t *> splashpacks = {
     _binary_jesseandkalleoutput_bin_start,
 };
 
+// Same order, for MemoryBudget
+eastl::vector<uint8_t *> splashpackEnds = {
+    _binary_kalle_bin_end,
+    _binary_niilosnailoutput_bin_end,
+    _binary_niilotoiletoutput_bin_end,
+    _binary_jesseandkalleoutput_bin_end,
+};
+
 uint8_t current_bin_start_index = splashpacks.size() - 1;
 namespace {
 
@@ -55,15 +77,40 @@ public:
 
     psyqo::AdvancedPad m_input;
     static constexpr uint8_t m_stickDeadzone = 0x30;
+
+    psxsplash::Benchmark m_benchmark;
+    psxsplash::QualityGovernor m_governor;
+    psxsplash::JobScheduler m_jobs;
+    psxsplash::WorldStreamer m_streamer;
+    psxsplash::TransformHierarchy m_hierarchy;
+    psxsplash::VertexAnimator m_animator;
+    psxsplash::Broadphase m_broadphase;
+    psxsplash::NavmeshSelector m_navmeshes;
+    psxsplash::RayCaster m_raycaster;
+    psxsplash::MemoryBudget m_budget;
+    psxsplash::ParticlePool m_particles;
 };
 
 class MainScene final : public psyqo::Scene {
   void frame() override;
   void start(StartReason reason) override;
 
+  void loadPack(uint8_t index);
+  void resetToPlayerStart();
+  void setViews();
+  void steer(psxsplash::Camera &camera, psyqo::Angle &rotX, psyqo::Angle &rotY,
+             int16_t leftXOffset, int16_t leftYOffset, int16_t rightXOffset,
+             int16_t rightYOffset, psyqo::FixedPoint<12> speed,
+             uint32_t deltaTime);
+
   psxsplash::Camera m_mainCamera;
   psyqo::Angle camRotX, camRotY, camRotZ;
 
+  // Start splits the screen with a free camera on the second pad
+  bool m_splitScreen = false;
+  psxsplash::Camera m_secondCamera;
+  psyqo::Angle cam2RotX, cam2RotY;
+
   psyqo::Trig<> m_trig;
   uint32_t m_lastFrameCounter;
 
@@ -110,30 +157,116 @@ void PSXSplash::prepare() {
 void PSXSplash::createScene() {
     m_font.uploadSystemFont(gpu());
     m_input.initialize();
+    m_governor.SetTarget(30, gpu().getRefreshRate());
+    uint32_t embeddedBytes = 0;
+    for (unsigned i = 0; i < splashpacks.size(); i++) {
+        embeddedBytes += splashpackEnds[i] - splashpacks[i];
+    }
+    m_budget.Start(embeddedBytes);
+#ifdef PSXSPLASH_BENCHMARK
+    pushScene(&mainScene);
+#else
     pushScene(&mainScreen);
+#endif
     
     //pushScene(&mainScene);
 }
 
-void MainScene::start(StartReason reason) {
-app.m_loader.LoadSplashpack(splashpacks.at(current_bin_start_index));
-    if (current_bin_start_index == 0) {
-        current_bin_start_index = splashpacks.size() - 1;
-    }
-  current_bin_start_index--;
-  psxsplash::Renderer::GetInstance().SetCamera(m_mainCamera);
-
+void MainScene::resetToPlayerStart() {
   m_mainCamera.SetPosition(
       static_cast<psyqo::FixedPoint<12>>(app.m_loader.playerStartPos.x),
       static_cast<psyqo::FixedPoint<12>>(app.m_loader.playerStartPos.y),
       static_cast<psyqo::FixedPoint<12>>(app.m_loader.playerStartPos.z));
 
   pheight = psyqo::FixedPoint<12>(app.m_loader.playerHeight);
+  m_freecam = app.m_loader.navmeshes.empty();
+}
+
+// Top and bottom halves, keeping the horizontal field of view
+void MainScene::setViews() {
+  auto &renderer = psxsplash::Renderer::GetInstance();
+  if (!m_splitScreen) {
+    renderer.SetCamera(m_mainCamera);
+    return;
+  }
+  constexpr int16_t width = psxsplash::Renderer::SCREEN_WIDTH;
+  constexpr int16_t half = psxsplash::Renderer::SCREEN_HEIGHT / 2;
+  psxsplash::View views[2] = {
+      {&m_mainCamera, {.a = {.x = 0, .y = 0}, .b = {.x = width, .y = half}},
+       psxsplash::Renderer::PROJECTION_H},
+      {&m_secondCamera, {.a = {.x = 0, .y = half}, .b = {.x = width, .y = half}},
+       psxsplash::Renderer::PROJECTION_H},
+  };
+  renderer.SetViews(views, 2);
+}
+
+// Loads a pack and starts everything that runs on it over, dropping what the
+// previous pack left behind
+void MainScene::loadPack(uint8_t index) {
+  app.m_budget.BeginPack();
+  app.m_loader.LoadSplashpack(splashpacks.at(index));
+  app.m_streamer.Start(app.m_loader, app.m_jobs);
+  app.m_hierarchy.Start(app.m_loader);
+  app.m_animator.Start(app.m_loader);
+  app.m_broadphase.Start(app.m_loader);
+  app.m_navmeshes.Start(app.m_loader);
+  app.m_raycaster.Start(app.m_loader);
+  app.m_budget.Report(app.m_loader, splashpackEnds.at(index) - splashpacks.at(index));
+  app.m_particles.Clear();
+
+  auto &renderer = psxsplash::Renderer::GetInstance();
+  renderer.SetParticles(&app.m_particles);
+  renderer.SetVertexAnimator(&app.m_animator);
+  setViews();
+  resetToPlayerStart();
+}
+
+void MainScene::start(StartReason reason) {
+#ifdef PSXSPLASH_BENCHMARK
+  app.m_benchmark.Start(splashpacks.size());
+  current_bin_start_index = app.m_benchmark.CurrentPack();
+  // Replays must see the same objects whatever the speed of the build
+  app.m_streamer.SetBlocking(true);
+#endif
+  loadPack(current_bin_start_index);
+    if (current_bin_start_index == 0) {
+        current_bin_start_index = splashpacks.size() - 1;
+    }
+  current_bin_start_index--;
+#ifndef PSXSPLASH_BENCHMARK
+  psxsplash::Renderer::GetInstance().SetQuality(app.m_governor.Settings());
+#endif
+
+#ifdef PSXSPLASH_BENCHMARK
+  camRotX = camRotY = camRotZ = 0.0_pi;
+  m_lastFrameCounter = gpu().getFrameCount();
+  app.m_benchmark.BeginPack(app.m_loader);
+#endif
 
   app.m_input.setOnEvent(eastl::function<void(psyqo::AdvancedPad::Event)>{
       [this](const psyqo::AdvancedPad::Event &event) {
         if (event.pad != psyqo::AdvancedPad::Pad::Pad1a)
           return;
+        if (event.type == psyqo::AdvancedPad::Event::ButtonPressed &&
+            event.button == psyqo::AdvancedPad::Button::Select) {
+          app.m_governor.SetTarget(app.m_governor.TargetFps() == 30 ? 60 : 30,
+                                   gpu().getRefreshRate());
+          return;
+        }
+        if (event.type == psyqo::AdvancedPad::Event::ButtonPressed &&
+            event.button == psyqo::AdvancedPad::Button::Start) {
+          // The second player starts where the first one is
+          m_splitScreen = !m_splitScreen;
+          if (m_splitScreen) {
+            const psyqo::Vec3 &position = m_mainCamera.GetPosition();
+            m_secondCamera.SetPosition(position.x, position.y, position.z);
+            cam2RotX = camRotX;
+            cam2RotY = camRotY;
+            m_secondCamera.SetRotation(cam2RotX, cam2RotY, camRotZ);
+          }
+          setViews();
+          return;
+        }
         if (app.m_loader.navmeshes.empty())
           return;
         if (event.type == psyqo::AdvancedPad::Event::ButtonPressed) {
@@ -165,10 +298,6 @@ app.m_loader.LoadSplashpack(splashpacks.at(current_bin_start_index));
           }
         }
       }});
-
-  if (app.m_loader.navmeshes.empty()) {
-    m_freecam = true;
-  }
 }
 
 
@@ -239,6 +368,32 @@ void MainScreen::showText(){
 
 
 
+void MainScene::steer(psxsplash::Camera &camera, psyqo::Angle &rotX,
+                      psyqo::Angle &rotY, int16_t leftXOffset,
+                      int16_t leftYOffset, int16_t rightXOffset,
+                      int16_t rightYOffset, psyqo::FixedPoint<12> speed,
+                      uint32_t deltaTime) {
+  if (__builtin_abs(rightXOffset) > app.m_stickDeadzone) {
+    rotY += (rightXOffset * rotSpeed * deltaTime) >> 7;
+  }
+  if (__builtin_abs(rightYOffset) > app.m_stickDeadzone) {
+    rotX -= (rightYOffset * rotSpeed * deltaTime) >> 7;
+    rotX = eastl::clamp(rotX, -0.5_pi, 0.5_pi);
+  }
+  camera.SetRotation(rotX, rotY, camRotZ);
+
+  if (__builtin_abs(leftYOffset) > app.m_stickDeadzone) {
+    psyqo::FixedPoint<12> forward = -(leftYOffset * speed * deltaTime) >> 7;
+    camera.MoveX((m_trig.sin(rotY) * forward));
+    camera.MoveZ((m_trig.cos(rotY) * forward));
+  }
+  if (__builtin_abs(leftXOffset) > app.m_stickDeadzone) {
+    psyqo::FixedPoint<12> strafe = -(leftXOffset * speed * deltaTime) >> 7;
+    camera.MoveX(-(m_trig.cos(rotY) * strafe));
+    camera.MoveZ((m_trig.sin(rotY) * strafe));
+  }
+}
+
 void MainScene::frame() {
   uint32_t beginFrame = gpu().now();
   auto currentFrameCounter = gpu().getFrameCount();
@@ -251,6 +406,33 @@ void MainScene::frame() {
 
   mainScene.m_lastFrameCounter = currentFrameCounter;
 
+#ifdef PSXSPLASH_BENCHMARK
+  if (app.m_benchmark.Finished()) {
+    return;
+  }
+
+  // Every frame advances the path by exactly one step, whatever the frame
+  // rate, so that runs of different builds see the same views.
+  auto vsyncs = deltaTime;
+  deltaTime = 1;
+
+  psxsplash::BenchmarkInput input;
+  if (!app.m_benchmark.NextInput(input)) {
+    if (!app.m_benchmark.NextPack()) {
+      app.m_benchmark.Finish();
+      return;
+    }
+    loadPack(app.m_benchmark.CurrentPack());
+    camRotX = camRotY = camRotZ = 0.0_pi;
+    app.m_benchmark.BeginPack(app.m_loader);
+    app.m_benchmark.NextInput(input);
+  }
+
+  int16_t rightXOffset = input.rightX;
+  int16_t rightYOffset = input.rightY;
+  int16_t leftXOffset = input.leftX;
+  int16_t leftYOffset = input.leftY;
+#else
   uint8_t rightX = app.m_input.getAdc(psyqo::AdvancedPad::Pad::Pad1a, 0);
   uint8_t rightY = app.m_input.getAdc(psyqo::AdvancedPad::Pad::Pad1a, 1);
 
@@ -262,6 +444,11 @@ void MainScene::frame() {
   int16_t leftXOffset = (int16_t)leftX - 0x80;
   int16_t leftYOffset = (int16_t)leftY - 0x80;
 
+#ifdef PSXSPLASH_BENCHMARK_RECORD
+  app.m_benchmark.Record({leftXOffset, leftYOffset, rightXOffset, rightYOffset}, app.m_stickDeadzone);
+#endif
+#endif
+
   if (__builtin_abs(leftXOffset) < app.m_stickDeadzone &&
       __builtin_abs(leftYOffset) < app.m_stickDeadzone) {
     m_sprinting = false;
@@ -273,25 +460,18 @@ void MainScene::frame() {
     }*/
 
   psyqo::FixedPoint<12> speed = m_sprinting ? sprintSpeed : moveSpeed;
-
-  if (__builtin_abs(rightXOffset) > app.m_stickDeadzone) {
-    camRotY += (rightXOffset * rotSpeed * deltaTime) >> 7;
-  }
-  if (__builtin_abs(rightYOffset) > app.m_stickDeadzone) {
-    camRotX -= (rightYOffset * rotSpeed * deltaTime) >> 7;
-    camRotX = eastl::clamp(camRotX, -0.5_pi, 0.5_pi);
-  }
-  m_mainCamera.SetRotation(camRotX, camRotY, camRotZ);
-
-  if (__builtin_abs(leftYOffset) > app.m_stickDeadzone) {
-    psyqo::FixedPoint<12> forward = -(leftYOffset * speed * deltaTime) >> 7;
-    m_mainCamera.MoveX((m_trig.sin(camRotY) * forward));
-    m_mainCamera.MoveZ((m_trig.cos(camRotY) * forward));
-  }
-  if (__builtin_abs(leftXOffset) > app.m_stickDeadzone) {
-    psyqo::FixedPoint<12> strafe = -(leftXOffset * speed * deltaTime) >> 7;
-    m_mainCamera.MoveX(-(m_trig.cos(camRotY) * strafe));
-    m_mainCamera.MoveZ((m_trig.sin(camRotY) * strafe));
+  steer(m_mainCamera, camRotX, camRotY, leftXOffset, leftYOffset, rightXOffset,
+        rightYOffset, speed, deltaTime);
+
+  // The second player doesn't walk the navmeshes, and sees what streamed in
+  // around the first one. The streamer rebases both cameras.
+  if (m_splitScreen) {
+    auto pad2 = psyqo::AdvancedPad::Pad::Pad2a;
+    steer(m_secondCamera, cam2RotX, cam2RotY,
+          int16_t(app.m_input.getAdc(pad2, 2)) - 0x80,
+          int16_t(app.m_input.getAdc(pad2, 3)) - 0x80,
+          int16_t(app.m_input.getAdc(pad2, 0)) - 0x80,
+          int16_t(app.m_input.getAdc(pad2, 1)) - 0x80, moveSpeed, deltaTime);
   }
 
     /*
@@ -302,27 +482,96 @@ void MainScene::frame() {
         m_mainCamera.MoveY(-speed * deltaTime);
     }*/
 
-  if (!m_freecam) {
-    psyqo::Vec3 adjustedPosition = psxsplash::ComputeNavmeshPosition(
-        m_mainCamera.GetPosition(), *app.m_loader.navmeshes[0], -pheight);
+  app.m_budget.Update();
+  app.m_hierarchy.Update(deltaTime);
+  app.m_particles.Update(deltaTime);
+  psxsplash::Camera *cameras[] = {&m_mainCamera, &m_secondCamera};
+  app.m_streamer.Update(cameras, m_splitScreen ? 2 : 1, app.m_particles,
+                        app.m_broadphase);
+  app.m_animator.Update(deltaTime);
+  uint16_t firstNavmesh, navmeshCount;
+  app.m_streamer.CurrentNavmeshes(firstNavmesh, navmeshCount);
+
+  if (!m_freecam && navmeshCount > 0) {
+    psyqo::Vec3 adjustedPosition = app.m_navmeshes.ComputePosition(
+        m_mainCamera.GetPosition(), firstNavmesh, navmeshCount, -pheight);
     m_mainCamera.SetPosition(adjustedPosition.x, adjustedPosition.y,
                              adjustedPosition.z);
   }
 
-  if (!m_renderSelect) {
+  app.m_broadphase.Update(app.m_loader.gameObjects);
+#ifdef PSXSPLASH_DEBUG
+  // The player stands under the camera, up is -y
+  psyqo::Vec3 eye = m_mainCamera.GetPosition();
+  psyqo::FixedPoint<12> halfWidth = pheight >> 2;
+  psxsplash::Box player = {{eye.x - halfWidth, eye.y, eye.z - halfWidth},
+                           {eye.x + halfWidth, eye.y + pheight, eye.z + halfWidth}};
+  app.m_broadphase.TrackTriggers(player);
+
+  // What the player looks at, up to four heights away. The view looks down z.
+  app.m_raycaster.Update(app.m_loader.gameObjects);
+  const psyqo::Vec3 &forward = m_mainCamera.GetRotation().vs[2];
+  psyqo::FixedPoint<12> reach = pheight * 4;
+  psyqo::Vec3 ahead = {eye.x + forward.x * reach, eye.y + forward.y * reach,
+                       eye.z + forward.z * reach};
+  psxsplash::RayHit look;
+  bool looking = app.m_raycaster.Cast(eye, ahead, app.m_broadphase, look);
+#endif
+
+  uint32_t beginRender = gpu().now();
+  if (!m_renderSelect || navmeshCount == 0) {
     psxsplash::Renderer::GetInstance().Render(app.m_loader.gameObjects);
   } else {
     psxsplash::Renderer::GetInstance().RenderNavmeshPreview(
-        *app.m_loader.navmeshes[0], true);
+        &app.m_loader.navmeshes[firstNavmesh], navmeshCount,
+        app.m_navmeshes.Current() - firstNavmesh);
   }
+  uint32_t renderTime = gpu().now() - beginRender;
 
   app.m_font.chainprintf(gpu(), {{.x = 2, .y = 2}},
                          {{.r = 0xff, .g = 0xff, .b = 0xff}}, "FPS: %i",
                          gpu().getRefreshRate() / deltaTime);
 
+  const auto &quality = app.m_governor.Settings();
+  app.m_font.chainprintf(
+      gpu(), {{.x = 2, .y = 18}}, {{.r = 0xff, .g = 0xff, .b = 0xff}},
+      "Q%i/%i %ifps sub %i dist %i%% prims %i", app.m_governor.Level(),
+      psxsplash::QualityGovernor::LEVEL_COUNT - 1, app.m_governor.TargetFps(),
+      quality.maxSubdivision, quality.drawDistance * 100 / 256,
+      psxsplash::Renderer::GetInstance().GetStats().primitivesEmitted);
+
+#ifdef PSXSPLASH_DEBUG
+  if (app.m_broadphase.InsideCount() > 0) {
+    app.m_font.chainprintf(gpu(), {{.x = 2, .y = 34}},
+                           {{.r = 0xff, .g = 0xff, .b = 0xff}}, "trigger %i",
+                           app.m_broadphase.Inside()[0]);
+  }
+  if (looking) {
+    app.m_font.chainprintf(gpu(), {{.x = 2, .y = 50}},
+                           {{.r = 0xff, .g = 0xff, .b = 0xff}}, "look %i",
+                           int(look.object - app.m_loader.objectTable));
+  }
+#endif
+
   gpu().pumpCallbacks();
   uint32_t endFrame = gpu().now();
   uint32_t spent = endFrame - beginFrame;
+
+#ifdef PSXSPLASH_BENCHMARK
+  app.m_benchmark.ReportFrame(spent, renderTime, vsyncs,
+                              psxsplash::Renderer::GetInstance().GetStats());
+#else
+  if (app.m_governor.Update(deltaTime, spent)) {
+    psxsplash::Renderer::GetInstance().SetQuality(app.m_governor.Settings());
+  }
+#endif
+
+  // Background jobs get what is left of the frame budget, minus a margin for
+  // the vsync wait. Neither the governor nor the benchmark see that time.
+  uint32_t budget = app.m_governor.Budget() / 16 * 15;
+  if (spent < budget) {
+    app.m_jobs.Run(gpu(), budget - spent);
+  }
 }
 
 int main() { return app.run(); }
\ No newline at end of file
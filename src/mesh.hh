@@ -5,6 +5,21 @@
 
 namespace psxsplash {
 
+  // Material flags stored in Tri::flags. Zero is the textured, Gouraud shaded,
+  // subdivided and opaque path every triangle used to take.
+  namespace TriFlags {
+      static constexpr uint16_t UNTEXTURED = 1 << 0;
+      static constexpr uint16_t FLAT = 1 << 1;          // colorA is used for the whole triangle
+      static constexpr uint16_t NO_SUBDIVIDE = 1 << 2;  // never split, the exporter vouches for its size
+      static constexpr uint16_t SEMI_TRANS = 1 << 3;    // blending mode comes from tpage
+      static constexpr uint16_t LIT = 1 << 4;           // vertex colors computed by the GTE, see Tri
+      static constexpr uint16_t MATERIAL_MASK = 0x001f;
+  }  // namespace TriFlags
+
+  // LIT triangles don't store vertex colors. normal holds the normal of v0 and
+  // colorA..colorC hold the normals of v1 and v2 as two more PackedVec3. The
+  // base color is neutral for textured triangles, untextured ones keep it in
+  // the first three bytes of uvA/uvB.
   class Tri final {
     public:
       psyqo::GTE::PackedVec3 v0, v1, v2;  
@@ -18,8 +33,48 @@ namespace psxsplash {
       psyqo::PrimPieces::TPageAttr tpage; 
       uint16_t clutX;
       uint16_t clutY;
-      uint16_t padding; 
+      uint16_t flags;
   };
   static_assert(sizeof(Tri) == 52, "Tri is not 52 bytes");
+
+  // Compact alternative to a Tri array, written by tools/splashcook --compact for
+  // meshes without LIT triangles. Vertices are shared, and quantized over the
+  // object bounds in steps of 1 << shift from origin. Each one is packed as
+  // x | (z & 0x1f) << 11 | y << 16 | (z >> 5) << 27, so x and y go to the GTE
+  // with a single mask. The vertices are followed by runCount runs, each being
+  // a CompactRun and count CompactTri of its material.
+  struct CompactMesh {
+      // The renderer scales the rotation by 1 << shift, 4.0 still fits the 4.12 GTE matrix
+      static constexpr uint8_t MAX_SHIFT = 2;
+
+      psyqo::GTE::PackedVec3 origin;
+      uint8_t shift;
+      uint8_t pad;
+      uint16_t vertexCount;
+      uint16_t runCount;
+
+      const uint32_t *Vertices() const { return reinterpret_cast<const uint32_t *>(this + 1); }
+      static constexpr uint32_t VertexXY(uint32_t vertex) { return vertex & 0x07ff07ff; }
+      static constexpr uint32_t VertexZ(uint32_t vertex) { return ((vertex >> 11) & 0x1f) | ((vertex >> 22) & 0x3e0); }
+  };
+  static_assert(sizeof(CompactMesh) == 12, "CompactMesh is not 12 bytes");
+
+  // Triangles of a run share their material flags, texture page and CLUT
+  struct CompactRun {
+      uint16_t count;
+      uint8_t flags;
+      uint8_t clutX;
+      psyqo::PrimPieces::TPageAttr tpage;
+      uint16_t clutY;
+  };
+  static_assert(sizeof(CompactRun) == 8, "CompactRun is not 8 bytes");
+
+  // Only what the material draws with is stored, untextured triangles keep one padding UV
+  template <uint16_t material>
+  struct CompactTri {
+      psyqo::Color colors[(material & TriFlags::FLAT) ? 1 : 3];
+      uint16_t vertices[3];
+      psyqo::PrimPieces::UVCoords uvs[(material & TriFlags::UNTEXTURED) ? 1 : 3];
+  };
   
 } // namespace psxsplash
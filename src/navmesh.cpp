@@ -1,121 +1,271 @@
 #include "navmesh.hh"
 
-#include <array>
+#include <stdint.h>
 
-#include "psyqo/fixed-point.hh"
-#include "psyqo/vector.hh"
+#include <EASTL/algorithm.h>
 
-using namespace psyqo::fixed_point_literals;
-
-// FIXME: This entire file uses hard FixedPoint scaling of 100. This is not ideal.
-// It would be better to move the fixedpoint precision to 19 instead.
+#include "gtegeometry.hh"
+#include "splashpack.hh"
 
 namespace psxsplash {
 
-psyqo::FixedPoint<12> DotProduct2D(const psyqo::Vec2& a, const psyqo::Vec2& b) { return a.x * b.x + a.y * b.y; }
-
-psyqo::Vec2 ClosestPointOnSegment(const psyqo::Vec2& A, const psyqo::Vec2& B, const psyqo::Vec2& P) {
-    psyqo::Vec2 AB = {B.x - A.x, B.y - A.y};
-    psyqo::Vec2 AP = {P.x - A.x, P.y - A.y};
-    auto abDot = DotProduct2D(AB, AB);
-    if (abDot == 0) return A;
-    psyqo::FixedPoint<12> t = DotProduct2D(AP, AB) / abDot;
-    if (t < 0.0_fp) t = 0.0_fp;
-    if (t > 1.0_fp) t = 1.0_fp;
-    return {(A.x + AB.x * t), (A.y + AB.y * t)};
-}
+namespace {
+
+// A triangle moved so that the query point is at the origin of the XZ plane and its first vertex at the
+// one of Y, then scaled down by shift until the GTE kernels can take it. Triangles close to the query
+// point keep their full precision.
+struct LocalTri {
+    ShortVec3 v[3];
+    int32_t originY;
+    uint8_t shift;
+};
 
-bool PointInTriangle(psyqo::Vec3& p, NavMeshTri& tri) {
-    psyqo::Vec2 A = {tri.v0.x * 100, tri.v0.z * 100};
-    psyqo::Vec2 B = {tri.v1.x * 100, tri.v1.z * 100};
-    psyqo::Vec2 C = {tri.v2.x * 100, tri.v2.z * 100};
-    psyqo::Vec2 P = {p.x * 100, p.z * 100};
-
-    psyqo::Vec2 v0 = {B.x - A.x, B.y - A.y};
-    psyqo::Vec2 v1 = {C.x - A.x, C.y - A.y};
-    psyqo::Vec2 v2 = {P.x - A.x, P.y - A.y};
-
-    auto d00 = DotProduct2D(v0, v0);
-    auto d01 = DotProduct2D(v0, v1);
-    auto d11 = DotProduct2D(v1, v1);
-    auto d20 = DotProduct2D(v2, v0);
-    auto d21 = DotProduct2D(v2, v1);
-
-    psyqo::FixedPoint<12> denom = d00 * d11 - d01 * d01;
-    if (denom == 0.0_fp) {
-        return false;
+LocalTri localize(const NavMeshTri &tri, int32_t x, int32_t z) {
+    const psyqo::Vec3 *vertices[3] = {&tri.v0, &tri.v1, &tri.v2};
+    int32_t local[3][3];
+    int32_t extent = 0;
+    for (unsigned i = 0; i < 3; i++) {
+        local[i][0] = vertices[i]->x.raw() - x;
+        local[i][1] = vertices[i]->y.raw() - tri.v0.y.raw();
+        local[i][2] = vertices[i]->z.raw() - z;
+        for (unsigned j = 0; j < 3; j++) {
+            int32_t magnitude = __builtin_abs(local[i][j]);
+            if (magnitude > extent) extent = magnitude;
+        }
     }
-    auto invDenom = 1.0_fp / denom;
-    auto u = (d11 * d20 - d01 * d21) * invDenom;
-    auto w = (d00 * d21 - d01 * d20) * invDenom;
 
-    return (u >= 0.0_fp) && (w >= 0.0_fp) && (u + w <= 1.0_fp);
+    LocalTri result;
+    result.originY = tri.v0.y.raw();
+    result.shift = 0;
+    while ((extent >> result.shift) > GEOMETRY_RANGE) result.shift++;
+    for (unsigned i = 0; i < 3; i++) {
+        result.v[i] = {int16_t(local[i][0] >> result.shift), int16_t(local[i][1] >> result.shift),
+                       int16_t(local[i][2] >> result.shift)};
+    }
+    return result;
 }
 
-psyqo::Vec3 ComputeNormal(const NavMeshTri& tri) {
-    psyqo::Vec3 v1 = {tri.v1.x * 100 - tri.v0.x  * 100, tri.v1.y  * 100 - tri.v0.y  * 100, tri.v1.z  * 100 - tri.v0.z  * 100};
-    psyqo::Vec3 v2 = {tri.v2.x  * 100 - tri.v0.x  * 100, tri.v2.y  * 100 - tri.v0.y  * 100, tri.v2.z  * 100 - tri.v0.z  * 100};
+// Borders included, triangles that are only a line seen from above contain nothing
+bool containsOrigin(const LocalTri &tri) {
+    ShortVec3 origin = {0, 0, 0};
+    LongVec3 edges;
+    EdgeFunctionsXZGTE(tri.v[0], tri.v[1], tri.v[2], &origin, &edges, 1);
+    if (edges.x + edges.y + edges.z == 0) return false;
+    return (edges.x >= 0 && edges.y >= 0 && edges.z >= 0) || (edges.x <= 0 && edges.y <= 0 && edges.z <= 0);
+}
 
-    psyqo::Vec3 normal = {
-        v1.y * v2.z - v1.z * v2.y,
-        v1.z * v2.x - v1.x * v2.z,
-        v1.x * v2.y - v1.y * v2.x
-    };
-    return normal;
+// Raw height of the plane of the triangle at the origin, or fallback for vertical triangles
+int32_t heightAtOrigin(const LocalTri &tri, int32_t fallback) {
+    ShortVec3 ab = {int16_t(tri.v[1].x - tri.v[0].x), int16_t(tri.v[1].y - tri.v[0].y),
+                    int16_t(tri.v[1].z - tri.v[0].z)};
+    ShortVec3 ac = {int16_t(tri.v[2].x - tri.v[0].x), int16_t(tri.v[2].y - tri.v[0].y),
+                    int16_t(tri.v[2].z - tri.v[0].z)};
+    LongVec3 normal;
+    CrossProductsGTE(&ab, &ac, &normal, 1);
+
+    // Only the ratios of the normal matter, it goes down to 16 bits for mvmva
+    int32_t extent = __builtin_abs(normal.x);
+    if (__builtin_abs(normal.y) > extent) extent = __builtin_abs(normal.y);
+    if (__builtin_abs(normal.z) > extent) extent = __builtin_abs(normal.z);
+    unsigned shift = 0;
+    while ((extent >> shift) > 0x7fff) shift++;
+    int32_t ny = normal.y >> shift;
+    if (ny == 0) return fallback;
+
+    // The plane goes through v0: n . (p - v0) = 0, p being (0, y, 0)
+    ShortVec3 rows[3] = {{int16_t(normal.x >> shift), 0, int16_t(normal.z >> shift)}, {}, {}};
+    LongVec3 dot;
+    DotProductsGTE(rows, &tri.v[0], &dot, 1);
+    int32_t y = tri.v[0].y + dot.x / ny;
+    return tri.originY + (y << tri.shift);
 }
 
-psyqo::FixedPoint<12> CalculateY(const psyqo::Vec3& p, const NavMeshTri& tri) {
-    psyqo::Vec3 normal = ComputeNormal(tri);
+// Point of the border of the triangle closest to the origin, and its squared distance
+ShortVec3 closestOnBorder(const LocalTri &tri, int32_t &distance) {
+    ShortVec3 edges[3];
+    for (unsigned i = 0; i < 3; i++) {
+        const ShortVec3 &start = tri.v[i], &end = tri.v[(i + 1) % 3];
+        edges[i] = {int16_t(end.x - start.x), 0, int16_t(end.z - start.z)};
+    }
+    int32_t lengths[3];
+    SquaredLengthsGTE(edges, lengths, 3);
+    // Every edge against every vertex, only the ones with their own start are used
+    LongVec3 along[3];
+    DotProductsGTE(edges, tri.v, along, 3);
+    int32_t starts[3] = {along[0].x, along[1].y, along[2].z};
 
-    psyqo::FixedPoint<12> A = normal.x;
-    psyqo::FixedPoint<12> B = normal.y;
-    psyqo::FixedPoint<12> C = normal.z;
+    ShortVec3 closest[3];
+    for (unsigned i = 0; i < 3; i++) {
+        const ShortVec3 &start = tri.v[i], &end = tri.v[(i + 1) % 3];
+        // The origin projects at -(start . edge) / |edge|^2 along the edge
+        int32_t t = -starts[i];
+        if (t <= 0 || lengths[i] == 0) {
+            closest[i] = {start.x, 0, start.z};
+        } else if (t >= lengths[i]) {
+            closest[i] = {end.x, 0, end.z};
+        } else {
+            closest[i] = {int16_t(start.x + int64_t(edges[i].x) * t / lengths[i]), 0,
+                          int16_t(start.z + int64_t(edges[i].z) * t / lengths[i])};
+        }
+    }
+    int32_t distances[3];
+    SquaredLengthsGTE(closest, distances, 3);
 
-    psyqo::FixedPoint<12> D = -(A * tri.v0.x + B * tri.v0.y + C * tri.v0.z);
+    unsigned best = 0;
+    for (unsigned i = 1; i < 3; i++) {
+        if (distances[i] < distances[best]) best = i;
+    }
+    distance = distances[best];
+    return closest[best];
+}
 
-    if (B != 0.0_fp) {
-        return -(A * p.x + C * p.z + D) / B;
-    } else {
-        return p.y;
+// Index of the first triangle under (x, z), -1 for none
+int triangleAt(const Navmesh &navmesh, int32_t x, int32_t z) {
+    for (int i = 0; i < navmesh.triangleCount; i++) {
+        if (containsOrigin(localize(navmesh.polygons[i], x, z))) return i;
     }
+    return -1;
+}
+
+int32_t heightAt(const NavMeshTri &tri, int32_t x, int32_t z, int32_t fallback) {
+    return heightAtOrigin(localize(tri, x, z), fallback);
 }
 
-psyqo::Vec3 ComputeNavmeshPosition(psyqo::Vec3& position, Navmesh& navmesh, psyqo::FixedPoint<12> pheight) {
+// Point of the borders of the navmesh closest to (x, z) and its triangle, returns the squared distance to
+// it or UINT64_MAX for an empty navmesh. Every triangle has its own scale, so the distances are compared
+// once scaled back up.
+uint64_t closestBorder(const Navmesh &navmesh, int32_t x, int32_t z, int32_t &closestX, int32_t &closestZ,
+                       int &triangle) {
+    uint64_t bestDistance = UINT64_MAX;
+    triangle = -1;
     for (int i = 0; i < navmesh.triangleCount; i++) {
-        if (PointInTriangle(position, navmesh.polygons[i])) {
-            position.y = CalculateY(position, navmesh.polygons[i]) + pheight;
-            return position;
+        LocalTri tri = localize(navmesh.polygons[i], x, z);
+        int32_t distance;
+        ShortVec3 closest = closestOnBorder(tri, distance);
+        uint64_t scaled = uint64_t(distance) << (2 * tri.shift);
+        if (scaled < bestDistance) {
+            bestDistance = scaled;
+            closestX = x + (closest.x << tri.shift);
+            closestZ = z + (closest.z << tri.shift);
+            triangle = i;
         }
     }
+    return bestDistance;
+}
 
-    psyqo::Vec2 P = {position.x * 100, position.z * 100};
+void moveTo(psyqo::Vec3 &position, const NavMeshTri &tri, int32_t x, int32_t z, psyqo::FixedPoint<12> pheight) {
+    position.x = psyqo::FixedPoint<12>(x, psyqo::FixedPoint<12>::RAW);
+    position.z = psyqo::FixedPoint<12>(z, psyqo::FixedPoint<12>::RAW);
+    position.y = psyqo::FixedPoint<12>(heightAt(tri, x, z, position.y.raw()), psyqo::FixedPoint<12>::RAW) + pheight;
+}
 
-    psyqo::Vec2 closestPoint;
-    psyqo::FixedPoint<12> minDist = 0x7ffff;
+}  // namespace
 
-    for (int i = 0; i < navmesh.triangleCount; i++) {
-        NavMeshTri& tri = navmesh.polygons[i];
-        psyqo::Vec2 A = {tri.v0.x * 100, tri.v0.z * 100};
-        psyqo::Vec2 B = {tri.v1.x * 100, tri.v1.z * 100};
-        psyqo::Vec2 C = {tri.v2.x * 100, tri.v2.z * 100};
-
-        std::array<std::pair<psyqo::Vec2, psyqo::Vec2>, 3> edges = {{{A, B}, {B, C}, {C, A}}};
-
-        for (auto& edge : edges) {
-            psyqo::Vec2 proj = ClosestPointOnSegment(edge.first, edge.second, P);
-            psyqo::Vec2 diff = {proj.x - P.x, proj.y - P.y};
-            auto distSq = DotProduct2D(diff, diff);
-            if (distSq < minDist) {
-                minDist = distSq;
-                closestPoint = proj;
-                position.y = CalculateY(position, navmesh.polygons[i]) + pheight;
+psyqo::Vec3 ComputeNavmeshPosition(psyqo::Vec3 &position, Navmesh &navmesh, psyqo::FixedPoint<12> pheight) {
+    int32_t x = position.x.raw();
+    int32_t z = position.z.raw();
+    int triangle = triangleAt(navmesh, x, z);
+    if (triangle >= 0) {
+        moveTo(position, navmesh.polygons[triangle], x, z, pheight);
+        return position;
+    }
+
+    // Off the navmesh, back onto the closest border
+    int32_t closestX, closestZ;
+    if (closestBorder(navmesh, x, z, closestX, closestZ, triangle) == UINT64_MAX) return position;
+    moveTo(position, navmesh.polygons[triangle], closestX, closestZ, pheight);
+    return position;
+}
+
+void NavmeshSelector::Start(SplashPackLoader &loader) {
+    m_loader = &loader;
+    m_current = NONE;
+    m_tested = 0;
+    m_bounds.resize(loader.navmeshes.size());
+    for (uint16_t i = 0; i < loader.navmeshes.size(); i++) {
+        const Navmesh &navmesh = *loader.navmeshes[i];
+        Bounds &bounds = m_bounds[i];
+        bounds = {INT32_MAX, INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN, INT32_MIN};
+        for (uint16_t t = 0; t < navmesh.triangleCount; t++) {
+            const NavMeshTri &tri = navmesh.polygons[t];
+            for (const psyqo::Vec3 *v : {&tri.v0, &tri.v1, &tri.v2}) {
+                bounds.minX = eastl::min(bounds.minX, v->x.raw());
+                bounds.minY = eastl::min(bounds.minY, v->y.raw());
+                bounds.minZ = eastl::min(bounds.minZ, v->z.raw());
+                bounds.maxX = eastl::max(bounds.maxX, v->x.raw());
+                bounds.maxY = eastl::max(bounds.maxY, v->y.raw());
+                bounds.maxZ = eastl::max(bounds.maxZ, v->z.raw());
             }
         }
     }
+}
+
+psyqo::Vec3 NavmeshSelector::ComputePosition(psyqo::Vec3 &position, uint16_t first, uint16_t count,
+                                             psyqo::FixedPoint<12> pheight) {
+    int32_t x = position.x.raw();
+    int32_t z = position.z.raw();
+    int32_t feet = (position.y - pheight).raw();
+    int32_t step = __builtin_abs(pheight.raw()) >> 1;
+    auto holds = [&](uint16_t index, bool vertically) {
+        const Bounds &bounds = m_bounds[index];
+        return x >= bounds.minX && x <= bounds.maxX && z >= bounds.minZ && z <= bounds.maxZ &&
+               (!vertically || (feet >= bounds.minY - step && feet <= bounds.maxY + step));
+    };
+    m_tested = 0;
+    if (m_current < first || m_current >= first + count) m_current = NONE;
+
+    // The current navmesh first, so that the ones it overlaps don't take over
+    if (m_current != NONE && holds(m_current, false)) {
+        const Navmesh &navmesh = *m_loader->navmeshes[m_current];
+        m_tested++;
+        int triangle = triangleAt(navmesh, x, z);
+        if (triangle >= 0) {
+            moveTo(position, navmesh.polygons[triangle], x, z, pheight);
+            return position;
+        }
+    }
 
-    position.x = closestPoint.x / 100;
-    position.z = closestPoint.y / 100;
+    // Hand-off, to the closest floor when there is no current navmesh yet
+    uint16_t best = NONE;
+    int bestTriangle = -1;
+    int32_t bestGap = INT32_MAX;
+    for (uint16_t i = first; i < first + count; i++) {
+        if (i == m_current || !holds(i, m_current != NONE)) continue;
+        const Navmesh &navmesh = *m_loader->navmeshes[i];
+        m_tested++;
+        int triangle = triangleAt(navmesh, x, z);
+        if (triangle < 0) continue;
+        int32_t gap = __builtin_abs(heightAt(navmesh.polygons[triangle], x, z, feet) - feet);
+        if ((m_current != NONE && gap > step) || gap >= bestGap) continue;
+        best = i;
+        bestTriangle = triangle;
+        bestGap = gap;
+    }
+    if (best != NONE) {
+        m_current = best;
+        moveTo(position, m_loader->navmeshes[best]->polygons[bestTriangle], x, z, pheight);
+        return position;
+    }
 
+    // Off every navmesh, back onto the current one, or the closest one
+    uint64_t bestDistance = UINT64_MAX;
+    int32_t bestX = x, bestZ = z;
+    for (uint16_t i = first; i < first + count; i++) {
+        if (m_current != NONE && i != m_current) continue;
+        int32_t closestX, closestZ;
+        int triangle;
+        uint64_t distance = closestBorder(*m_loader->navmeshes[i], x, z, closestX, closestZ, triangle);
+        m_tested++;
+        if (distance >= bestDistance) continue;
+        bestDistance = distance;
+        bestX = closestX;
+        bestZ = closestZ;
+        best = i;
+        bestTriangle = triangle;
+    }
+    if (best == NONE) return position;
+    m_current = best;
+    moveTo(position, m_loader->navmeshes[best]->polygons[bestTriangle], bestX, bestZ, pheight);
     return position;
 }
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <EASTL/vector.h>
 #include <psyqo/vector.hh>
 
 namespace psxsplash {
@@ -19,6 +22,42 @@ class Navmesh final {
     uint16_t reserved;
 };
 
+class SplashPackLoader;
+
 psyqo::Vec3 ComputeNavmeshPosition(psyqo::Vec3& position, Navmesh& navmesh, psyqo::FixedPoint<12> pheight);
 
+// Picks the navmesh the player walks on among the ones of a pack, or of its origin sector (see
+// WorldStreamer), so multi-floor and multi-area levels don't need a single navmesh every query scans.
+// Only the navmeshes whose bounds hold the player get their triangles tested. The player stays on its
+// navmesh until it is over a triangle of another one within half its height of its feet: navmeshes
+// connect along shared edges or overlapping borders, and floors above and below don't take over. Off
+// every navmesh, it gets back onto the closest border of the one it was on.
+class NavmeshSelector final {
+  public:
+    static constexpr uint16_t NONE = 0xffff;
+
+    // Computes the bounds of the pack's navmeshes, call after LoadSplashpack
+    void Start(SplashPackLoader& loader);
+
+    // Like ComputeNavmeshPosition, over the navmeshes first to first + count of the pack
+    psyqo::Vec3 ComputePosition(psyqo::Vec3& position, uint16_t first, uint16_t count,
+                                psyqo::FixedPoint<12> pheight);
+
+    // Index in the pack of the navmesh the player is on, NONE before the first query
+    uint16_t Current() const { return m_current; }
+    // Navmeshes the last query tested the triangles of
+    uint16_t Tested() const { return m_tested; }
+
+  private:
+    struct Bounds {
+        int32_t minX, minY, minZ;
+        int32_t maxX, maxY, maxZ;
+    };
+
+    SplashPackLoader* m_loader = nullptr;
+    eastl::vector<Bounds> m_bounds;
+    uint16_t m_current = NONE;
+    uint16_t m_tested = 0;
+};
+
 }  // namespace psxsplash
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "particles.hh"
+
+namespace psxsplash {
+
+static bool fitsGTE(int32_t value) { return value >= -0x8000 && value <= 0x7fff; }
+
+bool ParticlePool::Spawn(const psyqo::Vec3 &position, const psyqo::Vec3 &velocity, uint16_t life, uint16_t size,
+                         psyqo::Color color, uint8_t look) {
+    if (m_count == CAPACITY || life == 0 || look >= MAX_LOOKS) return false;
+    if (!fitsGTE(position.x.raw()) || !fitsGTE(position.y.raw()) || !fitsGTE(position.z.raw())) return false;
+
+    uint16_t i = m_count++;
+    m_x[i] = position.x.raw();
+    m_y[i] = position.y.raw();
+    m_z[i] = position.z.raw();
+    m_vx[i] = velocity.x.raw();
+    m_vy[i] = velocity.y.raw();
+    m_vz[i] = velocity.z.raw();
+    m_life[i] = life;
+    m_size[i] = size;
+    m_color[i] = color;
+    m_look[i] = look;
+    return true;
+}
+
+void ParticlePool::Update(uint32_t frames) {
+    for (uint16_t i = 0; i < m_count;) {
+        // Billboards neither age nor move
+        if (m_life[i] == PERMANENT) {
+            i++;
+            continue;
+        }
+        if (m_life[i] <= frames) {
+            remove(i);
+            continue;
+        }
+        m_life[i] -= frames;
+
+        m_vy[i] += m_gravity * int32_t(frames);
+        int32_t x = m_x[i] + m_vx[i] * int32_t(frames);
+        int32_t y = m_y[i] + m_vy[i] * int32_t(frames);
+        int32_t z = m_z[i] + m_vz[i] * int32_t(frames);
+        if (!fitsGTE(x) || !fitsGTE(y) || !fitsGTE(z)) {
+            remove(i);
+            continue;
+        }
+        m_x[i] = x;
+        m_y[i] = y;
+        m_z[i] = z;
+        i++;
+    }
+}
+
+void ParticlePool::Shift(int32_t x, int32_t z) {
+    for (uint16_t i = 0; i < m_count;) {
+        int32_t shiftedX = m_x[i] + x;
+        int32_t shiftedZ = m_z[i] + z;
+        if (!fitsGTE(shiftedX) || !fitsGTE(shiftedZ)) {
+            remove(i);
+            continue;
+        }
+        m_x[i] = shiftedX;
+        m_z[i] = shiftedZ;
+        i++;
+    }
+}
+
+// The last particle takes the place of the removed one
+void ParticlePool::remove(uint16_t index) {
+    uint16_t last = --m_count;
+    m_x[index] = m_x[last];
+    m_y[index] = m_y[last];
+    m_z[index] = m_z[last];
+    m_vx[index] = m_vx[last];
+    m_vy[index] = m_vy[last];
+    m_vz[index] = m_vz[last];
+    m_life[index] = m_life[last];
+    m_size[index] = m_size[last];
+    m_color[index] = m_color[last];
+    m_look[index] = m_look[last];
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <psyqo/primitives/common.hh>
+#include <psyqo/vector.hh>
+
+namespace psxsplash {
+
+// How a group of particles is drawn. Untextured sprites are flat rectangles, textured ones are
+// quads, as sprites can't scale their texture.
+struct ParticleLook {
+    bool textured;
+    bool semiTrans;  // blending mode comes from tpage
+    psyqo::PrimPieces::TPageAttr tpage;
+    uint16_t clutX, clutY;
+    uint8_t u0, v0, u1, v1;  // texture rectangle, u1 and v1 included
+};
+
+// Fixed pool of camera facing sprites, for particles and billboarded foliage. Every field is an array
+// of its own, so the update only walks the positions and lives, and the renderer projects the centers
+// straight from the position arrays, three at a time (see Renderer::renderParticles). Live particles
+// are kept packed at the start of the arrays.
+class ParticlePool final {
+  public:
+    static constexpr uint16_t CAPACITY = 256;
+    static constexpr uint8_t MAX_LOOKS = 8;
+    // Life of billboards, which stay until cleared
+    static constexpr uint16_t PERMANENT = 0xffff;
+
+    void SetLook(uint8_t index, const ParticleLook &look) { m_looks[index] = look; }
+    const ParticleLook &Look(uint8_t index) const { return m_looks[index]; }
+
+    // Added to the velocity of every moving particle, per frame
+    void SetGravity(int16_t gravity) { m_gravity = gravity; }
+    // Sprites drawn per frame at most, the rest are dropped
+    void SetBudget(uint16_t budget) { m_budget = budget; }
+    uint16_t Budget() const { return m_budget; }
+
+    // position is relative to the origin like the objects, velocity in 4.12 units per frame and size
+    // the world size of the sprite. Returns false when the pool is full or the position out of the
+    // GTE's 16 bits range.
+    bool Spawn(const psyqo::Vec3 &position, const psyqo::Vec3 &velocity, uint16_t life, uint16_t size,
+               psyqo::Color color, uint8_t look);
+    void Clear() { m_count = 0; }
+
+    // Ages and moves the particles, frames being the amount of frames since the last update
+    void Update(uint32_t frames);
+    // Follows a rebase of the origin, see WorldStreamer. Particles that end up out of range are dropped.
+    void Shift(int32_t x, int32_t z);
+
+    uint16_t Count() const { return m_count; }
+    const int16_t *X() const { return m_x; }
+    const int16_t *Y() const { return m_y; }
+    const int16_t *Z() const { return m_z; }
+    const uint16_t *Sizes() const { return m_size; }
+    const psyqo::Color *Colors() const { return m_color; }
+    const uint8_t *Looks() const { return m_look; }
+
+  private:
+    int16_t m_x[CAPACITY], m_y[CAPACITY], m_z[CAPACITY];
+    int16_t m_vx[CAPACITY], m_vy[CAPACITY], m_vz[CAPACITY];
+    uint16_t m_life[CAPACITY];
+    uint16_t m_size[CAPACITY];
+    psyqo::Color m_color[CAPACITY];
+    uint8_t m_look[CAPACITY];
+    uint16_t m_count = 0;
+
+    ParticleLook m_looks[MAX_LOOKS] = {};
+    int16_t m_gravity = 0;
+    uint16_t m_budget = CAPACITY;
+
+    void remove(uint16_t index);
+};
+
+}  // namespace psxsplash
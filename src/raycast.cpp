@@ -0,0 +1,374 @@
+#include "raycast.hh"
+
+#include <EASTL/algorithm.h>
+#include <psyqo/kernel.hh>
+
+#include "splashpack.hh"
+
+namespace psxsplash {
+
+namespace {
+
+// Fractions of a segment, in 1 << 16 units
+constexpr int32_t FRACTION_ONE = 1 << 16;
+
+struct BuildItem {
+    int16_t min[3], max[3];
+    int32_t center[3];
+};
+
+int64_t abs64(int64_t value) { return value < 0 ? -value : value; }
+
+void cross(const int64_t a[3], const int64_t b[3], int64_t out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+int64_t dot(const int64_t a[3], const int64_t b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+// Separating axes test, with every length doubled so that the box center stays an integer
+bool segmentHitsBox(const int32_t a[3], const int32_t b[3], const BvhNode &node) {
+    int64_t m[3], d[3], e[3], ad[3];
+    for (unsigned i = 0; i < 3; i++) {
+        m[i] = int64_t(a[i]) + b[i] - node.min[i] - node.max[i];
+        d[i] = b[i] - a[i];
+        e[i] = node.max[i] - node.min[i];
+        ad[i] = abs64(d[i]);
+        if (abs64(m[i]) > e[i] + ad[i]) return false;
+    }
+    if (abs64(m[1] * d[2] - m[2] * d[1]) > e[1] * ad[2] + e[2] * ad[1]) return false;
+    if (abs64(m[2] * d[0] - m[0] * d[2]) > e[0] * ad[2] + e[2] * ad[0]) return false;
+    if (abs64(m[0] * d[1] - m[1] * d[0]) > e[0] * ad[1] + e[1] * ad[0]) return false;
+    return true;
+}
+
+// Where the segment ab goes through the triangle, borders included, or -1. Möller-Trumbore without the
+// divisions but the last one: with segments up to MAX_LENGTH, every product fits in 64 bits.
+int32_t segmentHitsTriangle(const int32_t a[3], const int32_t b[3], const int32_t v[3][3]) {
+    int64_t e1[3], e2[3], d[3], s[3], p[3], q[3];
+    for (unsigned i = 0; i < 3; i++) {
+        e1[i] = v[1][i] - v[0][i];
+        e2[i] = v[2][i] - v[0][i];
+        d[i] = b[i] - a[i];
+        s[i] = a[i] - v[0][i];
+    }
+    cross(d, e2, p);
+    int64_t det = dot(e1, p);
+    if (det == 0) return -1;
+    cross(s, e1, q);
+    int64_t u = dot(s, p), w = dot(d, q), t = dot(e2, q);
+    if (det < 0) {
+        det = -det;
+        u = -u;
+        w = -w;
+        t = -t;
+    }
+    if (u < 0 || w < 0 || u + w > det || t < 0 || t > det) return -1;
+    while (det >= (int64_t(1) << 46)) {
+        det >>= 1;
+        t >>= 1;
+    }
+    return int32_t((t << 16) / det);
+}
+
+template <uint16_t material>
+const CompactRun *collectRun(const CompactRun &run, eastl::vector<const uint16_t *> &out) {
+    const CompactTri<material> *records = reinterpret_cast<const CompactTri<material> *>(&run + 1);
+    for (uint16_t i = 0; i < run.count; i++) out.push_back(records[i].vertices);
+    return reinterpret_cast<const CompactRun *>(records + run.count);
+}
+
+// Only the color and UV counts change the layout of a CompactTri
+const CompactRun *collectRun(const CompactRun &run, eastl::vector<const uint16_t *> &out) {
+    switch (run.flags & (TriFlags::UNTEXTURED | TriFlags::FLAT)) {
+        case 0:
+            return collectRun<0>(run, out);
+        case TriFlags::UNTEXTURED:
+            return collectRun<TriFlags::UNTEXTURED>(run, out);
+        case TriFlags::FLAT:
+            return collectRun<TriFlags::FLAT>(run, out);
+        default:
+            return collectRun<TriFlags::UNTEXTURED | TriFlags::FLAT>(run, out);
+    }
+}
+
+// Median split over the longest axis of the triangle centers
+void split(eastl::vector<BvhNode> &nodes, uint16_t *triangles, const BuildItem *items, uint16_t node,
+           uint16_t first, uint16_t count) {
+    BvhNode bounds = {{0x7fff, 0x7fff, 0x7fff}, {-0x8000, -0x8000, -0x8000}, first, count};
+    int32_t low[3] = {INT32_MAX, INT32_MAX, INT32_MAX}, high[3] = {INT32_MIN, INT32_MIN, INT32_MIN};
+    for (uint16_t i = first; i < first + count; i++) {
+        const BuildItem &item = items[triangles[i]];
+        for (unsigned axis = 0; axis < 3; axis++) {
+            bounds.min[axis] = eastl::min(bounds.min[axis], item.min[axis]);
+            bounds.max[axis] = eastl::max(bounds.max[axis], item.max[axis]);
+            low[axis] = eastl::min(low[axis], item.center[axis]);
+            high[axis] = eastl::max(high[axis], item.center[axis]);
+        }
+    }
+    nodes[node] = bounds;
+    if (count <= RayCaster::LEAF_SIZE) return;
+
+    unsigned axis = 0;
+    for (unsigned i = 1; i < 3; i++) {
+        if (high[i] - low[i] > high[axis] - low[axis]) axis = i;
+    }
+    eastl::sort(triangles + first, triangles + first + count,
+                [&](uint16_t a, uint16_t b) { return items[a].center[axis] < items[b].center[axis]; });
+
+    uint16_t children = nodes.size();
+    nodes.push_back({});
+    nodes.push_back({});
+    nodes[node].first = children;
+    nodes[node].count = 0;
+    uint16_t half = count / 2;
+    split(nodes, triangles, items, children, first, half);
+    split(nodes, triangles, items, children + 1, first + half, count - half);
+}
+
+}  // namespace
+
+void RayCaster::Start(SplashPackLoader &loader) {
+    m_meshes.clear();
+    m_objects = loader.objectTable;
+    m_bvhOf.assign(loader.objectCount, NONE);
+    for (GameObject *go : loader.gameObjects) prepare(go);
+}
+
+void RayCaster::Update(const eastl::vector<GameObject *> &objects) {
+    for (GameObject *go : objects) {
+        if (prepare(go)) return;
+    }
+}
+
+// True when a BVH had to be built
+bool RayCaster::prepare(GameObject *go) {
+    uint16_t &bvh = m_bvhOf[go - m_objects];
+    if (bvh != NONE) return false;
+    for (uint16_t i = 0; i < m_meshes.size(); i++) {
+        if (m_meshes[i].mesh != go->polygons) continue;
+        bvh = i;
+        return false;
+    }
+
+    bvh = m_meshes.size();
+    m_meshes.push_back({});
+    MeshBvh &mesh = m_meshes.back();
+    mesh.mesh = go->polygons;
+    mesh.compact = go->IsCompact();
+    if (mesh.compact) {
+        const CompactMesh &compact = *go->compact;
+        const CompactRun *run = reinterpret_cast<const CompactRun *>(compact.Vertices() + compact.vertexCount);
+        mesh.compactTris.reserve(go->TriangleCount());
+        for (uint16_t i = 0; i < compact.runCount; i++) run = collectRun(*run, mesh.compactTris);
+    }
+    build(mesh, go->TriangleCount());
+    return true;
+}
+
+void RayCaster::build(MeshBvh &bvh, uint16_t count) {
+    if (count == 0) return;
+    // Only while building
+    eastl::vector<BuildItem> items(count);
+    for (uint16_t i = 0; i < count; i++) {
+        int32_t v[3][3];
+        vertices(bvh, i, v);
+        for (unsigned axis = 0; axis < 3; axis++) {
+            items[i].min[axis] = eastl::min(eastl::min(v[0][axis], v[1][axis]), v[2][axis]);
+            items[i].max[axis] = eastl::max(eastl::max(v[0][axis], v[1][axis]), v[2][axis]);
+            items[i].center[axis] = v[0][axis] + v[1][axis] + v[2][axis];
+        }
+    }
+    bvh.triangles.resize(count);
+    for (uint16_t i = 0; i < count; i++) bvh.triangles[i] = i;
+    bvh.nodes.reserve(2 * (count / LEAF_SIZE) + 1);
+    bvh.nodes.push_back({});
+    split(bvh.nodes, bvh.triangles.data(), items.data(), 0, 0, count);
+}
+
+// Object space, like the renderer sees them
+void RayCaster::vertices(const MeshBvh &bvh, uint16_t triangle, int32_t out[3][3]) const {
+    if (!bvh.compact) {
+        const Tri &tri = static_cast<const Tri *>(bvh.mesh)[triangle];
+        const psyqo::GTE::PackedVec3 *v[3] = {&tri.v0, &tri.v1, &tri.v2};
+        for (unsigned i = 0; i < 3; i++) {
+            out[i][0] = v[i]->x.raw();
+            out[i][1] = v[i]->y.raw();
+            out[i][2] = v[i]->z.raw();
+        }
+        return;
+    }
+    const CompactMesh &mesh = *static_cast<const CompactMesh *>(bvh.mesh);
+    const uint32_t *packed = mesh.Vertices();
+    const uint16_t *indices = bvh.compactTris[triangle];
+    for (unsigned i = 0; i < 3; i++) {
+        uint32_t vertex = packed[indices[i]];
+        uint32_t xy = CompactMesh::VertexXY(vertex);
+        out[i][0] = mesh.origin.x.raw() + int32_t((xy & 0xffff) << mesh.shift);
+        out[i][1] = mesh.origin.y.raw() + int32_t((xy >> 16) << mesh.shift);
+        out[i][2] = mesh.origin.z.raw() + int32_t(CompactMesh::VertexZ(vertex) << mesh.shift);
+    }
+}
+
+bool RayCaster::Cast(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase, RayHit &hit,
+                     Budget budget) {
+    return cast(from, to, broadphase, hit, budget, false);
+}
+
+bool RayCaster::Blocked(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase,
+                        Budget budget) {
+    RayHit hit;
+    return cast(from, to, broadphase, hit, budget, true);
+}
+
+bool RayCaster::cast(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase, RayHit &hit,
+                     Budget budget, bool any) {
+    m_budget = budget;
+    m_nodesTested = m_trianglesTested = 0;
+    m_exhausted = false;
+
+    int32_t start[3] = {from.x.raw(), from.y.raw(), from.z.raw()};
+    int32_t delta[3] = {(to.x - from.x).raw(), (to.y - from.y).raw(), (to.z - from.z).raw()};
+    int32_t longest = eastl::max(eastl::max(__builtin_abs(delta[0]), __builtin_abs(delta[1])),
+                                 __builtin_abs(delta[2]));
+    if (longest > MAX_LENGTH) {
+        for (unsigned i = 0; i < 3; i++) delta[i] = int64_t(delta[i]) * MAX_LENGTH / longest;
+    }
+
+    // Closest objects first, so the segment gets shorter early
+    auto fixed = [](int32_t raw) { return psyqo::FixedPoint<12>(raw, psyqo::FixedPoint<12>::RAW); };
+    int32_t end[3] = {start[0] + delta[0], start[1] + delta[1], start[2] + delta[2]};
+    Box box = {{fixed(eastl::min(start[0], end[0])), fixed(eastl::min(start[1], end[1])),
+                fixed(eastl::min(start[2], end[2]))},
+               {fixed(eastl::max(start[0], end[0])), fixed(eastl::max(start[1], end[1])),
+                fixed(eastl::max(start[2], end[2]))}};
+    uint16_t ids[MAX_OBJECTS];
+    uint32_t distances[MAX_OBJECTS];
+    uint16_t count = broadphase.Query(box, Broadphase::Kind::Object, ids, MAX_OBJECTS);
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t id = ids[i];
+        const psyqo::Vec3 &position = m_objects[id].position;
+        int32_t offset[3] = {(position.x.raw() - start[0]) >> 6, (position.y.raw() - start[1]) >> 6,
+                             (position.z.raw() - start[2]) >> 6};
+        uint32_t distance = offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2];
+        uint16_t at = i;
+        for (; at > 0 && distances[at - 1] > distance; at--) {
+            ids[at] = ids[at - 1];
+            distances[at] = distances[at - 1];
+        }
+        ids[at] = id;
+        distances[at] = distance;
+    }
+
+    // What is left of the segment, out of FRACTION_ONE
+    int32_t remaining = FRACTION_ONE;
+    bool found = false;
+    for (uint16_t i = 0; i < count && !m_exhausted; i++) {
+        GameObject *go = m_objects + ids[i];
+        uint16_t bvh = m_bvhOf[ids[i]];
+        if (bvh == NONE || m_meshes[bvh].nodes.empty()) continue;
+
+        // Into object space, the rotation being orthonormal
+        int32_t local[2][3];
+        int32_t ends[2][3];
+        for (unsigned axis = 0; axis < 3; axis++) {
+            int32_t length = int64_t(delta[axis]) * remaining / FRACTION_ONE;
+            ends[0][axis] = start[axis];
+            ends[1][axis] = start[axis] + length;
+        }
+        const psyqo::Vec3 &position = go->position;
+        const psyqo::Matrix33 &rotation = go->rotation;
+        for (unsigned end = 0; end < 2; end++) {
+            int64_t offset[3] = {ends[end][0] - position.x.raw(), ends[end][1] - position.y.raw(),
+                                 ends[end][2] - position.z.raw()};
+            local[end][0] = (rotation.vs[0].x.raw() * offset[0] + rotation.vs[1].x.raw() * offset[1] +
+                             rotation.vs[2].x.raw() * offset[2]) >> 12;
+            local[end][1] = (rotation.vs[0].y.raw() * offset[0] + rotation.vs[1].y.raw() * offset[1] +
+                             rotation.vs[2].y.raw() * offset[2]) >> 12;
+            local[end][2] = (rotation.vs[0].z.raw() * offset[0] + rotation.vs[1].z.raw() * offset[1] +
+                             rotation.vs[2].z.raw() * offset[2]) >> 12;
+        }
+
+        uint16_t triangle;
+        int32_t fraction = castMesh(m_meshes[bvh], local[0], local[1], any, triangle);
+        if (fraction < 0) continue;
+        remaining = int64_t(remaining) * fraction / FRACTION_ONE;
+        hit.object = go;
+        hit.triangle = triangle;
+        found = true;
+        if (any) break;
+    }
+    if (!found) return false;
+
+    // Along the segment asked for, not the part of it that was tested
+    int32_t fraction = longest > MAX_LENGTH ? int64_t(remaining) * MAX_LENGTH / longest : remaining;
+    hit.fraction = psyqo::FixedPoint<12>(fraction >> 4, psyqo::FixedPoint<12>::RAW);
+    hit.point.x = psyqo::FixedPoint<12>(start[0] + int32_t(int64_t(delta[0]) * remaining / FRACTION_ONE),
+                                        psyqo::FixedPoint<12>::RAW);
+    hit.point.y = psyqo::FixedPoint<12>(start[1] + int32_t(int64_t(delta[1]) * remaining / FRACTION_ONE),
+                                        psyqo::FixedPoint<12>::RAW);
+    hit.point.z = psyqo::FixedPoint<12>(start[2] + int32_t(int64_t(delta[2]) * remaining / FRACTION_ONE),
+                                        psyqo::FixedPoint<12>::RAW);
+    return true;
+}
+
+// Fraction of from..to at the closest hit, or -1. Shortens to as hits are found.
+int32_t RayCaster::castMesh(const MeshBvh &bvh, const int32_t from[3], int32_t to[3], bool any, uint16_t &triangle) {
+    int32_t remaining = FRACTION_ONE;
+    int32_t original[3] = {to[0] - from[0], to[1] - from[1], to[2] - from[2]};
+    bool found = false;
+
+    // Deep enough for the 32767 triangles a mesh can have
+    uint16_t stack[32];
+    uint8_t depth = 0;
+    stack[depth++] = 0;
+    unsigned axis = 0;
+    for (unsigned i = 1; i < 3; i++) {
+        if (__builtin_abs(original[i]) > __builtin_abs(original[axis])) axis = i;
+    }
+
+    while (depth > 0) {
+        if (m_nodesTested >= m_budget.nodes) {
+            m_exhausted = true;
+            break;
+        }
+        m_nodesTested++;
+        const BvhNode &node = bvh.nodes[stack[--depth]];
+        if (!segmentHitsBox(from, to, node)) continue;
+
+        if (node.count == 0) {
+            // The near child goes on top
+            const BvhNode &left = bvh.nodes[node.first];
+            const BvhNode &right = bvh.nodes[node.first + 1];
+            bool leftFirst = (left.min[axis] + left.max[axis] <= right.min[axis] + right.max[axis]) ==
+                             (original[axis] >= 0);
+            stack[depth++] = leftFirst ? node.first + 1 : node.first;
+            stack[depth++] = leftFirst ? node.first : node.first + 1;
+            continue;
+        }
+
+        for (uint16_t i = node.first; i < node.first + node.count; i++) {
+            if (m_trianglesTested >= m_budget.triangles) {
+                m_exhausted = true;
+                break;
+            }
+            m_trianglesTested++;
+            int32_t v[3][3];
+            vertices(bvh, bvh.triangles[i], v);
+            int32_t fraction = segmentHitsTriangle(from, to, v);
+            if (fraction < 0) continue;
+            remaining = int64_t(remaining) * fraction / FRACTION_ONE;
+            for (unsigned k = 0; k < 3; k++) {
+                to[k] = from[k] + int32_t(int64_t(original[k]) * remaining / FRACTION_ONE);
+            }
+            triangle = bvh.triangles[i];
+            found = true;
+            if (any) return remaining;
+        }
+        if (m_exhausted) break;
+    }
+    return found ? remaining : -1;
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <EASTL/vector.h>
+#include <psyqo/fixed-point.hh>
+#include <psyqo/vector.hh>
+
+#include "broadphase.hh"
+#include "gameobject.hh"
+
+namespace psxsplash {
+
+class SplashPackLoader;
+
+// Node of a mesh's bounding volume hierarchy, in object space. Inner nodes have their two children next
+// to each other.
+struct BvhNode {
+    int16_t min[3], max[3];
+    // Leaves: first triangle in the leaf order and their count. Inner nodes: first child, count is 0.
+    uint16_t first;
+    uint16_t count;
+};
+static_assert(sizeof(BvhNode) == 16, "BvhNode is not 16 bytes");
+
+struct RayHit {
+    GameObject *object;
+    // In the order of the object's Tri, or of the runs of its CompactMesh
+    uint16_t triangle;
+    // Along the segment, from 0 at its start to 1 at its end
+    psyqo::FixedPoint<12> fraction;
+    psyqo::Vec3 point;
+};
+
+// Segment queries against the triangles the renderer draws, for camera collision, line of sight and
+// picking. Every mesh gets a BVH over its triangles, shared by its instances, and segments are moved to
+// the object space of the objects the broadphase finds along them. The tests are exact integer ones.
+// Queries stop once they tested as many nodes or triangles as their budget allows, so several of them
+// fit in a frame whatever the scene.
+class RayCaster final {
+  public:
+    static constexpr uint8_t LEAF_SIZE = 4;
+    // Longer segments are cut to it, so that the object space tests stay within 64 bits. Hits past it are
+    // missed, but their fraction is still one of the whole segment.
+    static constexpr int32_t MAX_LENGTH = 1 << 19;
+    // Objects a query looks at, closest first
+    static constexpr uint16_t MAX_OBJECTS = 32;
+
+    struct Budget {
+        uint16_t nodes;
+        uint16_t triangles;
+    };
+    static constexpr Budget DEFAULT_BUDGET = {256, 64};
+
+    // Builds the BVHs of the objects resident so far, call after LoadSplashpack and WorldStreamer::Start
+    void Start(SplashPackLoader &loader);
+    // Builds the BVH of at most one more mesh among objects, usually the loader's gameObjects, so that
+    // the sectors streamed in don't stall a frame. Objects without one yet are left out of the queries.
+    void Update(const eastl::vector<GameObject *> &objects);
+
+    // Closest triangle the segment goes through, false for none
+    bool Cast(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase, RayHit &hit,
+              Budget budget = DEFAULT_BUDGET);
+    // Whether any triangle is in the way, stops at the first one found
+    bool Blocked(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase,
+                 Budget budget = DEFAULT_BUDGET);
+
+    // The last query ran out of budget before it was done, a miss may not be one
+    bool Exhausted() const { return m_exhausted; }
+    uint16_t NodesTested() const { return m_nodesTested; }
+    uint16_t TrianglesTested() const { return m_trianglesTested; }
+
+  private:
+    static constexpr uint16_t NONE = 0xffff;
+
+    struct MeshBvh {
+        // Tri array or CompactMesh
+        const void *mesh;
+        bool compact;
+        eastl::vector<BvhNode> nodes;
+        eastl::vector<uint16_t> triangles;
+        // Vertex indices of the triangles of a compact mesh
+        eastl::vector<const uint16_t *> compactTris;
+    };
+
+    eastl::vector<MeshBvh> m_meshes;
+    GameObject *m_objects = nullptr;
+    // BVH of every object of the pack's object table
+    eastl::vector<uint16_t> m_bvhOf;
+
+    Budget m_budget;
+    uint16_t m_nodesTested = 0;
+    uint16_t m_trianglesTested = 0;
+    bool m_exhausted = false;
+
+    bool prepare(GameObject *go);
+    void build(MeshBvh &bvh, uint16_t count);
+    void vertices(const MeshBvh &bvh, uint16_t triangle, int32_t out[3][3]) const;
+    bool cast(const psyqo::Vec3 &from, const psyqo::Vec3 &to, const Broadphase &broadphase, RayHit &hit,
+              Budget budget, bool any);
+    int32_t castMesh(const MeshBvh &bvh, const int32_t from[3], int32_t to[3], bool any, uint16_t &triangle);
+};
+
+}  // namespace psxsplash
@@ -1,5 +1,6 @@
 #include "renderer.hh"
 
+#include <EASTL/algorithm.h>
 #include <EASTL/array.h>
 #include <EASTL/vector.h>
 
@@ -9,6 +10,8 @@
 #include <psyqo/kernel.hh>
 #include <psyqo/matrix.hh>
 #include <psyqo/primitives/common.hh>
+#include <psyqo/primitives/quads.hh>
+#include <psyqo/primitives/rectangles.hh>
 #include <psyqo/primitives/triangles.hh>
 #include <psyqo/soft-math.hh>
 #include <psyqo/trigonometry.hh>
@@ -22,6 +25,24 @@ using namespace psyqo::GTE;
 
 psxsplash::Renderer *psxsplash::Renderer::instance = nullptr;
 
+namespace {
+
+// Integer square root, only used to set up the views
+int32_t squareRoot(uint32_t x) {
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+}  // namespace
+
 void psxsplash::Renderer::Init(psyqo::GPU &gpuInstance) {
     psyqo::Kernel::assert(instance == nullptr, "A second intialization of Renderer was tried");
 
@@ -32,110 +53,779 @@ void psxsplash::Renderer::Init(psyqo::GPU &gpuInstance) {
     write<Register::OFX, Safe>(psyqo::FixedPoint<16>(160.0).raw());
     write<Register::OFY, Safe>(psyqo::FixedPoint<16>(120.0).raw());
 
-    write<Register::H, Safe>(120);
+    write<Register::H, Safe>(PROJECTION_H);
 
-    write<Register::ZSF3, Safe>(ORDERING_TABLE_SIZE / 3);
-    write<Register::ZSF4, Safe>(ORDERING_TABLE_SIZE / 4);
+    // avsz3 and avsz4 return the plain average of the SZ values, DepthMapping does the rest
+    write<Register::ZSF3, Safe>(0x1000 / 3);
+    write<Register::ZSF4, Safe>(0x1000 / 4);
 
     if (!instance) {
         instance = new Renderer(gpuInstance);
+        instance->SetDepthMapping(DEFAULT_DEPTH_MAPPING);
+    }
+}
+
+void psxsplash::Renderer::SetCamera(psxsplash::Camera &camera) {
+    View view = {&camera, {.a = {.x = 0, .y = 0}, .b = {.x = SCREEN_WIDTH, .y = SCREEN_HEIGHT}}, PROJECTION_H};
+    SetViews(&view, 1);
+}
+
+void psxsplash::Renderer::SetViews(const View *views, uint8_t count) {
+    psyqo::Kernel::assert(count > 0 && count <= MAX_VIEWS, "PSXSPLASH: Unsupported number of views");
+    for (uint8_t i = 0; i < count; i++) {
+        ViewState &state = m_views[i];
+        state.view = views[i];
+        if (state.view.h == 0) state.view.h = PROJECTION_H;
+        state.halfWidth = state.view.area.b.x / 2;
+        state.halfHeight = state.view.area.b.y / 2;
+        int32_t h = state.view.h;
+        state.lengthX = squareRoot(h * h + state.halfWidth * state.halfWidth);
+        state.lengthY = squareRoot(h * h + state.halfHeight * state.halfHeight);
+    }
+    m_viewCount = count;
+    m_currentCamera = m_views[0].view.camera;
+    m_revision++;
+}
+
+void psxsplash::Renderer::SetFog(const SceneFog &fog) {
+    m_sceneFog = fog;
+    updateDrawDistance();
+}
+
+void psxsplash::Renderer::SetQuality(const QualitySettings &quality) {
+    m_quality = quality;
+    updateDrawDistance();
+    updateTextureLods();
+}
+
+void psxsplash::Renderer::updateDrawDistance() {
+    m_revision++;
+    m_fog = m_sceneFog;
+    if (m_fog.farZ <= m_fog.nearZ) m_fog.farZ = 0;
+
+    // A shortened draw distance scales the scene fog. Scenes without fog get one fading to the
+    // clear color over the last quarter, so the cut-off doesn't show.
+    if (m_quality.drawDistance < QualitySettings::FULL_DRAW_DISTANCE) {
+        if (m_fog.farZ) {
+            m_fog.nearZ = uint32_t(m_fog.nearZ) * m_quality.drawDistance >> 8;
+            m_fog.farZ = uint32_t(m_fog.farZ) * m_quality.drawDistance >> 8;
+        } else {
+            m_fog.color = m_clearcolor;
+            m_fog.farZ = uint32_t(m_depthMapping.range) * m_quality.drawDistance >> 8;
+            m_fog.nearZ = m_fog.farZ - m_fog.farZ / 4;
+        }
+        if (m_fog.farZ && m_fog.nearZ >= m_fog.farZ) m_fog.nearZ = m_fog.farZ - 1;
+    }
+
+    m_farZ = m_fog.farZ ? m_fog.farZ : 0xffff;
+    if (!m_fog.farZ) return;
+
+    // rtps sets IR0 = DQB + DQA * H / SZ for its vertex. Solve for 0 at nearZ and 1.0 at
+    // farZ, with DQA in 8.8 and DQB in 8.24. DQA saturates when the two are too far apart
+    // compared to H, which only makes the fog start a bit further away.
+    int64_t nearZ = eastl::max(m_fog.nearZ, uint16_t(1));
+    int64_t farZ = m_fog.farZ;
+    int64_t dqa = -(nearZ * farZ * 256) / (int64_t(PROJECTION_H) * (farZ - nearZ));
+    int64_t dqb = (farZ << 24) / (farZ - nearZ);
+    m_fogDQA = eastl::max(dqa, int64_t(-0x8000));
+    m_fogDQB = eastl::min(dqb, int64_t(0x7fffffff));
+}
+
+namespace {
+
+// log2 of x in 16.16, only used to build the depth lookup
+int32_t log2Fixed(uint32_t x) {
+    if (x == 0) return 0;
+    int32_t integer = 31;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        integer--;
+    }
+
+    // Square the 1.30 mantissa once per fractional bit, each time it reaches 2 the bit is set
+    uint32_t mantissa = x >> 1;
+    int32_t fraction = 0;
+    for (int32_t bit = 1 << 15; bit != 0; bit >>= 1) {
+        mantissa = (uint64_t(mantissa) * mantissa) >> 30;
+        if (mantissa >= 0x80000000u) {
+            mantissa >>= 1;
+            fraction |= bit;
+        }
+    }
+    return (integer << 16) | fraction;
+}
+
+// TPageAttr keeps its bits to itself, texture LODs work on the raw attribute
+uint16_t tpageBits(const psyqo::PrimPieces::TPageAttr &tpage) {
+    uint16_t bits;
+    __builtin_memcpy(&bits, &tpage, sizeof(bits));
+    return bits;
+}
+
+}  // namespace
+
+void psxsplash::Renderer::SetDepthMapping(const DepthMapping &mapping) {
+    m_depthMapping = mapping;
+    int32_t range = eastl::max(mapping.range, uint16_t(2));
+    int32_t knee = eastl::clamp(int32_t(mapping.knee), int32_t(1), range - 1);
+    m_depthMapping.range = range;
+
+    m_depthShift = 0;
+    while ((range >> m_depthShift) >= int32_t(DEPTH_LUT_SIZE)) m_depthShift++;
+
+    constexpr int32_t last = ORDERING_TABLE_SIZE - 1;
+    constexpr int32_t half = ORDERING_TABLE_SIZE / 2;
+    int32_t logKnee = log2Fixed(knee);
+    int32_t logRange = log2Fixed(range + knee) - logKnee;
+    for (int32_t i = 0; i <= ((range - 1) >> m_depthShift); i++) {
+        int32_t depth = i << m_depthShift;
+        int32_t bucket;
+        switch (mapping.curve) {
+            case DepthMapping::Curve::Log:
+                bucket = int64_t(last) * (log2Fixed(depth + knee) - logKnee) / logRange;
+                break;
+            case DepthMapping::Curve::Piecewise:
+                bucket = depth < knee ? depth * half / knee : half + (depth - knee) * (last - half) / (range - knee);
+                break;
+            default:
+                bucket = int64_t(depth) * last / range;
+                break;
+        }
+        m_depthLut[i] = eastl::clamp(bucket, int32_t(0), last);
     }
+
+    // Scenes without fog draw up to the depth range
+    updateDrawDistance();
 }
 
-void psxsplash::Renderer::SetCamera(psxsplash::Camera &camera) { m_currentCamera = &camera; }
+void psxsplash::Renderer::SetTextureLods(const TextureLod *lods, uint16_t count) {
+    for (auto &lod : m_sceneTextureLods) lod = {};
+    for (uint16_t i = 0; i < count; i++) {
+        TextureLod &lod = m_sceneTextureLods[lods[i].source & TPAGE_PAGE_MASK];
+        lod = lods[i];
+        lod.levelCount = eastl::min(lod.levelCount, TextureLod::MAX_LEVELS);
+    }
+    updateTextureLods();
+}
+
+void psxsplash::Renderer::updateTextureLods() {
+    m_revision++;
+    for (size_t i = 0; i <= TPAGE_PAGE_MASK; i++) {
+        TextureLod &lod = m_textureLods[i];
+        lod = m_sceneTextureLods[i];
+        for (uint16_t level = 0; level < lod.levelCount; level++) {
+            uint32_t distance = uint32_t(lod.levels[level].distance) * m_quality.textureLodDistance >> 8;
+            lod.levels[level].distance = eastl::min(distance, uint32_t(0xffff));
+        }
+    }
+}
+
+void psxsplash::Renderer::lowerTexture(Tri &tri, const TextureLod &lod, int32_t depth) {
+    int level = 0;
+    while (level + 1 < lod.levelCount && depth >= lod.levels[level + 1].distance) level++;
+    const TextureLodLevel &target = lod.levels[level];
+    int shift = level + 1;
+
+    tri.uvA = {uint8_t((tri.uvA.u >> shift) + target.u), uint8_t((tri.uvA.v >> shift) + target.v)};
+    tri.uvB = {uint8_t((tri.uvB.u >> shift) + target.u), uint8_t((tri.uvB.v >> shift) + target.v)};
+    tri.uvC.u = (tri.uvC.u >> shift) + target.u;
+    tri.uvC.v = (tri.uvC.v >> shift) + target.v;
+
+    uint16_t bits = (tpageBits(tri.tpage) & ~TPAGE_PAGE_MASK) | (target.page & TPAGE_PAGE_MASK);
+    __builtin_memcpy(static_cast<void *>(&tri.tpage), &bits, sizeof(bits));
+    m_stats.trianglesTextureLod++;
+}
 
 void psxsplash::Renderer::Render(eastl::vector<GameObject *> &objects) {
-    psyqo::Kernel::assert(m_currentCamera != nullptr, "PSXSPLASH: Tried to render without an active camera");
+    psyqo::Kernel::assert(m_viewCount > 0, "PSXSPLASH: Tried to render without an active camera");
 
     uint8_t parity = m_gpu.getParity();
 
-    auto &ot = m_ots[parity];
-    auto &clear = m_clear[parity];
     auto &balloc = m_ballocs[parity];
+    auto &frame = m_frames[parity];
+
+    m_stats = {};
+
+    // The buffers of this parity still hold the frame drawn two frames ago. If the view and the
+    // settings are the same, the primitives of the objects that didn't move go back in the ordering
+    // table as they are and only the others are drawn again, after them in the bump allocator.
+    m_recording = m_viewCount == 1;
+    psyqo::Vec3 &cameraPosition = m_views[0].view.camera->GetPosition();
+    psyqo::Matrix33 &cameraRotation = m_views[0].view.camera->GetRotation();
+    bool sameView = m_recording && frame.valid && frame.revision == m_revision &&
+                    frame.objects.size() == objects.size() &&
+                    __builtin_memcmp(&frame.cameraPosition, &cameraPosition, sizeof(psyqo::Vec3)) == 0 &&
+                    __builtin_memcmp(&frame.cameraRotation, &cameraRotation, sizeof(psyqo::Matrix33)) == 0;
+    if (!sameView || balloc.remaining() < BUMP_ALLOCATOR_SIZE / 4) {
+        balloc.reset();
+        frame.valid = m_recording;
+        frame.revision = m_revision;
+        frame.cameraPosition = cameraPosition;
+        frame.cameraRotation = cameraRotation;
+        frame.objects.clear();
+        if (m_recording) frame.objects.resize(objects.size(), ObjectRecord{.object = nullptr});
+        frame.base = nullptr;
+        frame.count = 0;
+    }
 
-    balloc.reset();
-    eastl::array<psyqo::Vertex, 3> projected;
-    for (auto &obj : objects) {
-        psyqo::Vec3 cameraPosition, objectPosition;
-        psyqo::Matrix33 finalMatrix;
+    // Lights and fog color are the same for every view
+    writeSafe<PseudoRegister::Color>(m_lighting.colors);
+    write<Register::RBK, Unsafe>(m_lighting.ambient.x.raw());
+    write<Register::GBK, Unsafe>(m_lighting.ambient.y.raw());
+    write<Register::BBK, Safe>(m_lighting.ambient.z.raw());
+
+    // dpct fades towards the far color, in 8.4 units
+    write<Register::RFC, Unsafe>(m_fog.color.r << 4);
+    write<Register::GFC, Unsafe>(m_fog.color.g << 4);
+    write<Register::BFC, Safe>(m_fog.color.b << 4);
+
+    for (uint8_t view = 0; view < m_viewCount; view++) {
+        beginView(view, m_viewCount - view);
+        for (size_t i = 0; i < objects.size(); i++) {
+            GameObject *obj = objects[i];
+            if (!m_recording) {
+                renderObject(obj);
+                continue;
+            }
+
+            // Animated objects change shape without moving. Records that would go past the primitive
+            // budget are drawn again instead, which keeps what fits of them.
+            ObjectRecord &record = frame.objects[i];
+            if (record.object == obj && !(m_animator && m_animator->Animated(obj)) &&
+                __builtin_memcmp(&record.position, &obj->position, sizeof(psyqo::Vec3)) == 0 &&
+                __builtin_memcmp(&record.rotation, &obj->rotation, sizeof(psyqo::Matrix33)) == 0 &&
+                m_stats.primitivesEmitted + record.count <= m_primitiveLimit) {
+                reinsertObject(frame, record);
+                continue;
+            }
+
+            record.object = obj;
+            record.position = obj->position;
+            record.rotation = obj->rotation;
+            record.first = frame.count;
+            uint32_t dropped = m_stats.primitivesDropped;
+            renderObject(obj);
+            record.count = frame.count - record.first;
+            // Cut short, it would be reinserted without the primitives dropped even once they fit
+            if (m_stats.primitivesDropped != dropped) record.object = nullptr;
+        }
+        if (m_particles) renderParticles();
+    }
+    m_stats.bytesAllocated = BUMP_ALLOCATOR_SIZE - balloc.remaining();
+    submit(m_viewCount);
+}
 
-        ::clear<Register::TRX, Safe>();
-        ::clear<Register::TRY, Safe>();
-        ::clear<Register::TRZ, Safe>();
+// Points the GTE and the ordering table at a view, the views left sharing what remains of the budgets
+void psxsplash::Renderer::beginView(uint8_t index, uint8_t viewsLeft) {
+    m_view = &m_views[index];
+    m_currentCamera = m_view->view.camera;
+    m_ot = &m_ots[m_gpu.getParity()][index];
+
+    uint32_t emitted = m_stats.primitivesEmitted;
+    m_primitiveLimit = emitted + (m_quality.primitiveBudget > emitted ? m_quality.primitiveBudget - emitted : 0) /
+                                     viewsLeft;
+    uint32_t particleBudget = m_particles ? m_particles->Budget() : 0;
+    uint32_t drawn = m_stats.particlesDrawn;
+    m_particleLimit = drawn + (particleBudget > drawn ? particleBudget - drawn : 0) / viewsLeft;
+
+    // The fog factor goes with 1 / H, DQA was solved for PROJECTION_H
+    const psyqo::Rect &area = m_view->view.area;
+    int32_t dqa = int32_t(m_fogDQA) * PROJECTION_H / m_view->view.h;
+    write<Register::OFX, Unsafe>(uint32_t(area.a.x + area.b.x / 2) << 16);
+    write<Register::OFY, Unsafe>(uint32_t(area.a.y + area.b.y / 2) << 16);
+    write<Register::H, Unsafe>(m_view->view.h);
+    write<Register::DQA, Unsafe>(eastl::max(dqa, int32_t(-0x8000)));
+    write<Register::DQB, Safe>(m_fogDQB);
 
-        // Rotate the camera Translation vector by the camera rotation
-        writeSafe<PseudoRegister::Rotation>(m_currentCamera->GetRotation());
-        writeSafe<PseudoRegister::V0>(-m_currentCamera->GetPosition());
+    // Rotate the camera Translation vector by the camera rotation
+    ::clear<Register::TRX, Safe>();
+    ::clear<Register::TRY, Safe>();
+    ::clear<Register::TRZ, Safe>();
+    writeSafe<PseudoRegister::Rotation>(m_currentCamera->GetRotation());
+    writeSafe<PseudoRegister::V0>(-m_currentCamera->GetPosition());
+    Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::TR>();
+    m_cameraTranslation = readSafe<PseudoRegister::SV>();
+    m_lastTransformValid = false;
+}
 
-        Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::TR>();
-        cameraPosition = readSafe<PseudoRegister::SV>();
+// Chains the clear and the ordering tables of the views. Views not covering the screen are clipped to
+// their area, which is given back to the whole screen after the last one.
+void psxsplash::Renderer::submit(uint8_t viewCount) {
+    uint8_t parity = m_gpu.getParity();
+    auto &clear = m_clear[parity];
+    m_gpu.getNextClear(clear.primitive, m_clearcolor);
+    m_gpu.chain(clear);
 
-        // Rotate the object Translation vector by the camera rotation
-        writeSafe<PseudoRegister::V0>(obj->position);
-        Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::TR>();
-        objectPosition = readSafe<PseudoRegister::SV>();
+    // Drawing areas are in VRAM, the buffer being drawn starts where the clear does. psyqo takes the
+    // bottom right corner past the area.
+    psyqo::Vertex origin = clear.primitive.rect.a;
+    auto setArea = [&origin](AreaFragment &fragment, int16_t x, int16_t y, int16_t width, int16_t height) {
+        fragment.start = psyqo::Prim::DrawingAreaStart(
+            psyqo::Vertex{{.x = int16_t(origin.x + x), .y = int16_t(origin.y + y)}});
+        fragment.end = psyqo::Prim::DrawingAreaEnd(
+            psyqo::Vertex{{.x = int16_t(origin.x + x + width), .y = int16_t(origin.y + y + height)}});
+    };
 
-        objectPosition.x += cameraPosition.x;
-        objectPosition.y += cameraPosition.y;
-        objectPosition.z += cameraPosition.z;
+    bool clipped = false;
+    for (uint8_t i = 0; i < viewCount; i++) {
+        const psyqo::Rect &area = m_views[i].view.area;
+        if (area.a.x != 0 || area.a.y != 0 || area.b.x != SCREEN_WIDTH || area.b.y != SCREEN_HEIGHT) {
+            AreaFragment &fragment = m_areas[parity][i];
+            setArea(fragment, area.a.x, area.a.y, area.b.x, area.b.y);
+            m_gpu.chain(fragment);
+            clipped = true;
+        }
+        m_gpu.chain(m_ots[parity][i]);
+    }
+    if (clipped) {
+        AreaFragment &fragment = m_areas[parity][MAX_VIEWS];
+        setArea(fragment, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        m_gpu.chain(fragment);
+    }
+}
 
+// Whether a sphere in view space is past one of the side planes of the view being drawn
+bool psxsplash::Renderer::outsideView(const psyqo::Vec3 &position, int32_t radius) const {
+    int64_t x = position.x.raw(), y = position.y.raw(), z = position.z.raw();
+    int64_t h = m_view->view.h;
+    int64_t acrossX = z * m_view->halfWidth, acrossY = z * m_view->halfHeight;
+    int64_t reachX = int64_t(radius) * m_view->lengthX, reachY = int64_t(radius) * m_view->lengthY;
+    return x * h - acrossX > reachX || -x * h - acrossX > reachX || y * h - acrossY > reachY ||
+           -y * h - acrossY > reachY;
+}
+
+void psxsplash::Renderer::renderObject(GameObject *obj) {
+    psyqo::Vec3 objectPosition;
+
+    ::clear<Register::TRX, Safe>();
+    ::clear<Register::TRY, Safe>();
+    ::clear<Register::TRZ, Safe>();
+
+    // Rotate the object Translation vector by the camera rotation
+    writeSafe<PseudoRegister::Rotation>(m_currentCamera->GetRotation());
+    writeSafe<PseudoRegister::V0>(obj->position);
+    Kernels::mvmva<Kernels::MX::RT, Kernels::MV::V0, Kernels::TV::TR>();
+    objectPosition = readSafe<PseudoRegister::SV>();
+
+    objectPosition.x += m_cameraTranslation.x;
+    objectPosition.y += m_cameraTranslation.y;
+    objectPosition.z += m_cameraTranslation.z;
+
+    // Skip objects entirely behind the camera, past the far plane or beside the view
+    int32_t radius = obj->boundingRadius;
+    if (objectPosition.z.raw() + radius <= 0 || objectPosition.z.raw() - radius >= m_farZ ||
+        outsideView(objectPosition, radius)) {
+        m_stats.objectsCulled++;
+        return;
+    }
+
+    if (m_lastTransformValid && __builtin_memcmp(&m_lastRotation, &obj->rotation, sizeof(psyqo::Matrix33)) == 0) {
+        m_stats.transformsReused++;
+    } else {
         // Combine object and camera rotations
-        MatrixMultiplyGTE(m_currentCamera->GetRotation(), obj->rotation, &finalMatrix);
+        MatrixMultiplyGTE(m_currentCamera->GetRotation(), obj->rotation, &m_lastMatrix);
+
+        // Normals are in object space, bring the lights there instead of rotating every normal
+        MatrixMultiplyGTE(m_lighting.directions, obj->rotation, &m_lastLightMatrix);
+
+        m_lastRotation = obj->rotation;
+        m_lastTransformValid = true;
+    }
+    psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Light>(m_lastLightMatrix);
+
+    const void *pose = m_animator ? m_animator->Pose(obj) : nullptr;
+    if (obj->IsCompact()) {
+        // Quantized vertices go to the GTE as they are, the step is folded in the rotation and the
+        // origin in the translation
+        const CompactMesh &mesh = *obj->compact;
+        psyqo::Matrix33 scaled;
+        int32_t origin[3];
+        for (int row = 0; row < 3; row++) {
+            const psyqo::Vec3 &m = m_lastMatrix.vs[row];
+            scaled.vs[row].x = psyqo::FixedPoint<12>(m.x.raw() << mesh.shift, psyqo::FixedPoint<12>::RAW);
+            scaled.vs[row].y = psyqo::FixedPoint<12>(m.y.raw() << mesh.shift, psyqo::FixedPoint<12>::RAW);
+            scaled.vs[row].z = psyqo::FixedPoint<12>(m.z.raw() << mesh.shift, psyqo::FixedPoint<12>::RAW);
+            origin[row] = (m.x.raw() * mesh.origin.x.raw() + m.y.raw() * mesh.origin.y.raw() +
+                           m.z.raw() * mesh.origin.z.raw()) >> 12;
+        }
+        objectPosition.x += psyqo::FixedPoint<12>(origin[0], psyqo::FixedPoint<12>::RAW);
+        objectPosition.y += psyqo::FixedPoint<12>(origin[1], psyqo::FixedPoint<12>::RAW);
+        objectPosition.z += psyqo::FixedPoint<12>(origin[2], psyqo::FixedPoint<12>::RAW);
 
         psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Translation>(objectPosition);
-        psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Rotation>(finalMatrix);
+        psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Rotation>(scaled);
+        renderCompactMesh(mesh, pose ? static_cast<const uint32_t *>(pose) : mesh.Vertices());
+        return;
+    }
 
-        for (int i = 0; i < obj->polyCount; i++) {
-            Tri &tri = obj->polygons[i];
-            psyqo::Vec3 result;
+    psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Translation>(objectPosition);
+    psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Rotation>(m_lastMatrix);
+
+    // Split the object into runs of equal material, cooked packs have them sorted
+    Tri *tris = obj->polygons;
+    const PackedVec3 *corners = static_cast<const PackedVec3 *>(pose);
+    int first = 0;
+    while (first < obj->polyCount) {
+        uint16_t material = tris[first].flags & TriFlags::MATERIAL_MASK;
+        int last = first + 1;
+        while (last < obj->polyCount && (tris[last].flags & TriFlags::MATERIAL_MASK) == material) last++;
+        m_stats.materialRuns++;
+        m_runPose = corners ? corners + first * 3 : nullptr;
+        (this->*s_runRenderers[material])(tris + first, last - first);
+        first = last;
+    }
+}
 
-            writeSafe<PseudoRegister::V0>(tri.v0);
-            writeSafe<PseudoRegister::V1>(tri.v1);
-            writeSafe<PseudoRegister::V2>(tri.v2);
+void psxsplash::Renderer::reinsertObject(const FrameRecord &frame, const ObjectRecord &record) {
+    using namespace psyqo::Fragments;
+    auto &ot = *m_ot;
+    for (uint16_t i = 0; i < record.count; i++) {
+        uint32_t entry = frame.primitives[record.first + i];
+        uint8_t *fragment = frame.base + (entry >> 12) * 4;
+        int32_t zIndex = (entry >> 2) & 0x3ff;
+        switch (entry & 3) {
+            case 0:
+                ot.insert(*reinterpret_cast<SimpleFragment<psyqo::Prim::Triangle> *>(fragment), zIndex);
+                break;
+            case 1:
+                ot.insert(*reinterpret_cast<SimpleFragment<psyqo::Prim::GouraudTriangle> *>(fragment), zIndex);
+                break;
+            case 2:
+                ot.insert(*reinterpret_cast<SimpleFragment<psyqo::Prim::TexturedTriangle> *>(fragment), zIndex);
+                break;
+            default:
+                ot.insert(*reinterpret_cast<SimpleFragment<psyqo::Prim::GouraudTexturedTriangle> *>(fragment),
+                          zIndex);
+                break;
+        }
+    }
+    m_stats.primitivesEmitted += record.count;
+    m_stats.primitivesReused += record.count;
+}
 
-            Kernels::rtpt();
-            Kernels::nclip();
+// Only the particle centers go through the GTE, three at a time, and the sprites are sized by their
+// depth. Particles aren't recorded, they are expected to move every frame.
+void psxsplash::Renderer::renderParticles() {
+    const ParticlePool &pool = *m_particles;
+    const int16_t *x = pool.X();
+    const int16_t *y = pool.Y();
+    const int16_t *z = pool.Z();
 
-            int32_t mac0 = 0;
-            read<Register::MAC0>(reinterpret_cast<uint32_t *>(&mac0));
-            if (mac0 <= 0) continue;
+    writeSafe<PseudoRegister::Rotation>(m_currentCamera->GetRotation());
+    writeSafe<PseudoRegister::Translation>(m_cameraTranslation);
+
+    uint16_t count = pool.Count();
+    for (uint16_t first = 0; first < count && m_stats.particlesDrawn < m_particleLimit; first += 3) {
+        // A short last batch repeats its last particle
+        uint16_t batch = eastl::min<uint16_t>(3, count - first);
+        uint16_t second = first + (batch > 1 ? 1 : 0);
+        uint16_t third = first + batch - 1;
+        write<Register::VXY0, Unsafe>(uint16_t(x[first]) | uint32_t(y[first]) << 16);
+        write<Register::VZ0, Unsafe>(z[first]);
+        write<Register::VXY1, Unsafe>(uint16_t(x[second]) | uint32_t(y[second]) << 16);
+        write<Register::VZ1, Unsafe>(z[second]);
+        write<Register::VXY2, Unsafe>(uint16_t(x[third]) | uint32_t(y[third]) << 16);
+        write<Register::VZ2, Safe>(z[third]);
+        Kernels::rtpt();
 
-            int32_t zIndex = 0;
-            uint32_t u0, u1, u2;
+        uint32_t screen[3], depth[3];
+        read<Register::SXY0>(&screen[0]);
+        read<Register::SXY1>(&screen[1]);
+        read<Register::SXY2>(&screen[2]);
+        read<Register::SZ1>(&depth[0]);
+        read<Register::SZ2>(&depth[1]);
+        read<Register::SZ3>(&depth[2]);
+        for (uint16_t i = 0; i < batch; i++) {
+            if (!drawParticle(first + i, screen[i], int32_t(depth[i]))) return;
+        }
+    }
+}
 
-            read<Register::SZ1>(&u0);
-            read<Register::SZ2>(&u1);
-            read<Register::SZ3>(&u2);
+// Returns false once nothing more can be drawn this frame
+bool psxsplash::Renderer::drawParticle(uint16_t index, uint32_t screen, int32_t depth) {
+    const ParticlePool &pool = *m_particles;
+    if (depth < PARTICLE_NEAR_Z || depth >= m_farZ) return true;
+    int32_t zIndex = depthBucket(depth);
+    if (zIndex < 0) return true;
+    int32_t size = eastl::min(int32_t(pool.Sizes()[index]) * m_view->view.h / depth, MAX_PARTICLE_SIZE);
+    if (size == 0) return true;
+
+    auto &balloc = m_ballocs[m_gpu.getParity()];
+    if (balloc.remaining() < sizeof(psyqo::Prim::TexturedQuad) + 20 ||
+        m_stats.primitivesEmitted >= m_primitiveLimit || m_stats.particlesDrawn >= m_particleLimit) {
+        m_stats.primitivesDropped++;
+        return false;
+    }
 
-            int32_t sz0 = (int32_t)u0;
-            int32_t sz1 = (int32_t)u1;
-            int32_t sz2 = (int32_t)u2;
+    psyqo::Vertex center;
+    center.packed = screen;
+    int16_t left = center.x - size / 2;
+    int16_t top = center.y - size / 2;
+    const ParticleLook &look = pool.Look(pool.Looks()[index]);
+    auto &ot = *m_ot;
+    if (look.textured) {
+        auto &prim = balloc.allocateFragment<psyqo::Prim::TexturedQuad>();
+        prim.primitive.pointA = {{.x = left, .y = top}};
+        prim.primitive.pointB = {{.x = int16_t(left + size), .y = top}};
+        prim.primitive.pointC = {{.x = left, .y = int16_t(top + size)}};
+        prim.primitive.pointD = {{.x = int16_t(left + size), .y = int16_t(top + size)}};
+        prim.primitive.uvA.u = look.u0;
+        prim.primitive.uvA.v = look.v0;
+        prim.primitive.uvB.u = look.u1;
+        prim.primitive.uvB.v = look.v0;
+        prim.primitive.uvC.u = look.u0;
+        prim.primitive.uvC.v = look.v1;
+        prim.primitive.uvD.u = look.u1;
+        prim.primitive.uvD.v = look.v1;
+        prim.primitive.tpage = look.tpage;
+        prim.primitive.clutIndex = psyqo::PrimPieces::ClutIndex(look.clutX, look.clutY);
+        prim.primitive.setColor(pool.Colors()[index]);
+        if (look.semiTrans) {
+            prim.primitive.setSemiTrans();
+        } else {
+            prim.primitive.setOpaque();
+        }
+        ot.insert(prim, zIndex);
+    } else {
+        auto &prim = balloc.allocateFragment<psyqo::Prim::Rectangle>();
+        prim.primitive.position = {{.x = left, .y = top}};
+        prim.primitive.size = {{.w = int16_t(size), .h = int16_t(size)}};
+        prim.primitive.setColor(pool.Colors()[index]);
+        if (look.semiTrans) {
+            prim.primitive.setSemiTrans();
+        } else {
+            prim.primitive.setOpaque();
+        }
+        ot.insert(prim, zIndex);
+    }
+    m_stats.primitivesEmitted++;
+    m_stats.particlesDrawn++;
+    return true;
+}
 
-            if ((sz0 < 1 && sz1 < 1 && sz2 < 1)) {
-                continue;
-            };
+void psxsplash::Renderer::recordPrimitive(const void *fragment, int32_t zIndex, uint32_t kind) {
+    if (!m_recording) return;
+    auto &frame = m_frames[m_gpu.getParity()];
+    if (frame.count == MAX_RECORDED_PRIMITIVES) {
+        // Too much to remember, the next frame of this parity starts over
+        frame.valid = false;
+        return;
+    }
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(fragment);
+    if (!frame.base) frame.base = const_cast<uint8_t *>(bytes);
+    frame.primitives[frame.count++] = uint32_t(bytes - frame.base) / 4 << 12 | zIndex << 2 | kind;
+}
 
-            zIndex = eastl::max(eastl::max(sz0, sz1), sz2);
-            if (zIndex < 0 || zIndex >= ORDERING_TABLE_SIZE) continue;
+inline bool psxsplash::Renderer::projectTriangle(eastl::array<psyqo::Vertex, 3> &projected, int32_t &zIndex,
+                                                 int32_t &nearest, uint32_t &fog) {
+    Kernels::rtpt();
+    Kernels::nclip();
+    m_stats.trianglesTested++;
+
+    int32_t mac0 = 0;
+    read<Register::MAC0>(reinterpret_cast<uint32_t *>(&mac0));
+    if (mac0 <= 0) {
+        m_stats.trianglesBackfaceCulled++;
+        return false;
+    }
 
-            read<Register::SXY0>(&projected[0].packed);
-            read<Register::SXY1>(&projected[1].packed);
-            read<Register::SXY2>(&projected[2].packed);
+    uint32_t u0, u1, u2;
 
-            recursiveSubdivideAndRender(tri, projected, zIndex, 1);
+    read<Register::SZ1>(&u0);
+    read<Register::SZ2>(&u1);
+    read<Register::SZ3>(&u2);
+
+    int32_t sz0 = (int32_t)u0;
+    int32_t sz1 = (int32_t)u1;
+    int32_t sz2 = (int32_t)u2;
+
+    if ((sz0 < 1 && sz1 < 1 && sz2 < 1)) {
+        m_stats.trianglesDepthCulled++;
+        return false;
+    };
+
+    nearest = eastl::min(eastl::min(sz0, sz1), sz2);
+    if (nearest >= m_farZ) {
+        m_stats.trianglesDepthCulled++;
+        return false;
+    }
+
+    int32_t depth;
+    if (m_depthMapping.average) {
+        uint32_t otz;
+        Kernels::avsz3();
+        read<Register::OTZ>(&otz);
+        depth = otz;
+    } else {
+        depth = eastl::max(eastl::max(sz0, sz1), sz2);
+    }
+    zIndex = depthBucket(depth);
+    if (zIndex < 0) {
+        m_stats.trianglesDepthCulled++;
+        return false;
+    }
+
+    read<Register::SXY0>(&projected[0].packed);
+    read<Register::SXY1>(&projected[1].packed);
+    read<Register::SXY2>(&projected[2].packed);
+
+    // Fog factor of the farthest vertex, zero before nearZ. rtpt leaves the one of V2 in IR0, and
+    // dpct/ncdt fog the whole triangle with it, so project the farthest vertex last when it isn't V2.
+    fog = 0;
+    if (m_fog.farZ) {
+        if (sz1 > sz2 && sz1 > sz0) {
+            uint32_t xy, z;
+            read<Register::VXY1>(&xy);
+            read<Register::VZ1>(&z);
+            write<Register::VXY0, Unsafe>(xy);
+            write<Register::VZ0, Safe>(z);
+            Kernels::rtps();
+        } else if (sz0 > sz2) {
+            Kernels::rtps();
         }
+        read<Register::IR0>(&fog);
+    }
+
+    m_stats.trianglesDrawn++;
+    return true;
+}
+
+template <uint16_t material>
+void psxsplash::Renderer::drawProjected(const Tri &tri, const eastl::array<psyqo::Vertex, 3> &projected,
+                                        int32_t zIndex, int32_t nearest, uint32_t fog) {
+    // Once shaded, a triangle draws exactly like its unlit counterpart
+    const Tri *drawn = &tri;
+    Tri local;
+    if ((material & TriFlags::LIT) || fog != 0) {
+        shadeTriangle<material>(tri, local, fog != 0);
+        drawn = &local;
+    }
+
+    // Distant triangles sample a smaller copy of their texture page, if the pack has one. The
+    // nearest vertex decides, so long triangles don't get blurry up close.
+    if constexpr (!(material & TriFlags::UNTEXTURED)) {
+        uint16_t tpage = tpageBits(tri.tpage);
+        const TextureLod &lod = m_textureLods[tpage & TPAGE_PAGE_MASK];
+        if (lod.levelCount && nearest >= lod.levels[0].distance && (tpage & TPAGE_SOURCE_MASK) == lod.source) {
+            if (drawn != &local) local = tri;
+            lowerTexture(local, lod, nearest);
+            drawn = &local;
+        }
+    }
+
+    drawTriangle<material & ~TriFlags::LIT>(*drawn, projected, zIndex);
+}
+
+template <uint16_t material>
+void psxsplash::Renderer::renderRun(Tri *tris, int count) {
+    eastl::array<psyqo::Vertex, 3> projected;
+    const PackedVec3 *pose = m_runPose;
+    for (int i = 0; i < count; i++) {
+        Tri &tri = tris[i];
+
+        if (pose) {
+            writeSafe<PseudoRegister::V0>(pose[0]);
+            writeSafe<PseudoRegister::V1>(pose[1]);
+            writeSafe<PseudoRegister::V2>(pose[2]);
+            pose += 3;
+        } else {
+            writeSafe<PseudoRegister::V0>(tri.v0);
+            writeSafe<PseudoRegister::V1>(tri.v1);
+            writeSafe<PseudoRegister::V2>(tri.v2);
+        }
+
+        int32_t zIndex, nearest;
+        uint32_t fog;
+        if (!projectTriangle(projected, zIndex, nearest, fog)) continue;
+        drawProjected<material>(tri, projected, zIndex, nearest, fog);
+    }
+}
+
+template <uint16_t material>
+const psxsplash::CompactRun *psxsplash::Renderer::renderCompactRun(const uint32_t *vertices, const CompactRun &run) {
+    constexpr bool textured = !(material & TriFlags::UNTEXTURED);
+    constexpr bool gouraud = !(material & TriFlags::FLAT);
+    const CompactTri<material> *records = reinterpret_cast<const CompactTri<material> *>(&run + 1);
+    eastl::array<psyqo::Vertex, 3> projected;
+
+    // The parts of a Tri the run shares, the rest is filled in for the triangles that get drawn
+    Tri tri;
+    if constexpr (textured) {
+        tri.tpage = run.tpage;
+        tri.clutX = run.clutX;
+        tri.clutY = run.clutY;
+    }
+
+    for (int i = 0; i < run.count; i++) {
+        const CompactTri<material> &record = records[i];
+        uint32_t v0 = vertices[record.vertices[0]];
+        uint32_t v1 = vertices[record.vertices[1]];
+        uint32_t v2 = vertices[record.vertices[2]];
+
+        write<Register::VXY0, Unsafe>(CompactMesh::VertexXY(v0));
+        write<Register::VZ0, Unsafe>(CompactMesh::VertexZ(v0));
+        write<Register::VXY1, Unsafe>(CompactMesh::VertexXY(v1));
+        write<Register::VZ1, Unsafe>(CompactMesh::VertexZ(v1));
+        write<Register::VXY2, Unsafe>(CompactMesh::VertexXY(v2));
+        write<Register::VZ2, Safe>(CompactMesh::VertexZ(v2));
+
+        int32_t zIndex, nearest;
+        uint32_t fog;
+        if (!projectTriangle(projected, zIndex, nearest, fog)) continue;
+
+        tri.colorA = record.colors[0];
+        if constexpr (gouraud) {
+            tri.colorB = record.colors[1];
+            tri.colorC = record.colors[2];
+        }
+        if constexpr (textured) {
+            tri.uvA = record.uvs[0];
+            tri.uvB = record.uvs[1];
+            tri.uvC.u = record.uvs[2].u;
+            tri.uvC.v = record.uvs[2].v;
+        }
+        drawProjected<material>(tri, projected, zIndex, nearest, fog);
+    }
+    return reinterpret_cast<const CompactRun *>(records + run.count);
+}
+
+void psxsplash::Renderer::renderCompactMesh(const CompactMesh &mesh, const uint32_t *vertices) {
+    const CompactRun *run = reinterpret_cast<const CompactRun *>(mesh.Vertices() + mesh.vertexCount);
+    for (uint16_t i = 0; i < mesh.runCount; i++) {
+        psyqo::Kernel::assert(run->flags < TriFlags::LIT, "PSXSPLASH: Compact mesh with an unsupported material");
+        m_stats.materialRuns++;
+        run = (this->*s_compactRunRenderers[run->flags])(vertices, *run);
     }
-    m_gpu.getNextClear(clear.primitive, m_clearcolor);
-    m_gpu.chain(clear);
-    m_gpu.chain(ot);
 }
 
-void psxsplash::Renderer::RenderNavmeshPreview(psxsplash::Navmesh navmesh, bool isOnMesh) {
+const psxsplash::Renderer::RunRenderer psxsplash::Renderer::s_runRenderers[TriFlags::MATERIAL_MASK + 1] = {
+    &Renderer::renderRun<0>,  &Renderer::renderRun<1>,  &Renderer::renderRun<2>,  &Renderer::renderRun<3>,
+    &Renderer::renderRun<4>,  &Renderer::renderRun<5>,  &Renderer::renderRun<6>,  &Renderer::renderRun<7>,
+    &Renderer::renderRun<8>,  &Renderer::renderRun<9>,  &Renderer::renderRun<10>, &Renderer::renderRun<11>,
+    &Renderer::renderRun<12>, &Renderer::renderRun<13>, &Renderer::renderRun<14>, &Renderer::renderRun<15>,
+    &Renderer::renderRun<16>, &Renderer::renderRun<17>, &Renderer::renderRun<18>, &Renderer::renderRun<19>,
+    &Renderer::renderRun<20>, &Renderer::renderRun<21>, &Renderer::renderRun<22>, &Renderer::renderRun<23>,
+    &Renderer::renderRun<24>, &Renderer::renderRun<25>, &Renderer::renderRun<26>, &Renderer::renderRun<27>,
+    &Renderer::renderRun<28>, &Renderer::renderRun<29>, &Renderer::renderRun<30>, &Renderer::renderRun<31>,
+};
+
+const psxsplash::Renderer::CompactRunRenderer psxsplash::Renderer::s_compactRunRenderers[TriFlags::LIT] = {
+    &Renderer::renderCompactRun<0>,  &Renderer::renderCompactRun<1>,  &Renderer::renderCompactRun<2>,
+    &Renderer::renderCompactRun<3>,  &Renderer::renderCompactRun<4>,  &Renderer::renderCompactRun<5>,
+    &Renderer::renderCompactRun<6>,  &Renderer::renderCompactRun<7>,  &Renderer::renderCompactRun<8>,
+    &Renderer::renderCompactRun<9>,  &Renderer::renderCompactRun<10>, &Renderer::renderCompactRun<11>,
+    &Renderer::renderCompactRun<12>, &Renderer::renderCompactRun<13>, &Renderer::renderCompactRun<14>,
+    &Renderer::renderCompactRun<15>,
+};
+
+void psxsplash::Renderer::RenderNavmeshPreview(psxsplash::Navmesh *const *navmeshes, uint16_t count, uint16_t current) {
     uint8_t parity = m_gpu.getParity();
+    m_frames[parity].valid = false;
     eastl::array<psyqo::Vertex, 3> projected;
 
-    auto &ot = m_ots[parity];
-    auto &clear = m_clear[parity];
+    m_stats = {};
+    beginView(0, 1);
+    auto &ot = *m_ot;
     auto &balloc = m_ballocs[parity];
     balloc.reset();
 
@@ -158,63 +848,65 @@ void psxsplash::Renderer::RenderNavmeshPreview(psxsplash::Navmesh navmesh, bool
 
     psyqo::GTE::writeSafe<psyqo::GTE::PseudoRegister::Rotation>(m_currentCamera->GetRotation());
 
-    for (int i = 0; i < navmesh.triangleCount; i++) {
-        NavMeshTri &tri = navmesh.polygons[i];
-        psyqo::Vec3 result;
+    for (uint16_t n = 0; n < count; n++) {
+        const Navmesh &navmesh = *navmeshes[n];
+        bool isOnMesh = n == current;
+        for (int i = 0; i < navmesh.triangleCount; i++) {
+            NavMeshTri &tri = navmesh.polygons[i];
+            psyqo::Vec3 result;
 
-        writeSafe<PseudoRegister::V0>(tri.v0);
-        writeSafe<PseudoRegister::V1>(tri.v1);
-        writeSafe<PseudoRegister::V2>(tri.v2);
+            writeSafe<PseudoRegister::V0>(tri.v0);
+            writeSafe<PseudoRegister::V1>(tri.v1);
+            writeSafe<PseudoRegister::V2>(tri.v2);
 
-        Kernels::rtpt();
-        Kernels::nclip();
+            Kernels::rtpt();
+            Kernels::nclip();
 
-        int32_t mac0 = 0;
-        read<Register::MAC0>(reinterpret_cast<uint32_t *>(&mac0));
-        if (mac0 <= 0) continue;
+            int32_t mac0 = 0;
+            read<Register::MAC0>(reinterpret_cast<uint32_t *>(&mac0));
+            if (mac0 <= 0) continue;
+
+            int32_t zIndex = 0;
+            uint32_t u0, u1, u2;
+            read<Register::SZ0>(&u0);
+            read<Register::SZ1>(&u1);
+            read<Register::SZ2>(&u2);
 
-        int32_t zIndex = 0;
-        uint32_t u0, u1, u2;
-        read<Register::SZ0>(&u0);
-        read<Register::SZ1>(&u1);
-        read<Register::SZ2>(&u2);
+            int32_t sz0 = *reinterpret_cast<int32_t *>(&u0);
+            int32_t sz1 = *reinterpret_cast<int32_t *>(&u1);
+            int32_t sz2 = *reinterpret_cast<int32_t *>(&u2);
 
-        int32_t sz0 = *reinterpret_cast<int32_t *>(&u0);
-        int32_t sz1 = *reinterpret_cast<int32_t *>(&u1);
-        int32_t sz2 = *reinterpret_cast<int32_t *>(&u2);
+            zIndex = depthBucket(eastl::max(eastl::max(sz0, sz1), sz2));
+            if (zIndex < 0) continue;
 
-        zIndex = eastl::max(eastl::max(sz0, sz1), sz2);
-        if (zIndex < 0 || zIndex >= ORDERING_TABLE_SIZE) continue;
+            read<Register::SXY0>(&projected[0].packed);
+            read<Register::SXY1>(&projected[1].packed);
+            read<Register::SXY2>(&projected[2].packed);
 
-        read<Register::SXY0>(&projected[0].packed);
-        read<Register::SXY1>(&projected[1].packed);
-        read<Register::SXY2>(&projected[2].packed);
+            auto &prim = balloc.allocateFragment<psyqo::Prim::Triangle>();
 
-        auto &prim = balloc.allocateFragment<psyqo::Prim::Triangle>();
+            prim.primitive.pointA = projected[0];
+            prim.primitive.pointB = projected[1];
+            prim.primitive.pointC = projected[2];
 
-        prim.primitive.pointA = projected[0];
-        prim.primitive.pointB = projected[1];
-        prim.primitive.pointC = projected[2];
+            psyqo::Color heightColor;
 
-        psyqo::Color heightColor;
+            if (isOnMesh) {
+                heightColor.r = 0;
+                heightColor.g = ((tri.v0.y.raw() + tri.v1.y.raw() + tri.v2.y.raw()) / 3) * 100 % 256;
+                heightColor.b = 0;
+            } else {
+                heightColor.r = ((tri.v0.y.raw() + tri.v1.y.raw() + tri.v2.y.raw()) / 3) * 100 % 256;
+                heightColor.g = 0;
+                heightColor.b = 0;
+            }
 
-        if (isOnMesh) {
-            heightColor.r = 0;
-            heightColor.g = ((tri.v0.y.raw() + tri.v1.y.raw() + tri.v2.y.raw()) / 3) * 100 % 256;
-            heightColor.b = 0;
-        } else {
-            heightColor.r = ((tri.v0.y.raw() + tri.v1.y.raw() + tri.v2.y.raw()) / 3) * 100 % 256;
-            heightColor.g = 0;
-            heightColor.b = 0;
+            prim.primitive.setColor(heightColor);
+            prim.primitive.setOpaque();
+            ot.insert(prim, zIndex);
         }
-
-        prim.primitive.setColor(heightColor);
-        prim.primitive.setOpaque();
-        ot.insert(prim, zIndex);
     }
-    m_gpu.getNextClear(clear.primitive, m_clearcolor);
-    m_gpu.chain(clear);
-    m_gpu.chain(ot);
+    submit(1);
 }
 
 void psxsplash::Renderer::VramUpload(const uint16_t *imageData, int16_t posX, int16_t posY, int16_t width,
@@ -228,63 +920,186 @@ psyqo::Color averageColor(const psyqo::Color &a, const psyqo::Color &b) {
                         static_cast<uint8_t>((a.b + b.b) >> 1)};
 }
 
-void psxsplash::Renderer::recursiveSubdivideAndRender(Tri &tri, eastl::array<psyqo::Vertex, 3> &projected, int zIndex,
-                                                      int maxIterations) {
-    uint16_t minX = eastl::min({projected[0].x, projected[1].x, projected[2].x});
-    uint16_t maxX = eastl::max({projected[0].x, projected[1].x, projected[2].x});
-    uint16_t minY = eastl::min({projected[0].y, projected[1].y, projected[2].y});
-    uint16_t maxY = eastl::max({projected[0].y, projected[1].y, projected[2].y});
-    uint16_t width = maxX - minX;
-    uint16_t height = maxY - minY;
+namespace {
+
+// Smallest primitive able to draw a material
+template <bool textured, bool gouraud>
+struct TrianglePrim;
+template <>
+struct TrianglePrim<true, true> {
+    using Type = psyqo::Prim::GouraudTexturedTriangle;
+};
+template <>
+struct TrianglePrim<true, false> {
+    using Type = psyqo::Prim::TexturedTriangle;
+};
+template <>
+struct TrianglePrim<false, true> {
+    using Type = psyqo::Prim::GouraudTriangle;
+};
+template <>
+struct TrianglePrim<false, false> {
+    using Type = psyqo::Prim::Triangle;
+};
+
+}  // namespace
+
+template <uint16_t material>
+void psxsplash::Renderer::shadeTriangle(const Tri &tri, Tri &shaded, bool fogged) {
+    constexpr bool textured = !(material & TriFlags::UNTEXTURED);
+    constexpr bool gouraud = !(material & TriFlags::FLAT);
+
+    if constexpr (textured) {
+        shaded.uvA = tri.uvA;
+        shaded.uvB = tri.uvB;
+        shaded.uvC = tri.uvC;
+        shaded.tpage = tri.tpage;
+        shaded.clutX = tri.clutX;
+        shaded.clutY = tri.clutY;
+    }
 
-    bool leavingScreenSpace = false;
-    if (projected[0].x < -100 || projected[0].y < -100 || projected[1].x < -100 || projected[1].y < -100 ||
-        projected[2].x < -100 || projected[2].y < -100 || width > 420 || height > 356) {
-        leavingScreenSpace = true;
+    if constexpr (material & TriFlags::LIT) {
+        // Neutral gray leaves the texture as is, 0x80 being 1.0 in the texture blending
+        psyqo::Color base = {.r = 0x80, .g = 0x80, .b = 0x80};
+        if constexpr (!textured) base = {.r = tri.uvA.u, .g = tri.uvA.v, .b = tri.uvB.u};
+        write<Register::RGB, Unsafe>(base.packed);
+
+        writeSafe<PseudoRegister::V0>(tri.normal);
+        if constexpr (gouraud) {
+            // The normals of v1 and v2 are packed over the color words, see Tri
+            write<Register::VXY1, Unsafe>(tri.colorA.packed);
+            write<Register::VZ1, Unsafe>(tri.colorB.packed & 0xffff);
+            write<Register::VXY2, Unsafe>((tri.colorB.packed >> 16) | (tri.colorC.packed << 16));
+            write<Register::VZ2, Safe>(tri.colorC.packed >> 16);
+            if (fogged) {
+                Kernels::ncdt();
+            } else {
+                Kernels::ncct();
+            }
+        } else if (fogged) {
+            Kernels::ncds();
+        } else {
+            Kernels::nccs();
+        }
+    } else if constexpr (gouraud) {
+        write<Register::RGB0, Unsafe>(tri.colorA.packed);
+        write<Register::RGB1, Unsafe>(tri.colorB.packed);
+        write<Register::RGB2, Unsafe>(tri.colorC.packed);
+        ::clear<Register::RGB, Safe>();
+        Kernels::dpct();
+    } else {
+        psyqo::Color color = {.r = tri.colorA.r, .g = tri.colorA.g, .b = tri.colorA.b};
+        write<Register::RGB, Safe>(color.packed);
+        Kernels::dpcs();
     }
 
-    if (maxIterations == 0 || ((width < 512 && height < 256 && !leavingScreenSpace))) {
-        auto &balloc = m_ballocs[m_gpu.getParity()];
+    if constexpr (gouraud) {
+        read<Register::RGB0>(&shaded.colorA.packed);
+        read<Register::RGB1>(&shaded.colorB.packed);
+        read<Register::RGB2>(&shaded.colorC.packed);
+    } else {
+        read<Register::RGB2>(&shaded.colorA.packed);
+    }
+}
 
-        // The 20 is some headroom just in case
-        if (balloc.remaining() < sizeof(psyqo::Prim::GouraudTexturedTriangle) + 20) {
-            return;
-        }
-        auto &prim = balloc.allocateFragment<psyqo::Prim::GouraudTexturedTriangle>();
+template <uint16_t material>
+void psxsplash::Renderer::drawTriangle(const Tri &tri, const eastl::array<psyqo::Vertex, 3> &projected, int zIndex) {
+    if constexpr (material & TriFlags::NO_SUBDIVIDE) {
+        emitTriangle<material>(tri, projected, zIndex);
+    } else {
+        recursiveSubdivideAndRender<material>(tri, projected, zIndex, m_quality.maxSubdivision, m_longestEdgeFirst);
+    }
+}
+
+template <uint16_t material>
+void psxsplash::Renderer::emitTriangle(const Tri &tri, const eastl::array<psyqo::Vertex, 3> &projected, int zIndex) {
+    constexpr bool textured = !(material & TriFlags::UNTEXTURED);
+    constexpr bool gouraud = !(material & TriFlags::FLAT);
+    using Prim = typename TrianglePrim<textured, gouraud>::Type;
+
+    auto &balloc = m_ballocs[m_gpu.getParity()];
+
+    // The 20 is some headroom just in case
+    if (balloc.remaining() < sizeof(Prim) + 20 || m_stats.primitivesEmitted >= m_primitiveLimit) {
+        m_stats.primitivesDropped++;
+        return;
+    }
+    auto &prim = balloc.template allocateFragment<Prim>();
 
-        prim.primitive.pointA = projected[0];
-        prim.primitive.pointB = projected[1];
-        prim.primitive.pointC = projected[2];
+    prim.primitive.pointA = projected[0];
+    prim.primitive.pointB = projected[1];
+    prim.primitive.pointC = projected[2];
 
+    if constexpr (textured) {
         prim.primitive.uvA = tri.uvA;
         prim.primitive.uvB = tri.uvB;
         prim.primitive.uvC = tri.uvC;
         prim.primitive.tpage = tri.tpage;
         psyqo::PrimPieces::ClutIndex clut(tri.clutX, tri.clutY);
         prim.primitive.clutIndex = clut;
+    }
+    if constexpr (gouraud) {
         prim.primitive.setColorA(tri.colorA);
         prim.primitive.setColorB(tri.colorB);
         prim.primitive.setColorC(tri.colorC);
+    } else {
+        prim.primitive.setColor(tri.colorA);
+    }
+    if constexpr (material & TriFlags::SEMI_TRANS) {
+        prim.primitive.setSemiTrans();
+    } else {
         prim.primitive.setOpaque();
+    }
+
+    m_ot->insert(prim, zIndex);
+    m_stats.primitivesEmitted++;
+    recordPrimitive(&prim, zIndex, (textured ? 2 : 0) | (gouraud ? 1 : 0));
+}
 
-        m_ots[m_gpu.getParity()].insert(prim, zIndex);
+template <uint16_t material>
+void psxsplash::Renderer::recursiveSubdivideAndRender(const Tri &tri, const eastl::array<psyqo::Vertex, 3> &projected,
+                                                      int zIndex, int maxIterations, bool longestEdgeFirst) {
+    constexpr bool textured = !(material & TriFlags::UNTEXTURED);
+    constexpr bool gouraud = !(material & TriFlags::FLAT);
+
+    uint16_t minX = eastl::min({projected[0].x, projected[1].x, projected[2].x});
+    uint16_t maxX = eastl::max({projected[0].x, projected[1].x, projected[2].x});
+    uint16_t minY = eastl::min({projected[0].y, projected[1].y, projected[2].y});
+    uint16_t maxY = eastl::max({projected[0].y, projected[1].y, projected[2].y});
+    uint16_t width = maxX - minX;
+    uint16_t height = maxY - minY;
+
+    bool leavingScreenSpace = false;
+    if (projected[0].x < -100 || projected[0].y < -100 || projected[1].x < -100 || projected[1].y < -100 ||
+        projected[2].x < -100 || projected[2].y < -100 || width > 420 || height > 356) {
+        leavingScreenSpace = true;
+    }
+
+    if (maxIterations == 0 || ((width < 512 && height < 256 && !leavingScreenSpace))) {
+        emitTriangle<material>(tri, projected, zIndex);
         return;
     }
 
-    // FIXME: This is slow. The optimal way to do this would be to export the triangles from unity such that
-    // the edge between v0 and v1 is always the longest edge. This way we can always split the triangle optimally.
+    m_stats.subdivisions++;
+
+    // Cooked packs (tools/splashcook) have the longest edge between v0 and v1 in object space, which is
+    // a good enough split for the projection too. The halves built below don't keep that property, so
+    // only the top level takes the shortcut.
     auto distanceSq = [](const psyqo::Vertex &a, const psyqo::Vertex &b) -> uint32_t {
         int dx = a.x - b.x;
         int dy = a.y - b.y;
         return dx * dx + dy * dy;
     };
 
-    uint32_t d0 = distanceSq(projected[0], projected[1]);
-    uint32_t d1 = distanceSq(projected[1], projected[2]);
-    uint32_t d2 = distanceSq(projected[2], projected[0]);
+    uint32_t d0 = 0, d1 = 0, d2 = 0;
+    if (!longestEdgeFirst) {
+        d0 = distanceSq(projected[0], projected[1]);
+        d1 = distanceSq(projected[1], projected[2]);
+        d2 = distanceSq(projected[2], projected[0]);
+    }
 
     int i, j, k;
-    if (d0 >= d1 && d0 >= d2) {
+    if (longestEdgeFirst || (d0 >= d1 && d0 >= d2)) {
         i = 0;
         j = 1;
         k = 2;
@@ -298,33 +1113,10 @@ void psxsplash::Renderer::recursiveSubdivideAndRender(Tri &tri, eastl::array<psy
         k = 1;
     }
 
-    auto getUVu = [&](int idx) -> uint8_t {
-        if (idx == 0) return tri.uvA.u;
-        if (idx == 1) return tri.uvB.u;
-        return tri.uvC.u;
-    };
-
-    auto getUVv = [&](int idx) -> uint8_t {
-        if (idx == 0) return tri.uvA.v;
-        if (idx == 1) return tri.uvB.v;
-        return tri.uvC.v;
-    };
-
-    auto getColor = [&](int idx) -> psyqo::Color {
-        if (idx == 0) return tri.colorA;
-        if (idx == 1) return tri.colorB;
-        return tri.colorC;
-    };
-
     psyqo::Vertex mid;
     mid.x = (projected[i].x + projected[j].x) >> 1;
     mid.y = (projected[i].y + projected[j].y) >> 1;
 
-    uint8_t newU = (getUVu(i) + getUVu(j)) / 2;
-    uint8_t newV = (getUVv(i) + getUVv(j)) / 2;
-
-    psyqo::Color newColor = averageColor(getColor(i), getColor(j));
-
     eastl::array<psyqo::Vertex, 3> projA, projB;
     projA[0] = projected[i];
     projA[1] = mid;
@@ -334,42 +1126,62 @@ void psxsplash::Renderer::recursiveSubdivideAndRender(Tri &tri, eastl::array<psy
     projB[1] = projected[j];
     projB[2] = projected[k];
 
+    // Only the attributes the material draws with are carried over to the halves
     Tri triA, triB;
 
-    triA.uvA = {getUVu(i), getUVv(i)};
-    triA.uvB = {newU, newV};
-    triA.uvC = {getUVu(k), getUVv(k)};
-
-    triA.colorA = getColor(i);
-    triA.colorB = newColor;
-    triA.colorC = getColor(k);
-
-    /*triA.colorA = {.r = 255};
-    triA.colorB = {.r = 255};
-    triA.colorC = {.r = 255};*/
-
-    triA.tpage = tri.tpage;
-    triA.clutX = tri.clutX;
-    triA.clutY = tri.clutY;
-    triA.normal = tri.normal;
+    if constexpr (textured) {
+        auto getUVu = [&](int idx) -> uint8_t {
+            if (idx == 0) return tri.uvA.u;
+            if (idx == 1) return tri.uvB.u;
+            return tri.uvC.u;
+        };
+
+        auto getUVv = [&](int idx) -> uint8_t {
+            if (idx == 0) return tri.uvA.v;
+            if (idx == 1) return tri.uvB.v;
+            return tri.uvC.v;
+        };
+
+        uint8_t newU = (getUVu(i) + getUVu(j)) / 2;
+        uint8_t newV = (getUVv(i) + getUVv(j)) / 2;
+
+        triA.uvA = {getUVu(i), getUVv(i)};
+        triA.uvB = {newU, newV};
+        triA.uvC = {getUVu(k), getUVv(k)};
+
+        triB.uvA = {newU, newV};
+        triB.uvB = {getUVu(j), getUVv(j)};
+        triB.uvC = {getUVu(k), getUVv(k)};
+
+        triA.tpage = tri.tpage;
+        triA.clutX = tri.clutX;
+        triA.clutY = tri.clutY;
+        triB.tpage = tri.tpage;
+        triB.clutX = tri.clutX;
+        triB.clutY = tri.clutY;
+    }
 
-    triB.uvA = {newU, newV};
-    triB.uvB = {getUVu(j), getUVv(j)};
-    triB.uvC = {getUVu(k), getUVv(k)};
+    if constexpr (gouraud) {
+        auto getColor = [&](int idx) -> psyqo::Color {
+            if (idx == 0) return tri.colorA;
+            if (idx == 1) return tri.colorB;
+            return tri.colorC;
+        };
 
-    triB.colorA = newColor;
-    triB.colorB = getColor(j);
-    triB.colorC = getColor(k);
+        psyqo::Color newColor = averageColor(getColor(i), getColor(j));
 
-    /*triB.colorA = {.g = 255};
-    triB.colorB = {.g = 255};
-    triB.colorC = {.g = 255};*/
+        triA.colorA = getColor(i);
+        triA.colorB = newColor;
+        triA.colorC = getColor(k);
 
-    triB.tpage = tri.tpage;
-    triB.clutX = tri.clutX;
-    triB.clutY = tri.clutY;
-    triB.normal = tri.normal;
+        triB.colorA = newColor;
+        triB.colorB = getColor(j);
+        triB.colorC = getColor(k);
+    } else {
+        triA.colorA = tri.colorA;
+        triB.colorA = tri.colorA;
+    }
 
-    recursiveSubdivideAndRender(triA, projA, zIndex, maxIterations - 1);
-    recursiveSubdivideAndRender(triB, projB, zIndex, maxIterations - 1);
-}
\ No newline at end of file
+    recursiveSubdivideAndRender<material>(triA, projA, zIndex, maxIterations - 1, false);
+    recursiveSubdivideAndRender<material>(triB, projB, zIndex, maxIterations - 1, false);
+}
@@ -7,34 +7,164 @@
 #include <psyqo/fragments.hh>
 #include <psyqo/gpu.hh>
 #include <psyqo/kernel.hh>
+#include <psyqo/matrix.hh>
 #include <psyqo/ordering-table.hh>
 #include <psyqo/primitives/common.hh>
+#include <psyqo/primitives/control.hh>
 #include <psyqo/primitives/misc.hh>
 #include <psyqo/primitives/triangles.hh>
 #include <psyqo/trigonometry.hh>
+#include <psyqo/vector.hh>
 
 #include "camera.hh"
 #include "gameobject.hh"
 #include "navmesh.hh"
+#include "particles.hh"
+#include "vertexanim.hh"
 
 namespace psxsplash {
 
+// Per-frame counters filled in by Render, used by the benchmark mode
+struct RenderStats {
+    uint32_t trianglesTested;
+    uint32_t trianglesBackfaceCulled;
+    uint32_t trianglesDepthCulled;
+    uint32_t trianglesDrawn;
+    uint32_t primitivesEmitted;
+    uint32_t primitivesDropped;
+    uint32_t subdivisions;
+    uint32_t bytesAllocated;
+    uint32_t materialRuns;
+    uint32_t objectsCulled;
+    uint32_t primitivesReused;
+    uint32_t trianglesTextureLod;
+    uint32_t transformsReused;
+    uint32_t particlesDrawn;
+};
+
+// GTE lighting setup for the LIT material. Light directions are in world space,
+// one per row. Light colors are one per column, ambient is the background color.
+struct SceneLighting {
+    psyqo::Matrix33 directions;
+    psyqo::Matrix33 colors;
+    psyqo::Vec3 ambient;
+};
+
+// GTE depth cueing. Vertex colors fade to color between nearZ and farZ, and
+// geometry past farZ is culled. Distances are view space depths, in the 4.12
+// units of SZ. A farZ of 0 disables both.
+struct SceneFog {
+    psyqo::Color color;
+    uint16_t nearZ;
+    uint16_t farZ;
+};
+
+// How view depths are turned into ordering table buckets. Depths are in the
+// 4.12 units of SZ, anything at or past range is culled.
+struct DepthMapping {
+    enum class Curve : uint8_t {
+        Linear,
+        Log,        // spacing grows with the depth, roughly linear below knee
+        Piecewise,  // half of the buckets below knee, the other half above
+    };
+    Curve curve;
+    bool average;  // average of the three vertices instead of the farthest one
+    uint16_t range;
+    uint16_t knee;
+};
+
+// Knobs turned by the quality governor, the defaults are full quality
+struct QualitySettings {
+    static constexpr uint16_t FULL_DRAW_DISTANCE = 256;
+
+    uint8_t maxSubdivision = 1;                  // splits allowed for triangles too big for the GPU
+    uint16_t drawDistance = FULL_DRAW_DISTANCE;  // scale of the scene far plane, in 1/256
+    uint16_t primitiveBudget = 0xffff;           // primitives per frame, the rest are dropped
+    uint16_t textureLodDistance = 256;           // scale of the texture LOD distances, in 1/256
+};
+
+// A smaller copy of a texture page, made by tools/splashcook. Past distance, texture
+// coordinates are halved once per level, then moved by u, v inside of page.
+struct TextureLodLevel {
+    uint16_t distance;
+    uint16_t page;  // page bits of the tpage attribute
+    uint8_t u, v;
+};
+
+// The copies of one texture page, source being the page and color mode bits of the
+// tpage attribute they stand in for. Levels go from the nearest to the farthest.
+struct TextureLod {
+    static constexpr uint16_t MAX_LEVELS = 2;
+
+    uint16_t source;
+    uint16_t levelCount;
+    TextureLodLevel levels[MAX_LEVELS];
+};
+
+// A camera drawn to a part of the screen. Several of them split the screen, each with its own projection,
+// and share the work that doesn't depend on the camera.
+struct View {
+    Camera* camera;
+    psyqo::Rect area;  // in screen pixels, a being the top left corner and b the size
+    uint16_t h;        // projection plane distance, see Renderer::PROJECTION_H
+};
+
 class Renderer final {
   public:
     Renderer(const Renderer&) = delete;
     Renderer& operator=(const Renderer&) = delete;
 
-    // FIXME: I have no idea how to precompute the required sizes of these. It would be best to allocate them based on the scene
-    static constexpr size_t ORDERING_TABLE_SIZE = 2048 * 3;
+    // The ordering table size is a template parameter of psyqo's OrderingTable, scenes choose how their
+    // depth range is spread over it instead (see DepthMapping)
+    // FIXME: I have no idea how to precompute the required size of the bump allocator. It would be best to allocate it based on the scene
+    static constexpr size_t ORDERING_TABLE_SIZE = 1024;
     static constexpr size_t BUMP_ALLOCATOR_SIZE = 8096 * 24;
+    // Projection plane distance, written to the GTE H register
+    static constexpr uint16_t PROJECTION_H = 120;
+    // Primitives remembered per buffer for reuse by unchanged frames
+    static constexpr size_t MAX_RECORDED_PRIMITIVES = 4096;
+    // Particles closer than this are skipped rather than covering the screen, and none grows past
+    // MAX_PARTICLE_SIZE pixels
+    static constexpr int32_t PARTICLE_NEAR_Z = 64;
+    static constexpr int32_t MAX_PARTICLE_SIZE = 256;
+    static constexpr DepthMapping DEFAULT_DEPTH_MAPPING = {DepthMapping::Curve::Log, false, 2048 * 3, 512};
+    static constexpr int16_t SCREEN_WIDTH = 320, SCREEN_HEIGHT = 240;
+    // Every view has an ordering table per buffer
+    static constexpr uint8_t MAX_VIEWS = 2;
 
     static void Init(psyqo::GPU& gpuInstance);
 
+    // A single view covering the screen
     void SetCamera(Camera& camera);
+    void SetViews(const View* views, uint8_t count);
+    uint8_t ViewCount() const { return m_viewCount; }
+    // Drawn by Render after the objects, nullptr for none
+    void SetParticles(const ParticlePool* particles) { m_particles = particles; }
+    // Animated objects are drawn with the poses it decodes, nullptr for none
+    void SetVertexAnimator(VertexAnimator* animator) { m_animator = animator; }
 
     
+    // Draws objects once per view, the primitive budget being shared among them
     void Render(eastl::vector<GameObject*>& objects);
-    void RenderNavmeshPreview(psxsplash::Navmesh navmesh, bool isOnMesh);
+    // From the first view. The one at current in green, the others in red
+    void RenderNavmeshPreview(psxsplash::Navmesh *const *navmeshes, uint16_t count, uint16_t current);
+
+    const RenderStats& GetStats() const { return m_stats; }
+
+    // Cooked splashpacks have the longest edge of every triangle between v0 and v1
+    void SetLongestEdgeFirst(bool longestEdgeFirst) {
+        m_longestEdgeFirst = longestEdgeFirst;
+        m_revision++;
+    }
+
+    void SetLighting(const SceneLighting& lighting) {
+        m_lighting = lighting;
+        m_revision++;
+    }
+    void SetFog(const SceneFog& fog);
+    void SetQuality(const QualitySettings& quality);
+    void SetDepthMapping(const DepthMapping& mapping);
+    void SetTextureLods(const TextureLod* lods, uint16_t count);
 
     void VramUpload(const uint16_t* imageData, int16_t posX, int16_t posY, int16_t width, int16_t height);
 
@@ -49,19 +179,152 @@ class Renderer final {
     Renderer(psyqo::GPU& gpuInstance) : m_gpu(gpuInstance) {}
     ~Renderer() {}
 
-    Camera* m_currentCamera;
+    // Frustum side planes of a view, in view space. Their normals are (h, +-half width) and
+    // (h, +-half height) across z, the lengths being theirs.
+    struct ViewState {
+        View view;
+        int32_t halfWidth, halfHeight;
+        int32_t lengthX, lengthY;
+    };
+    // Drawing area commands chained before the ordering table of a view that doesn't cover the screen
+    struct AreaFragment {
+        uint32_t head;
+        psyqo::Prim::DrawingAreaStart start = psyqo::Prim::DrawingAreaStart(psyqo::Vertex{{.x = 0, .y = 0}});
+        psyqo::Prim::DrawingAreaEnd end = psyqo::Prim::DrawingAreaEnd(psyqo::Vertex{{.x = 0, .y = 0}});
+        size_t getActualFragmentSize() const { return 2; }
+    };
+
+    ViewState m_views[MAX_VIEWS];
+    uint8_t m_viewCount = 0;
+    // The view being drawn
+    const ViewState* m_view = nullptr;
+    Camera* m_currentCamera = nullptr;
+    psyqo::OrderingTable<ORDERING_TABLE_SIZE>* m_ot = nullptr;
+    // What the view being drawn may emit, the views left share what the previous ones didn't use
+    uint32_t m_primitiveLimit;
+    uint32_t m_particleLimit;
+    const ParticlePool* m_particles = nullptr;
+    VertexAnimator* m_animator = nullptr;
+    // Corners of the Tri run being drawn when its object is animated
+    const psyqo::GTE::PackedVec3* m_runPose = nullptr;
 
     psyqo::GPU& m_gpu;
     psyqo::Trig<> m_trig;
 
-    psyqo::OrderingTable<ORDERING_TABLE_SIZE> m_ots[2];
+    psyqo::OrderingTable<ORDERING_TABLE_SIZE> m_ots[2][MAX_VIEWS];
     psyqo::Fragments::SimpleFragment<psyqo::Prim::FastFill> m_clear[2];
+    // The last one gives the whole screen back, for what is drawn after the views
+    AreaFragment m_areas[2][MAX_VIEWS + 1];
     psyqo::BumpAllocator<BUMP_ALLOCATOR_SIZE> m_ballocs[2];
 
     psyqo::Color m_clearcolor = {.r = 0, .g = 0, .b = 0};
 
-    void recursiveSubdivideAndRender(Tri &tri, eastl::array<psyqo::Vertex, 3> &projected, int zIndex,
-      int maxIterations);
+    RenderStats m_stats;
+    bool m_longestEdgeFirst = false;
+    SceneLighting m_lighting;
+    SceneFog m_sceneFog = {};
+    SceneFog m_fog = {};  // m_sceneFog with the quality draw distance applied
+    QualitySettings m_quality;
+    int32_t m_farZ = 0xffff;
+    int16_t m_fogDQA = 0;
+    int32_t m_fogDQB = 0;
+
+    // Depth to bucket lookup, indexed by depth >> m_depthShift
+    static constexpr size_t DEPTH_LUT_SIZE = 1024;
+    DepthMapping m_depthMapping;
+    uint8_t m_depthShift;
+    uint16_t m_depthLut[DEPTH_LUT_SIZE];
+
+    // Texture LODs by page, as loaded and with the quality applied
+    static constexpr uint16_t TPAGE_PAGE_MASK = 0x001f;
+    static constexpr uint16_t TPAGE_SOURCE_MASK = 0x019f;
+    TextureLod m_sceneTextureLods[TPAGE_PAGE_MASK + 1] = {};
+    TextureLod m_textureLods[TPAGE_PAGE_MASK + 1] = {};
+
+    // What was drawn in the buffers of one parity. An object is recorded as its transform and the range
+    // of primitives it emitted, each primitive as its offset from base << 12 | z << 2 | kind
+    struct ObjectRecord {
+        GameObject* object;
+        psyqo::Vec3 position;
+        psyqo::Matrix33 rotation;
+        uint16_t first;
+        uint16_t count;
+    };
+    struct FrameRecord {
+        bool valid = false;
+        uint32_t revision;
+        psyqo::Vec3 cameraPosition;
+        psyqo::Matrix33 cameraRotation;
+        eastl::vector<ObjectRecord> objects;
+        uint8_t* base;
+        uint16_t count;
+        uint32_t primitives[MAX_RECORDED_PRIMITIVES];
+    };
+    static_assert(ORDERING_TABLE_SIZE <= 1024, "Recorded primitives keep z in 10 bits");
+
+    // Only single view frames are recorded, more would need a record and their own buffers each
+    FrameRecord m_frames[2];
+    bool m_recording;
+    // Bumped by every setter that changes the output, so recorded frames don't outlive it
+    uint32_t m_revision = 0;
+
+    // Camera translation rotated by the camera, the same for every object of a frame
+    psyqo::Vec3 m_cameraTranslation;
+    // Matrices of the last object drawn, instances of a mesh are drawn back to back and often
+    // share their rotation
+    bool m_lastTransformValid;
+    psyqo::Matrix33 m_lastRotation;
+    psyqo::Matrix33 m_lastMatrix;
+    psyqo::Matrix33 m_lastLightMatrix;
+
+    void beginView(uint8_t index, uint8_t viewsLeft);
+    void submit(uint8_t viewCount);
+    bool outsideView(const psyqo::Vec3& position, int32_t radius) const;
+    void renderObject(GameObject* obj);
+    void reinsertObject(const FrameRecord& frame, const ObjectRecord& record);
+    void recordPrimitive(const void* fragment, int32_t zIndex, uint32_t kind);
+    void renderParticles();
+    bool drawParticle(uint16_t index, uint32_t screen, int32_t depth);
+
+    void updateDrawDistance();
+    void updateTextureLods();
+    void lowerTexture(Tri& tri, const TextureLod& lod, int32_t depth);
+
+    // Ordering table bucket of a view depth, -1 past the depth range
+    int32_t depthBucket(int32_t depth) const {
+        return depth < m_depthMapping.range ? m_depthLut[depth >> m_depthShift] : -1;
+    }
+
+    // Triangles are drawn in runs of equal material flags, each run going through
+    // a loop specialised for its flags (see TriFlags)
+    using RunRenderer = void (Renderer::*)(Tri* tris, int count);
+    static const RunRenderer s_runRenderers[TriFlags::MATERIAL_MASK + 1];
+    // Compact meshes have no LIT form
+    using CompactRunRenderer = const CompactRun* (Renderer::*)(const uint32_t* vertices, const CompactRun& run);
+    static const CompactRunRenderer s_compactRunRenderers[TriFlags::LIT];
+
+    void renderCompactMesh(const CompactMesh& mesh, const uint32_t* vertices);
+    template <uint16_t material>
+    void renderRun(Tri* tris, int count);
+    template <uint16_t material>
+    const CompactRun* renderCompactRun(const uint32_t* vertices, const CompactRun& run);
+
+    // Projects the triangle in V0..V2 and runs the culling tests, false when it is culled. nearest
+    // is the depth of its nearest vertex, fog the depth cue factor of the farthest one, left in IR0.
+    bool projectTriangle(eastl::array<psyqo::Vertex, 3>& projected, int32_t& zIndex, int32_t& nearest,
+                         uint32_t& fog);
+    template <uint16_t material>
+    void drawProjected(const Tri& tri, const eastl::array<psyqo::Vertex, 3>& projected, int32_t zIndex,
+                       int32_t nearest, uint32_t fog);
+    template <uint16_t material>
+    void shadeTriangle(const Tri& tri, Tri& shaded, bool fogged);
+    template <uint16_t material>
+    void drawTriangle(const Tri& tri, const eastl::array<psyqo::Vertex, 3>& projected, int zIndex);
+    template <uint16_t material>
+    void emitTriangle(const Tri& tri, const eastl::array<psyqo::Vertex, 3>& projected, int zIndex);
+    template <uint16_t material>
+    void recursiveSubdivideAndRender(const Tri& tri, const eastl::array<psyqo::Vertex, 3>& projected, int zIndex,
+                                     int maxIterations, bool longestEdgeFirst);
 };
 
 }  // namespace psxsplash
\ No newline at end of file
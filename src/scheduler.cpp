@@ -0,0 +1,61 @@
+#include "scheduler.hh"
+
+#include <EASTL/utility.h>
+
+namespace psxsplash {
+
+bool JobScheduler::Add(Job &&job) {
+    for (auto &entry : m_jobs) {
+        if (entry.active) continue;
+        entry.job = eastl::move(job);
+        entry.active = true;
+        // Jobs added by a running job wait for the next frame
+        entry.parked = m_gpu != nullptr;
+        m_count++;
+        return true;
+    }
+    return false;
+}
+
+bool JobScheduler::SliceOver() const {
+    if (!m_gpu) return true;
+    return int32_t(m_gpu->now() - m_sliceEnd) >= 0;
+}
+
+void JobScheduler::Run(psyqo::GPU &gpu, uint32_t budget) {
+    if (m_count == 0) return;
+    for (auto &entry : m_jobs) entry.parked = false;
+
+    m_gpu = &gpu;
+    uint32_t start = gpu.now();
+    while (m_count > 0) {
+        uint32_t elapsed = gpu.now() - start;
+        if (elapsed + MIN_SLICE > budget) break;
+
+        // What is left is split evenly between the jobs that can still run
+        // this frame, a job finishing early leaves more for the others
+        uint8_t runnable = 0;
+        for (auto &entry : m_jobs) {
+            if (entry.active && !entry.parked) runnable++;
+        }
+        if (runnable == 0) break;
+        uint32_t slice = (budget - elapsed) / runnable;
+        if (slice < MIN_SLICE) slice = MIN_SLICE;
+
+        while (!m_jobs[m_next].active || m_jobs[m_next].parked) m_next = (m_next + 1) % MAX_JOBS;
+        m_current = m_next;
+        m_next = (m_next + 1) % MAX_JOBS;
+
+        auto &entry = m_jobs[m_current];
+        m_sliceEnd = gpu.now() + slice;
+        entry.job.resume();
+        if (entry.job.done()) {
+            entry.job = Job();
+            entry.active = false;
+            m_count--;
+        }
+    }
+    m_gpu = nullptr;
+}
+
+}  // namespace psxsplash
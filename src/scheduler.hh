@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <coroutine>
+#include <psyqo/coroutine.hh>
+#include <psyqo/gpu.hh>
+
+namespace psxsplash {
+
+// Runs work that doesn't fit in a single frame as cooperative jobs. A job is a
+// psyqo coroutine that co_awaits Yield() between steps: it keeps going while
+// its time slice lasts and is suspended otherwise, to be resumed on a later
+// frame. The frame loop hands the scheduler whatever time is left once the
+// frame has been submitted, and the jobs share it round robin.
+//
+//   psyqo::Coroutine<> job(JobScheduler &scheduler) {
+//       for (...) {
+//           step();
+//           co_await scheduler.Yield();
+//       }
+//   }
+//   scheduler.Add(job(scheduler));
+class JobScheduler final {
+  public:
+    static constexpr uint8_t MAX_JOBS = 8;
+    // Below this, a slice isn't worth resuming a job for
+    static constexpr uint32_t MIN_SLICE = 500;
+
+    using Job = psyqo::Coroutine<>;
+
+    // Suspends the job once its slice is over, or unconditionally when
+    // nextFrame is set
+    struct YieldAwaiter {
+        JobScheduler *scheduler;
+        bool nextFrame;
+        bool await_ready() const { return !nextFrame && !scheduler->SliceOver(); }
+        void await_suspend(std::coroutine_handle<>) const {
+            if (nextFrame) scheduler->m_jobs[scheduler->m_current].parked = true;
+        }
+        void await_resume() const {}
+    };
+
+    // The job doesn't run until the next call to Run. Returns false when the
+    // scheduler is full, in which case the job is dropped.
+    bool Add(Job &&job);
+
+    // Yield keeps running if the slice has time left, NextFrame always waits
+    // for the next call to Run
+    YieldAwaiter Yield() { return {this, false}; }
+    YieldAwaiter NextFrame() { return {this, true}; }
+
+    // Resumes the jobs for at most budget microseconds
+    void Run(psyqo::GPU &gpu, uint32_t budget);
+
+    bool SliceOver() const;
+    uint8_t Pending() const { return m_count; }
+
+  private:
+    // Slots are reused in place rather than compacted, so a coroutine is
+    // only ever moved once, into its slot
+    struct Entry {
+        Job job;
+        bool active = false;
+        bool parked = false;
+    };
+
+    Entry m_jobs[MAX_JOBS];
+    uint8_t m_count = 0;
+    uint8_t m_next = 0;
+    uint8_t m_current = 0;
+
+    psyqo::GPU *m_gpu = nullptr;
+    uint32_t m_sliceEnd = 0;
+};
+
+}  // namespace psxsplash
@@ -1,5 +1,6 @@
 #include "splashpack.hh"
 
+#include <EASTL/algorithm.h>
 #include <psyqo/primitives/common.hh>
 
 #include "gameobject.hh"
@@ -8,8 +9,17 @@
 #include "psyqo/gte-registers.hh"
 #include "renderer.hh"
 
+using namespace psyqo::fixed_point_literals;
+
 namespace psxsplash {
 
+// Version 2 adds the section table after the CLUT table, version 3 the MESH section, version 4 the SECT
+// section, version 5 the HIER section, version 6 the TRIG section, version 7 the VANI section
+static constexpr uint16_t SPLASHPACK_VERSION = 7;
+
+// Set by tools/splashcook when every triangle has its longest edge between v0 and v1
+static constexpr uint16_t SPLASHPACK_FLAG_LONGEST_EDGE_FIRST = 1 << 0;
+
 struct SPLASHPACKFileHeader {
     char magic[2];
     uint16_t version;
@@ -20,7 +30,7 @@ struct SPLASHPACKFileHeader {
     psyqo::GTE::PackedVec3 playerStartPos;
     psyqo::GTE::PackedVec3 playerStartRot;
     psyqo::FixedPoint<12, uint16_t> playerHeight;
-    uint16_t pad[1];
+    uint16_t flags;
 };
 
 struct SPLASHPACKTextureAtlas {
@@ -37,25 +47,176 @@ struct SPLASHPACKClut {
     uint16_t pad;
 };
 
+// Optional per-scene data, found by tag. Sections the runtime doesn't know are skipped.
+struct SPLASHPACKSectionTable {
+    uint16_t count;
+    uint16_t pad;
+};
+
+struct SPLASHPACKSection {
+    char tag[4];
+    uint32_t offset;
+    uint32_t size;
+};
+
+// "LITE": GTE lighting for the LIT material
+struct SPLASHPACKLighting {
+    psyqo::Matrix33 lightDirections;
+    psyqo::Matrix33 lightColors;
+    psyqo::Vec3 ambient;
+};
+
+// "FOG ": depth cueing and far plane, see SceneFog
+struct SPLASHPACKFog {
+    psyqo::Color color;
+    uint16_t nearZ;
+    uint16_t farZ;
+};
+
+// "DPTH": ordering table depth mapping, see DepthMapping
+struct SPLASHPACKDepthMapping {
+    uint8_t curve;
+    uint8_t average;
+    uint16_t range;
+    uint16_t knee;
+    uint16_t pad;
+};
+
+// "TLOD": texture LODs, followed by count TextureLod
+struct SPLASHPACKTextureLods {
+    uint16_t count;
+    uint16_t pad;
+};
+
+// "MESH": triangle lists shared by their instances, as Tri or CompactMesh. When present,
+// GameObject::polygonsOffset is an index in it instead of an offset.
+struct SPLASHPACKMeshTable {
+    uint16_t count;
+    uint16_t pad;
+};
+
+struct SPLASHPACKMesh {
+    uint32_t polygonsOffset;
+    uint16_t polyCount;
+    uint16_t flags;
+};
+
+// The mesh is a CompactMesh instead of polyCount Tri
+static constexpr uint16_t SPLASHPACK_MESH_COMPACT = 1 << 0;
+
+// "SECT": the sector grid, followed by count Sector. When present, object positions, navmesh vertices
+// and the player start are relative to their sector.
+struct SPLASHPACKSectorTable {
+    uint16_t count;
+    uint8_t shift;
+    uint8_t pad;
+    uint16_t startSector;
+    uint16_t pad2;
+};
+
+// "HIER": the transform hierarchy, see TransformHierarchy. Followed by nodeCount HierarchyNode, one per
+// object, then trackCount Track whose keys are found keysOffset bytes from the start of the section. The
+// objects with a parent hold their transform relative to it.
+struct SPLASHPACKHierarchy {
+    uint16_t nodeCount;
+    uint16_t trackCount;
+};
+
+// "TRIG": trigger volumes, followed by count TriggerVolume. With sectors, they are relative to the start
+// sector like the player start.
+struct SPLASHPACKTriggers {
+    uint16_t count;
+    uint16_t pad;
+};
+
+// "VANI": vertex animations, see VertexAnimator. Followed by clipCount VertexClip whose keys are found
+// keysOffset bytes from the start of the section, then bindingCount VertexBinding.
+struct SPLASHPACKVertexAnimations {
+    uint16_t clipCount;
+    uint16_t bindingCount;
+};
+
+static uint16_t computeBoundingRadius(const GameObject *go) {
+    uint32_t maxLengthSq = 0;
+    auto grow = [&maxLengthSq](int32_t x, int32_t y, int32_t z) {
+        maxLengthSq = eastl::max(maxLengthSq, uint32_t(x * x) + uint32_t(y * y) + uint32_t(z * z));
+    };
+    if (go->IsCompact()) {
+        const CompactMesh &mesh = *go->compact;
+        const uint32_t *vertices = mesh.Vertices();
+        for (uint16_t i = 0; i < mesh.vertexCount; i++) {
+            uint32_t xy = CompactMesh::VertexXY(vertices[i]);
+            grow(mesh.origin.x.raw() + int32_t((xy & 0xffff) << mesh.shift),
+                 mesh.origin.y.raw() + int32_t((xy >> 16) << mesh.shift),
+                 mesh.origin.z.raw() + int32_t(CompactMesh::VertexZ(vertices[i]) << mesh.shift));
+        }
+    } else {
+        for (uint16_t i = 0; i < go->polyCount; i++) {
+            const Tri &tri = go->polygons[i];
+            for (const psyqo::GTE::PackedVec3 *v : {&tri.v0, &tri.v1, &tri.v2}) {
+                grow(v->x.raw(), v->y.raw(), v->z.raw());
+            }
+        }
+    }
+
+    // Integer square root, rounded up so the sphere stays conservative
+    uint32_t radius = 0;
+    for (uint32_t bit = 1 << 15; bit != 0; bit >>= 1) {
+        uint32_t candidate = radius | bit;
+        if (candidate * candidate <= maxLengthSq) radius = candidate;
+    }
+    if (radius * radius < maxLengthSq) radius++;
+    return eastl::min(radius, uint32_t(0xffff));
+}
+
+// With a MESH section, polygonsOffset is a mesh index
+void SplashPackLoader::resolveMesh(GameObject *go) {
+    if (m_meshTable) {
+        psyqo::Kernel::assert(go->polygonsOffset < m_meshTable->count, "Splashpack object uses a missing mesh");
+        auto *meshes = reinterpret_cast<const psxsplash::SPLASHPACKMesh *>(m_meshTable + 1);
+        const psxsplash::SPLASHPACKMesh &mesh = meshes[go->polygonsOffset];
+        go->polygonsOffset = mesh.polygonsOffset;
+        go->polyCount = mesh.polyCount;
+        if (mesh.flags & SPLASHPACK_MESH_COMPACT) go->polyCount |= psxsplash::GameObject::COMPACT_MESH;
+    }
+    go->polygons = reinterpret_cast<psxsplash::Tri *>(m_data + go->polygonsOffset);
+}
+
+// splashcook puts the instances of a mesh next to each other inside of a sector
+void SplashPackLoader::ResolveSectorObject(const Sector &sector, uint16_t index) {
+    GameObject *go = objectTable + sector.firstObject + index;
+    resolveMesh(go);
+    bool instance = index > 0 && (go - 1)->polygons == go->polygons;
+    go->boundingRadius = instance ? (go - 1)->boundingRadius : computeBoundingRadius(go);
+}
+
 void SplashPackLoader::LoadSplashpack(uint8_t *data) {
     psyqo::Kernel::assert(data != nullptr, "Splashpack loading data pointer is null");
     psxsplash::SPLASHPACKFileHeader *header = reinterpret_cast<psxsplash::SPLASHPACKFileHeader *>(data);
     psyqo::Kernel::assert(__builtin_memcmp(header->magic, "SP", 2) == 0, "Splashpack has incorrect magic");
+    psyqo::Kernel::assert(header->version >= 1 && header->version <= SPLASHPACK_VERSION,
+                          "Splashpack has unsupported version");
 
     playerStartPos = header->playerStartPos;
     playerStartRot = header->playerStartRot;
     playerHeight = header->playerHeight;
 
+    psxsplash::Renderer::GetInstance().SetLongestEdgeFirst(header->flags & SPLASHPACK_FLAG_LONGEST_EDGE_FIRST);
+
     gameObjects.reserve(header->gameObjectCount);
     gameObjects.clear();
     navmeshes.reserve(header->navmeshCount);
     navmeshes.clear();
 
+    usage.navmeshBytes = usage.atlasBytes = usage.clutBytes = usage.sectionBytes = 0;
+    usage.sectionCount = 0;
+    usage.atlases.clear();
+    usage.cluts.clear();
+
     uint8_t *curentPointer = data + sizeof(psxsplash::SPLASHPACKFileHeader);
 
     for (uint16_t i = 0; i < header->gameObjectCount; i++) {
         psxsplash::GameObject *go = reinterpret_cast<psxsplash::GameObject *>(curentPointer);
-        go->polygons = reinterpret_cast<psxsplash::Tri *>(data + go->polygonsOffset);
         gameObjects.push_back(go);
         curentPointer += sizeof(psxsplash::GameObject);
     }
@@ -64,6 +225,7 @@ void SplashPackLoader::LoadSplashpack(uint8_t *data) {
         psxsplash::Navmesh *navmesh = reinterpret_cast<psxsplash::Navmesh *>(curentPointer);
         navmesh->polygons = reinterpret_cast<psxsplash::NavMeshTri *>(data + navmesh->polygonsOffset);
         navmeshes.push_back(navmesh);
+        usage.navmeshBytes += navmesh->triangleCount * sizeof(psxsplash::NavMeshTri);
         curentPointer += sizeof(psxsplash::Navmesh);
     }
 
@@ -72,6 +234,8 @@ void SplashPackLoader::LoadSplashpack(uint8_t *data) {
         uint8_t *offsetData = data + atlas->polygonsOffset;
         uint16_t *castedData = reinterpret_cast<uint16_t *>(offsetData);
         psxsplash::Renderer::GetInstance().VramUpload(castedData, atlas->x, atlas->y, atlas->width, atlas->height);
+        usage.atlasBytes += atlas->width * atlas->height * sizeof(uint16_t);
+        usage.atlases.push_back({atlas->x, atlas->y, atlas->width, atlas->height});
         curentPointer += sizeof(psxsplash::SPLASHPACKTextureAtlas);
     }
 
@@ -80,8 +244,137 @@ void SplashPackLoader::LoadSplashpack(uint8_t *data) {
         uint8_t *clutOffset = data + clut->clutOffset;
         psxsplash::Renderer::GetInstance().VramUpload((uint16_t *)clutOffset, clut->clutPackingX * 16,
                                                       clut->clutPackingY, clut->length, 1);
+        usage.clutBytes += clut->length * sizeof(uint16_t);
+        usage.cluts.push_back({uint16_t(clut->clutPackingX * 16), clut->clutPackingY, clut->length, 1});
         curentPointer += sizeof(psxsplash::SPLASHPACKClut);
     }
+
+    // Without a LITE section, LIT triangles only get a white ambient term
+    psxsplash::SceneLighting lighting = {};
+    lighting.ambient = {1.0_fp, 1.0_fp, 1.0_fp};
+    psxsplash::SceneFog fog = {};
+    psxsplash::DepthMapping depthMapping = psxsplash::Renderer::DEFAULT_DEPTH_MAPPING;
+    const psxsplash::TextureLod *textureLods = nullptr;
+    uint16_t textureLodCount = 0;
+    const psxsplash::SPLASHPACKMeshTable *meshTable = nullptr;
+    sectors = nullptr;
+    sectorCount = 0;
+    hierarchy = nullptr;
+    tracks = nullptr;
+    trackCount = 0;
+    triggers = nullptr;
+    triggerCount = 0;
+    vertexClips = nullptr;
+    vertexClipCount = 0;
+    vertexBindings = nullptr;
+    vertexBindingCount = 0;
+
+    if (header->version >= 2) {
+        auto *table = reinterpret_cast<psxsplash::SPLASHPACKSectionTable *>(curentPointer);
+        auto *sections = reinterpret_cast<psxsplash::SPLASHPACKSection *>(table + 1);
+        curentPointer = reinterpret_cast<uint8_t *>(sections + table->count);
+        for (uint16_t i = 0; i < table->count; i++) {
+            psxsplash::SPLASHPACKSection &section = sections[i];
+            usage.sectionBytes += section.size;
+            if (usage.sectionCount < PackUsage::MAX_SECTIONS) {
+                PackUsage::Section &listed = usage.sections[usage.sectionCount++];
+                __builtin_memcpy(listed.tag, section.tag, 4);
+                listed.bytes = section.size;
+            }
+            if (__builtin_memcmp(section.tag, "LITE", 4) == 0) {
+                auto *lite = reinterpret_cast<psxsplash::SPLASHPACKLighting *>(data + section.offset);
+                lighting.directions = lite->lightDirections;
+                lighting.colors = lite->lightColors;
+                lighting.ambient = lite->ambient;
+            } else if (__builtin_memcmp(section.tag, "FOG ", 4) == 0) {
+                auto *sceneFog = reinterpret_cast<psxsplash::SPLASHPACKFog *>(data + section.offset);
+                fog.color = sceneFog->color;
+                fog.nearZ = sceneFog->nearZ;
+                fog.farZ = sceneFog->farZ;
+            } else if (__builtin_memcmp(section.tag, "DPTH", 4) == 0) {
+                auto *mapping = reinterpret_cast<psxsplash::SPLASHPACKDepthMapping *>(data + section.offset);
+                depthMapping.curve = psxsplash::DepthMapping::Curve(mapping->curve);
+                depthMapping.average = mapping->average != 0;
+                depthMapping.range = mapping->range;
+                depthMapping.knee = mapping->knee;
+            } else if (__builtin_memcmp(section.tag, "TLOD", 4) == 0) {
+                auto *lods = reinterpret_cast<psxsplash::SPLASHPACKTextureLods *>(data + section.offset);
+                textureLods = reinterpret_cast<psxsplash::TextureLod *>(lods + 1);
+                textureLodCount = lods->count;
+            } else if (__builtin_memcmp(section.tag, "MESH", 4) == 0) {
+                meshTable = reinterpret_cast<psxsplash::SPLASHPACKMeshTable *>(data + section.offset);
+            } else if (__builtin_memcmp(section.tag, "SECT", 4) == 0) {
+                auto *grid = reinterpret_cast<psxsplash::SPLASHPACKSectorTable *>(data + section.offset);
+                sectors = reinterpret_cast<psxsplash::Sector *>(grid + 1);
+                sectorCount = grid->count;
+                sectorShift = grid->shift;
+                startSector = grid->startSector;
+                psyqo::Kernel::assert(startSector < sectorCount, "Splashpack starts outside of its sectors");
+                psyqo::Kernel::assert(sectorShift > 0 && sectorShift < 16, "Splashpack has unsupported sector size");
+            } else if (__builtin_memcmp(section.tag, "HIER", 4) == 0) {
+                auto *nodes = reinterpret_cast<psxsplash::SPLASHPACKHierarchy *>(data + section.offset);
+                psyqo::Kernel::assert(nodes->nodeCount == header->gameObjectCount,
+                                      "Splashpack hierarchy doesn't match its objects");
+                hierarchy = reinterpret_cast<psxsplash::HierarchyNode *>(nodes + 1);
+                tracks = reinterpret_cast<psxsplash::Track *>(hierarchy + nodes->nodeCount);
+                trackCount = nodes->trackCount;
+                for (uint16_t t = 0; t < trackCount; t++) {
+                    tracks[t].keys = reinterpret_cast<psxsplash::TrackKey *>(reinterpret_cast<uint8_t *>(nodes) +
+                                                                             tracks[t].keysOffset);
+                }
+            } else if (__builtin_memcmp(section.tag, "TRIG", 4) == 0) {
+                auto *volumes = reinterpret_cast<psxsplash::SPLASHPACKTriggers *>(data + section.offset);
+                triggers = reinterpret_cast<psxsplash::TriggerVolume *>(volumes + 1);
+                triggerCount = volumes->count;
+            } else if (__builtin_memcmp(section.tag, "VANI", 4) == 0) {
+                auto *animations = reinterpret_cast<psxsplash::SPLASHPACKVertexAnimations *>(data + section.offset);
+                vertexClips = reinterpret_cast<psxsplash::VertexClip *>(animations + 1);
+                vertexClipCount = animations->clipCount;
+                vertexBindings = reinterpret_cast<psxsplash::VertexBinding *>(vertexClips + vertexClipCount);
+                vertexBindingCount = animations->bindingCount;
+                for (uint16_t c = 0; c < vertexClipCount; c++) {
+                    vertexClips[c].keys = reinterpret_cast<psxsplash::VertexKey *>(
+                        reinterpret_cast<uint8_t *>(animations) + vertexClips[c].keysOffset);
+                }
+            }
+        }
+    }
+    psyqo::Kernel::assert(!sectors || !hierarchy, "Splashpack can't have both sectors and a hierarchy");
+    usage.tableBytes = curentPointer - data;
+
+    m_data = data;
+    m_meshTable = meshTable;
+    objectTable = reinterpret_cast<psxsplash::GameObject *>(data + sizeof(psxsplash::SPLASHPACKFileHeader));
+    objectCount = header->gameObjectCount;
+
+    // The streamer fills gameObjects as the sectors load
+    if (sectors) {
+        gameObjects.clear();
+    } else {
+        // Instances share their triangles and bounding radius. The objects are then reordered so the
+        // instances of a mesh are drawn back to back, in the order the meshes first appear.
+        eastl::vector<psxsplash::GameObject *> ordered;
+        ordered.reserve(gameObjects.size());
+        for (psxsplash::GameObject *go : gameObjects) {
+            resolveMesh(go);
+
+            auto position = ordered.end();
+            bool instance = false;
+            for (auto it = ordered.begin(); it != ordered.end(); ++it) {
+                if ((*it)->polygons != go->polygons) continue;
+                position = it + 1;
+                instance = true;
+            }
+            go->boundingRadius = instance ? (*(position - 1))->boundingRadius : computeBoundingRadius(go);
+            ordered.insert(position, go);
+        }
+        gameObjects.swap(ordered);
+    }
+
+    psxsplash::Renderer::GetInstance().SetLighting(lighting);
+    psxsplash::Renderer::GetInstance().SetFog(fog);
+    psxsplash::Renderer::GetInstance().SetDepthMapping(depthMapping);
+    psxsplash::Renderer::GetInstance().SetTextureLods(textureLods, textureLodCount);
 }
 
 }  // namespace psxsplash
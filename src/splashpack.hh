@@ -2,21 +2,95 @@
 
 #include <EASTL/vector.h>
 
+#include "broadphase.hh"
 #include "gameobject.hh"
+#include "hierarchy.hh"
 #include "navmesh.hh"
+#include "vertexanim.hh"
 #include "psyqo/fixed-point.hh"
 
 namespace psxsplash {
 
+struct SPLASHPACKMeshTable;
+
+// A cell of the pack's sector grid, see WorldStreamer. Its objects and navmeshes are contiguous in
+// the pack, positioned relative to the center of the cell, (x, z) << SplashPackLoader::sectorShift.
+struct Sector {
+    int16_t x, z;
+    uint16_t firstObject, objectCount;
+    uint16_t firstNavmesh, navmeshCount;
+};
+
+// Where the bytes of the loaded pack go, see MemoryBudget. VRAM rectangles are in 16 bits pixels.
+struct PackUsage {
+    static constexpr uint8_t MAX_SECTIONS = 16;
+
+    struct Section {
+        char tag[4];
+        uint32_t bytes;
+    };
+    struct VramRect {
+        uint16_t x, y, width, height;
+    };
+
+    // Header, objects, and the navmesh, atlas, CLUT and section tables
+    uint32_t tableBytes;
+    uint32_t navmeshBytes;
+    // The pixels stay in RAM once uploaded
+    uint32_t atlasBytes, clutBytes;
+    // Every section, the first MAX_SECTIONS of them listed
+    uint32_t sectionBytes;
+    Section sections[MAX_SECTIONS];
+    uint8_t sectionCount;
+    eastl::vector<VramRect> atlases, cluts;
+};
+
 class SplashPackLoader {
   public:
+    // Every object of the pack, or with sectors only the ones of the resident sectors
     eastl::vector<GameObject *> gameObjects;
     eastl::vector<Navmesh *> navmeshes;
-    
+
     psyqo::GTE::PackedVec3 playerStartPos, playerStartRot;
     psyqo::FixedPoint<12, uint16_t> playerHeight;
 
+    // Set when the pack is split in sectors, playerStartPos is then relative to startSector
+    Sector *sectors = nullptr;
+    uint16_t sectorCount = 0;
+    uint16_t startSector = 0;
+    uint8_t sectorShift = 0;
+    GameObject *objectTable = nullptr;
+    uint16_t objectCount = 0;
+
+    // Set when some objects have a parent or a track, one node per object of objectTable. Packs with a
+    // hierarchy have no sectors.
+    HierarchyNode *hierarchy = nullptr;
+    Track *tracks = nullptr;
+    uint16_t trackCount = 0;
+
+    // Relative to the start sector with sectors, see Broadphase
+    TriggerVolume *triggers = nullptr;
+    uint16_t triggerCount = 0;
+
+    // Set when some objects have a vertex animation, see VertexAnimator
+    VertexClip *vertexClips = nullptr;
+    uint16_t vertexClipCount = 0;
+    VertexBinding *vertexBindings = nullptr;
+    uint16_t vertexBindingCount = 0;
+
+    PackUsage usage = {};
+
     void LoadSplashpack(uint8_t *data);
+
+    // Points an object of a sector at its triangles and computes its bounds, once per pack. Objects
+    // of sectors are left unresolved by LoadSplashpack, the streamer resolves them as it loads them.
+    void ResolveSectorObject(const Sector &sector, uint16_t index);
+
+  private:
+    uint8_t *m_data = nullptr;
+    const SPLASHPACKMeshTable *m_meshTable = nullptr;
+
+    void resolveMesh(GameObject *go);
 };
 
-};  // namespace psxsplash
\ No newline at end of file
+};  // namespace psxsplash
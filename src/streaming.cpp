@@ -0,0 +1,159 @@
+#include "streaming.hh"
+
+#include <EASTL/algorithm.h>
+
+namespace psxsplash {
+
+static int16_t cellDistance(const Sector &sector, int16_t x, int16_t z) {
+    return eastl::max(__builtin_abs(sector.x - x), __builtin_abs(sector.z - z));
+}
+
+void WorldStreamer::Start(SplashPackLoader &loader, JobScheduler &jobs) {
+    m_loader = &loader;
+    m_jobs = &jobs;
+    // A job still running for the previous pack picks the new queue up
+    m_states.assign(loader.sectorCount, State::Unloaded);
+    m_resolved.assign(loader.sectorCount, 0);
+    if (!loader.sectors) return;
+
+    const Sector &start = loader.sectors[loader.startSector];
+    m_originX = start.x;
+    m_originZ = start.z;
+    for (uint16_t i = 0; i < loader.sectorCount; i++) {
+        if (cellDistance(loader.sectors[i], m_originX, m_originZ) <= RADIUS) loadNow(i);
+    }
+}
+
+void WorldStreamer::Update(Camera *const *cameras, uint8_t cameraCount, ParticlePool &particles,
+                           Broadphase &broadphase) {
+    if (!m_loader || !m_loader->sectors) return;
+
+    // Cells are centered on their origin, their edges are half a sector away from it
+    int32_t half = 1 << (m_loader->sectorShift - 1);
+    psyqo::Vec3 &position = cameras[0]->GetPosition();
+    int32_t dx = (position.x.raw() + half) >> m_loader->sectorShift;
+    int32_t dz = (position.z.raw() + half) >> m_loader->sectorShift;
+    if (dx != 0 || dz != 0) {
+        psyqo::FixedPoint<12> shiftX(-(dx << m_loader->sectorShift), psyqo::FixedPoint<12>::RAW);
+        psyqo::FixedPoint<12> shiftZ(-(dz << m_loader->sectorShift), psyqo::FixedPoint<12>::RAW);
+        for (uint8_t i = 0; i < cameraCount; i++) {
+            psyqo::Vec3 &eye = cameras[i]->GetPosition();
+            cameras[i]->SetPosition(eye.x + shiftX, eye.y, eye.z + shiftZ);
+        }
+        for (GameObject *go : m_loader->gameObjects) {
+            go->position.x += shiftX;
+            go->position.z += shiftZ;
+        }
+        particles.Shift(shiftX.raw(), shiftZ.raw());
+        broadphase.Shift(shiftX.raw(), shiftZ.raw());
+        m_originX += dx;
+        m_originZ += dz;
+    }
+
+    bool queued = false;
+    for (uint16_t i = 0; i < m_loader->sectorCount; i++) {
+        int16_t distance = cellDistance(m_loader->sectors[i], m_originX, m_originZ);
+        if ((distance == 0 || (m_blocking && distance <= RADIUS)) && m_states[i] != State::Resident) {
+            // The camera is in it already, this one can't wait
+            loadNow(i);
+        } else if (distance <= RADIUS && m_states[i] == State::Unloaded) {
+            m_states[i] = State::Queued;
+        } else if (distance > RADIUS + 1 && m_states[i] == State::Resident) {
+            unload(i);
+        } else if (distance > RADIUS + 1 && m_states[i] == State::Queued) {
+            m_states[i] = State::Unloaded;
+        }
+        queued |= m_states[i] == State::Queued;
+    }
+
+    if (queued && !m_loading) {
+        m_loading = m_jobs->Add(loadSectors());
+    }
+}
+
+void WorldStreamer::CurrentNavmeshes(uint16_t &first, uint16_t &count) const {
+    first = count = 0;
+    if (!m_loader) return;
+    if (!m_loader->sectors) {
+        count = m_loader->navmeshes.size();
+        return;
+    }
+    for (uint16_t i = 0; i < m_loader->sectorCount; i++) {
+        const Sector &sector = m_loader->sectors[i];
+        if (sector.x != m_originX || sector.z != m_originZ) continue;
+        first = sector.firstNavmesh;
+        count = sector.navmeshCount;
+        return;
+    }
+}
+
+// One object at a time, so that the objects of a sector don't need to fit in a single slice. The queue
+// is looked at again after every step as the camera may have moved on meanwhile.
+psyqo::Coroutine<> WorldStreamer::loadSectors() {
+    for (int32_t index = nextQueued(); index >= 0; index = nextQueued()) {
+        const Sector &sector = m_loader->sectors[index];
+        if (m_resolved[index] < sector.objectCount) {
+            m_loader->ResolveSectorObject(sector, m_resolved[index]++);
+        } else {
+            makeResident(index);
+        }
+        co_await m_jobs->Yield();
+    }
+    m_loading = false;
+}
+
+// The closest queued sector first
+int32_t WorldStreamer::nextQueued() const {
+    int32_t best = -1;
+    int16_t bestDistance = 0x7fff;
+    for (uint16_t i = 0; i < m_states.size(); i++) {
+        if (m_states[i] != State::Queued) continue;
+        int16_t distance = cellDistance(m_loader->sectors[i], m_originX, m_originZ);
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+void WorldStreamer::loadNow(uint16_t index) {
+    const Sector &sector = m_loader->sectors[index];
+    while (m_resolved[index] < sector.objectCount) m_loader->ResolveSectorObject(sector, m_resolved[index]++);
+    makeResident(index);
+}
+
+void WorldStreamer::makeResident(uint16_t index) {
+    const Sector &sector = m_loader->sectors[index];
+    offsetObjects(index, 1);
+    for (uint16_t i = 0; i < sector.objectCount; i++) {
+        m_loader->gameObjects.push_back(m_loader->objectTable + sector.firstObject + i);
+    }
+    m_states[index] = State::Resident;
+}
+
+void WorldStreamer::unload(uint16_t index) {
+    const Sector &sector = m_loader->sectors[index];
+    GameObject *first = m_loader->objectTable + sector.firstObject;
+    GameObject *last = first + sector.objectCount;
+    auto &objects = m_loader->gameObjects;
+    objects.erase(eastl::remove_if(objects.begin(), objects.end(),
+                                   [first, last](GameObject *go) { return go >= first && go < last; }),
+                  objects.end());
+    offsetObjects(index, -1);
+    m_states[index] = State::Unloaded;
+}
+
+// Moves the objects of a sector between its own frame and the origin sector's one
+void WorldStreamer::offsetObjects(uint16_t index, int32_t sign) {
+    const Sector &sector = m_loader->sectors[index];
+    psyqo::FixedPoint<12> x(sign * ((sector.x - m_originX) << m_loader->sectorShift), psyqo::FixedPoint<12>::RAW);
+    psyqo::FixedPoint<12> z(sign * ((sector.z - m_originZ) << m_loader->sectorShift), psyqo::FixedPoint<12>::RAW);
+    for (uint16_t i = 0; i < sector.objectCount; i++) {
+        GameObject *go = m_loader->objectTable + sector.firstObject + i;
+        go->position.x += x;
+        go->position.z += z;
+    }
+}
+
+}  // namespace psxsplash
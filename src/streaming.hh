@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <EASTL/vector.h>
+#include <psyqo/coroutine.hh>
+
+#include "broadphase.hh"
+#include "camera.hh"
+#include "navmesh.hh"
+#include "particles.hh"
+#include "scheduler.hh"
+#include "splashpack.hh"
+
+namespace psxsplash {
+
+// Loads and unloads the sectors of a pack (see Sector) around the camera, and keeps the camera and the
+// resident objects relative to the center of the sector the camera is in, the origin sector. Once the
+// camera leaves it, everything is rebased on the sector it entered, so coordinates stay within a couple
+// of sectors of 0 whatever the size of the level: the GTE takes 16 bits vectors. Packs without sectors
+// are left alone.
+class WorldStreamer final {
+  public:
+    // Sectors up to RADIUS cells away from the origin sector get loaded, and only the ones further than
+    // RADIUS + 1 get unloaded, so walking back and forth over a border doesn't reload anything
+    static constexpr int16_t RADIUS = 1;
+
+    // Loads the sectors around the start sector right away, call after LoadSplashpack
+    void Start(SplashPackLoader &loader, JobScheduler &jobs);
+
+    // Rebases the cameras, objects, particles and triggers when the first camera left the origin sector,
+    // then unloads the sectors that are now too far and queues the loading of the close ones as a
+    // background job. The other cameras, those of the other views, only follow the rebase.
+    void Update(Camera *const *cameras, uint8_t cameraCount, ParticlePool &particles, Broadphase &broadphase);
+
+    // Loads the close sectors in Update itself rather than in the background, so that which objects are
+    // resident doesn't depend on how much time the frames leave. The benchmark replays need that.
+    void SetBlocking(bool blocking) { m_blocking = blocking; }
+
+    // Navmeshes of the origin sector, or all of them for a pack without sectors, see NavmeshSelector
+    void CurrentNavmeshes(uint16_t &first, uint16_t &count) const;
+    bool Loading() const { return m_loading; }
+
+  private:
+    enum class State : uint8_t { Unloaded, Queued, Resident };
+
+    SplashPackLoader *m_loader = nullptr;
+    JobScheduler *m_jobs = nullptr;
+    eastl::vector<State> m_states;
+    // Objects resolved so far, kept when a sector unloads so it only happens once
+    eastl::vector<uint16_t> m_resolved;
+    int16_t m_originX = 0, m_originZ = 0;
+    bool m_loading = false;
+    bool m_blocking = false;
+
+    psyqo::Coroutine<> loadSectors();
+    int32_t nextQueued() const;
+    void loadNow(uint16_t index);
+    void makeResident(uint16_t index);
+    void unload(uint16_t index);
+    void offsetObjects(uint16_t index, int32_t sign);
+};
+
+}  // namespace psxsplash
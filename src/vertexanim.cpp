@@ -0,0 +1,167 @@
+#include "vertexanim.hh"
+
+#include <EASTL/algorithm.h>
+#include <psyqo/gte-kernels.hh>
+#include <psyqo/gte-registers.hh>
+#include <psyqo/kernel.hh>
+
+#include "mesh.hh"
+#include "splashpack.hh"
+
+using namespace psyqo::GTE;
+
+namespace psxsplash {
+
+void VertexAnimator::Start(SplashPackLoader &loader) {
+    m_animations.clear();
+    m_objects = loader.objectTable;
+    m_animationOf.assign(loader.objectCount, NONE);
+    m_posesDecoded = 0;
+
+    m_animations.reserve(loader.vertexBindingCount);
+    for (uint16_t i = 0; i < loader.vertexBindingCount; i++) {
+        const VertexBinding &binding = loader.vertexBindings[i];
+        psyqo::Kernel::assert(binding.object < loader.objectCount && binding.clip < loader.vertexClipCount,
+                              "Splashpack vertex animation of a missing object or clip");
+        psyqo::Kernel::assert(m_animationOf[binding.object] == NONE,
+                              "Splashpack object has more than one vertex animation");
+        m_animationOf[binding.object] = m_animations.size();
+        Animation animation;
+        animation.object = loader.objectTable + binding.object;
+        animation.clip = loader.vertexClips + binding.clip;
+        animation.time = 0;
+        animation.key = NONE;
+        animation.fresh = false;
+        m_animations.push_back(animation);
+    }
+}
+
+// Clips loop at the frame of their last key like tracks do, see TransformHierarchy
+void VertexAnimator::Update(uint32_t frames) {
+    m_posesDecoded = 0;
+    for (Animation &animation : m_animations) {
+        const VertexClip &clip = *animation.clip;
+        if (animation.object->boundingRadius < clip.radius) animation.object->boundingRadius = clip.radius;
+
+        uint16_t last = clip.keyCount ? clip.Key(clip.keyCount - 1).frame : 0;
+        uint16_t time = 0;
+        if (last && (clip.flags & VertexClip::LOOP)) {
+            time = (animation.time + frames) % last;
+        } else if (last) {
+            time = eastl::min(uint32_t(animation.time) + frames, uint32_t(last));
+        }
+        if (time != animation.time) {
+            animation.time = time;
+            animation.fresh = false;
+        }
+    }
+}
+
+const void *VertexAnimator::Pose(const GameObject *go) {
+    uint16_t index = animationOf(go);
+    if (index == NONE) return nullptr;
+    Animation &animation = m_animations[index];
+
+    if (!animation.fresh) {
+        const VertexClip &clip = *animation.clip;
+        uint16_t passed = 0;
+        while (passed < clip.keyCount && clip.Key(passed).frame <= animation.time) passed++;
+
+        // Deltas only go forward, a clip that looped starts over from the mesh
+        if (animation.key == NONE || passed < animation.key) rewind(animation);
+        for (; animation.key < passed; animation.key++) {
+            const VertexKey &key = clip.Key(animation.key);
+            const int8_t *deltas = key.Deltas();
+            int16_t *base = animation.base.data();
+            for (uint32_t i = 0; i < clip.vertexCount * 3u; i++) base[i] += deltas[i] << key.shift;
+        }
+
+        interpolate(animation);
+        animation.fresh = true;
+        m_posesDecoded++;
+    }
+
+    if (animation.object->IsCompact()) return animation.packed.data();
+    return animation.corners.data();
+}
+
+void VertexAnimator::rewind(Animation &animation) {
+    const GameObject *go = animation.object;
+    uint16_t count = animation.clip->vertexCount;
+    animation.base.resize(count * 3);
+    int16_t *base = animation.base.data();
+
+    if (go->IsCompact()) {
+        const CompactMesh &mesh = *go->compact;
+        psyqo::Kernel::assert(mesh.vertexCount == count, "Splashpack vertex animation doesn't match its mesh");
+        const uint32_t *vertices = mesh.Vertices();
+        for (uint16_t i = 0; i < count; i++, base += 3) {
+            base[0] = vertices[i] & 0x7ff;
+            base[1] = (vertices[i] >> 16) & 0x7ff;
+            base[2] = CompactMesh::VertexZ(vertices[i]);
+        }
+        animation.packed.resize(count);
+    } else {
+        psyqo::Kernel::assert(go->TriangleCount() * 3 == count, "Splashpack vertex animation doesn't match its mesh");
+        const Tri *tris = go->polygons;
+        for (uint16_t i = 0; i < go->TriangleCount(); i++) {
+            for (const PackedVec3 *corner : {&tris[i].v0, &tris[i].v1, &tris[i].v2}) {
+                base[0] = corner->x.raw();
+                base[1] = corner->y.raw();
+                base[2] = corner->z.raw();
+                base += 3;
+            }
+        }
+        animation.corners.resize(count);
+    }
+    animation.key = 0;
+}
+
+// Between the pose of the keys passed and the next key, base + ((deltas << shift) * t >> 12) on the GTE:
+// gpl with sf set adds IR * IR0 to MAC << 12, and leaves the result in IR, saturated to 16 bits.
+void VertexAnimator::interpolate(Animation &animation) {
+    const VertexClip &clip = *animation.clip;
+    const int16_t *base = animation.base.data();
+    bool compact = animation.object->IsCompact();
+    auto store = [&animation, compact](uint16_t i, int32_t x, int32_t y, int32_t z) {
+        if (compact) {
+            animation.packed[i] = uint32_t(x) | uint32_t(z & 0x1f) << 11 | uint32_t(y) << 16 | uint32_t(z >> 5) << 27;
+        } else {
+            animation.corners[i].x = psyqo::FixedPoint<12, int16_t>(x, psyqo::FixedPoint<12, int16_t>::RAW);
+            animation.corners[i].y = psyqo::FixedPoint<12, int16_t>(y, psyqo::FixedPoint<12, int16_t>::RAW);
+            animation.corners[i].z = psyqo::FixedPoint<12, int16_t>(z, psyqo::FixedPoint<12, int16_t>::RAW);
+        }
+    };
+
+    int32_t t = 0;
+    const VertexKey *next = nullptr;
+    if (animation.key < clip.keyCount) {
+        next = &clip.Key(animation.key);
+        uint16_t from = animation.key > 0 ? clip.Key(animation.key - 1).frame : 0;
+        t = ((animation.time - from) << 12) / (next->frame - from);
+    }
+    if (t == 0) {
+        for (uint16_t i = 0; i < clip.vertexCount; i++, base += 3) store(i, base[0], base[1], base[2]);
+        return;
+    }
+
+    write<Register::IR0, Safe>(uint32_t(t));
+    const int8_t *deltas = next->Deltas();
+    uint8_t shift = next->shift;
+    for (uint16_t i = 0; i < clip.vertexCount; i++, base += 3, deltas += 3) {
+        write<Register::MAC1, Unsafe>(uint32_t(int32_t(base[0])));
+        write<Register::MAC2, Unsafe>(uint32_t(int32_t(base[1])));
+        write<Register::MAC3, Unsafe>(uint32_t(int32_t(base[2])));
+        write<Register::IR1, Unsafe>(uint32_t(deltas[0] << shift));
+        write<Register::IR2, Unsafe>(uint32_t(deltas[1] << shift));
+        write<Register::IR3, Safe>(uint32_t(deltas[2] << shift));
+        Kernels::gpl();
+        uint32_t x, y, z;
+        read<Register::IR1>(&x);
+        read<Register::IR2>(&y);
+        read<Register::IR3>(&z);
+        store(i, int16_t(x), int16_t(y), int16_t(z));
+    }
+}
+
+}  // namespace psxsplash
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <EASTL/vector.h>
+#include <psyqo/gte-registers.hh>
+
+#include "gameobject.hh"
+
+namespace psxsplash {
+
+class SplashPackLoader;
+
+// Pose of a VertexClip, every vertex moved from the pose of the previous key by its deltas << shift. The
+// deltas follow as x, y, z per vertex, padded to 4 bytes.
+struct VertexKey {
+    uint16_t frame;
+    uint8_t shift;
+    uint8_t pad;
+
+    const int8_t *Deltas() const { return reinterpret_cast<const int8_t *>(this + 1); }
+};
+static_assert(sizeof(VertexKey) == 4, "VertexKey is not 4 bytes");
+
+// Keyframed vertices of a mesh. For a CompactMesh they are its shared vertices, in its steps, for a Tri
+// array the corners of its triangles, three per triangle, in object space units. The vertices of the
+// mesh itself are the pose at frame 0, the keys follow by increasing frame.
+struct VertexClip {
+    static constexpr uint16_t LOOP = 1 << 0;
+
+    union {
+        VertexKey *keys;
+        uint32_t keysOffset;
+    };
+    uint16_t keyCount;
+    uint16_t vertexCount;
+    // Of the object over every pose, it is culled with it
+    uint16_t radius;
+    uint16_t flags;
+
+    uint32_t KeyStride() const { return sizeof(VertexKey) + ((vertexCount * 3 + 3) & ~3); }
+    const VertexKey &Key(uint16_t index) const {
+        return *reinterpret_cast<const VertexKey *>(reinterpret_cast<const uint8_t *>(keys) + index * KeyStride());
+    }
+};
+
+// Clip played by an object of the pack's object table
+struct VertexBinding {
+    uint16_t object;
+    uint16_t clip;
+};
+
+// Plays the vertex animations of a pack. Every animation keeps the pose of the last key it went past,
+// decoded from the deltas, and the renderer asks for the vertices of the objects it draws: only those get
+// their keys applied and are interpolated towards the next key, with the GTE, once per frame whatever the
+// number of views. Animations of objects out of view cost nothing but their clock.
+class VertexAnimator final {
+  public:
+    // Picks the animated objects of the pack, call after LoadSplashpack
+    void Start(SplashPackLoader &loader);
+    // Advances the clips by frames, and widens the bounding radius of their objects to their clip's. Call
+    // once the streamer resolved the objects it loaded.
+    void Update(uint32_t frames);
+
+    bool Animated(const GameObject *go) const { return animationOf(go) != NONE; }
+    // For the renderer, what to draw the object with this frame: the packed vertices of a compact mesh,
+    // or a PackedVec3 per corner of its Tri. nullptr when the object isn't animated.
+    const void *Pose(const GameObject *go);
+
+    uint16_t AnimationCount() const { return m_animations.size(); }
+    // Poses decoded since the last Update
+    uint16_t PosesDecoded() const { return m_posesDecoded; }
+
+  private:
+    static constexpr uint16_t NONE = 0xffff;
+
+    struct Animation {
+        GameObject *object;
+        const VertexClip *clip;
+        uint16_t time;
+        // Keys applied to base, NONE before the first pose
+        uint16_t key;
+        bool fresh;
+        // x, y, z per vertex, the pose of the last key applied
+        eastl::vector<int16_t> base;
+        // Interpolated pose, one of them depending on the mesh
+        eastl::vector<uint32_t> packed;
+        eastl::vector<psyqo::GTE::PackedVec3> corners;
+    };
+
+    eastl::vector<Animation> m_animations;
+    const GameObject *m_objects = nullptr;
+    // Animation of every object of the pack's object table
+    eastl::vector<uint16_t> m_animationOf;
+    uint16_t m_posesDecoded = 0;
+
+    uint16_t animationOf(const GameObject *go) const {
+        uint16_t index = go - m_objects;
+        return index < m_animationOf.size() ? m_animationOf[index] : NONE;
+    }
+    void rewind(Animation &animation);
+    void interpolate(Animation &animation);
+};
+
+}  // namespace psxsplash
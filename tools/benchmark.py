@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Runs the psxsplash benchmark build under PCSX-Redux and summarizes it.
+
+Build the executable with `make BENCHMARK=true` first. The emulator output is
+parsed for the BENCH lines printed by src/benchmark.cpp and turned into a
+per-pack summary table. Save a summary with --save and pass it back with
+--compare on another build to get the difference between the two.
+
+    tools/benchmark.py --save before.csv
+    (rebuild)
+    tools/benchmark.py --compare before.csv
+"""
+
+import argparse
+import csv
+import os
+import shlex
+import subprocess
+import sys
+
+FRAME_FIELDS = [
+    "pack", "frame", "cpu_us", "render_us", "vsyncs", "tested", "backface", "depth",
+    "drawn", "prims", "dropped", "subdiv", "bytes",
+]
+
+SUMMARY_FIELDS = [
+    "pack", "frames", "cpu_avg", "cpu_p95", "cpu_max", "render_avg", "fps_avg",
+    "drawn_avg", "prims_avg", "dropped", "bytes_max",
+]
+
+DEFAULT_EMU_ARGS = "-cli -run -stdout -testmode -fastboot"
+
+
+def run_emulator(emulator, exe, extra_args, timeout):
+    cmd = [emulator] + shlex.split(extra_args) + ["-loadexe", exe]
+    print("running: " + " ".join(cmd), file=sys.stderr)
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=timeout)
+    return proc.stdout.decode("latin-1")
+
+
+def parse_log(text):
+    frames = {}
+    done = False
+    for line in text.splitlines():
+        parts = line.strip().split()
+        if not parts:
+            continue
+        if parts[0] == "BENCH" and len(parts) == len(FRAME_FIELDS) + 1:
+            row = dict(zip(FRAME_FIELDS, (int(p) for p in parts[1:])))
+            frames.setdefault(row["pack"], []).append(row)
+        elif parts[0] == "BENCH_DONE":
+            done = True
+    return frames, done
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(fraction * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def summarize(frames):
+    summary = []
+    # Packs are run from the highest index down, keep that order in the table
+    for pack in sorted(frames, reverse=True):
+        rows = frames[pack]
+        count = len(rows)
+        cpu = [r["cpu_us"] for r in rows]
+        vsyncs = sum(r["vsyncs"] for r in rows)
+        summary.append({
+            "pack": pack,
+            "frames": count,
+            "cpu_avg": sum(cpu) // count,
+            "cpu_p95": percentile(cpu, 0.95),
+            "cpu_max": max(cpu),
+            "render_avg": sum(r["render_us"] for r in rows) // count,
+            # Refresh rate assumed to be 60Hz (NTSC), as the frame pacing is vsync based
+            "fps_avg": round(60.0 * count / vsyncs, 1) if vsyncs else 0.0,
+            "drawn_avg": sum(r["drawn"] for r in rows) // count,
+            "prims_avg": sum(r["prims"] for r in rows) // count,
+            "dropped": sum(r["dropped"] for r in rows),
+            "bytes_max": max(r["bytes"] for r in rows),
+        })
+    return summary
+
+
+def load_summary(path):
+    with open(path, newline="") as f:
+        return {int(row["pack"]): row for row in csv.DictReader(f)}
+
+
+def save_summary(path, summary):
+    with open(path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=SUMMARY_FIELDS)
+        writer.writeheader()
+        writer.writerows(summary)
+
+
+def print_table(summary, baseline):
+    header = list(SUMMARY_FIELDS)
+    lines = [header]
+    for row in summary:
+        cells = []
+        for field in header:
+            cell = str(row[field])
+            base = baseline.get(row["pack"]) if baseline else None
+            if base and field not in ("pack", "frames"):
+                old = float(base[field])
+                new = float(row[field])
+                if old != 0:
+                    cell += " (%+.1f%%)" % ((new - old) * 100.0 / old)
+            cells.append(cell)
+        lines.append(cells)
+    widths = [max(len(line[i]) for line in lines) for i in range(len(header))]
+    for index, line in enumerate(lines):
+        print("  ".join(cell.rjust(widths[i]) for i, cell in enumerate(line)))
+        if index == 0:
+            print("  ".join("-" * w for w in widths))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--emulator", default=os.environ.get("PCSX_REDUX", "pcsx-redux"),
+                        help="path to the PCSX-Redux binary (default: $PCSX_REDUX or pcsx-redux)")
+    parser.add_argument("--exe", default="psxsplash.ps-exe", help="benchmark build of psxsplash")
+    parser.add_argument("--emu-args", default=DEFAULT_EMU_ARGS, help="extra emulator arguments")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds before giving up on the emulator")
+    parser.add_argument("--log", help="parse an existing emulator log instead of running the emulator")
+    parser.add_argument("--save-log", help="write the raw emulator output to this file")
+    parser.add_argument("--frames", help="write every parsed frame to this csv file")
+    parser.add_argument("--save", help="write the summary to this csv file")
+    parser.add_argument("--compare", help="summary csv of a previous run to compare against")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, encoding="latin-1") as f:
+            text = f.read()
+    else:
+        text = run_emulator(args.emulator, args.exe, args.emu_args, args.timeout)
+        if args.save_log:
+            with open(args.save_log, "w") as f:
+                f.write(text)
+
+    frames, done = parse_log(text)
+    if not frames:
+        print("no benchmark output found, was the executable built with BENCHMARK=true?", file=sys.stderr)
+        return 1
+    if not done:
+        print("warning: the benchmark did not run to completion", file=sys.stderr)
+
+    if args.frames:
+        with open(args.frames, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=FRAME_FIELDS)
+            writer.writeheader()
+            for pack in sorted(frames, reverse=True):
+                writer.writerows(frames[pack])
+
+    summary = summarize(frames)
+    baseline = load_summary(args.compare) if args.compare else None
+    print_table(summary, baseline)
+    if args.save:
+        save_summary(args.save, summary)
+    return 0 if done else 2
+
+
+if __name__ == "__main__":
+    sys.exit(main())
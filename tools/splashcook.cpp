@@ -0,0 +1,1545 @@
+// splashcook: offline optimizer for splashpacks.
+//
+// Reads a .bin splashpack as written by the exporter, and rewrites it with the
+// layout decisions the runtime would otherwise pay for every frame:
+//
+//  - degenerate triangles (repeated vertices or zero area) are dropped
+//  - every triangle is rotated so that v0-v1 is its longest edge, which lets
+//    the renderer split it without searching (see recursiveSubdivideAndRender)
+//  - triangles with the same color on all three vertices are flagged FLAT, so
+//    they are drawn with the smaller non-Gouraud primitives
+//  - triangles are sorted by material, then texture page and CLUT inside of
+//    each object, so the renderer sees long runs of a single material and
+//    consecutive primitives hit the same GPU texture cache contents
+//  - objects with identical triangles share them through the mesh table, so
+//    repeated props are stored once (version 3)
+//  - with --compact, meshes without LIT triangles are stored as a CompactMesh:
+//    shared vertices quantized to 32 bits and 12 to 24 bytes per triangle, the
+//    texture page and CLUT moving to per run headers
+//  - with --sectors SHIFT, the level is split in a grid of 1 << SHIFT sized
+//    sectors the runtime streams in and out around the camera (version 4, see
+//    WorldStreamer). Objects move to the sector their position is in, navmesh
+//    triangles are copied to every sector they overlap, and both become
+//    relative to the center of their sector. 13 or less keeps what is resident
+//    within the GTE's 16 bits vectors. --sectors 0 merges the sectors back.
+//    Packs with a transform hierarchy (HIER, version 5) can't be split, the
+//    children hold transforms relative to parents that may land elsewhere.
+//    Trigger volumes (TRIG, version 6) stay in one piece, relative to the
+//    start sector like the player start.
+//  - texture pages get up to two half resolution copies in free VRAM, which
+//    the renderer switches distant triangles to (see TextureLod). Indexed
+//    pages keep their color mode and CLUTs, a copied texel takes the most
+//    common index of the four it covers.
+//  - vertex animations (VANI, version 7) follow their triangles through all
+//    of the above: they are decoded to a position per corner and key, then
+//    delta encoded again for the cooked mesh, over the shared vertices of a
+//    compact one. Animated objects aren't instanced, and keep their
+//    degenerate triangles as they may not be degenerate in every pose.
+//
+// It also prints per-pack statistics. The file is parsed field by field so
+// the tool doesn't depend on the host having 32 bits pointers.
+//
+//   splashcook [--no-sort] [--no-rotate] [--no-flat] [--no-texture-lod] [--no-instance] [--compact]
+//              [--sectors SHIFT] [--keep-degenerate] in.bin [out.bin]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+namespace {
+
+// Must match SPLASHPACKFileHeader in src/splashpack.cpp
+constexpr uint16_t SUPPORTED_VERSION = 7;
+constexpr uint16_t FLAG_LONGEST_EDGE_FIRST = 1 << 0;
+
+// Must match TriFlags in src/mesh.hh
+constexpr uint16_t TRI_UNTEXTURED = 1 << 0;
+constexpr uint16_t TRI_FLAT = 1 << 1;
+constexpr uint16_t TRI_LIT = 1 << 4;
+constexpr uint16_t TRI_MATERIAL_MASK = 0x001f;
+
+// Must match TextureLod in src/renderer.hh
+constexpr unsigned TEXTURE_LOD_MAX_LEVELS = 2;
+constexpr size_t TEXTURE_LOD_SIZE = 16;
+constexpr uint16_t TPAGE_PAGE_MASK = 0x001f;
+constexpr uint16_t TPAGE_SOURCE_MASK = 0x019f;
+// Renderer::PROJECTION_H, to turn texel sizes into distances
+constexpr double PROJECTION_H = 120;
+
+constexpr unsigned VRAM_WIDTH = 1024;
+constexpr unsigned VRAM_HEIGHT = 512;
+
+constexpr size_t HEADER_SIZE = 28;
+constexpr size_t GAMEOBJECT_SIZE = 56;
+constexpr size_t NAVMESH_SIZE = 8;
+constexpr size_t NAVMESH_TRI_SIZE = 36;
+constexpr size_t ATLAS_SIZE = 12;
+constexpr size_t CLUT_SIZE = 12;
+constexpr size_t SECTION_TABLE_SIZE = 4;
+constexpr size_t SECTION_SIZE = 12;
+constexpr size_t MESH_SIZE = 8;
+constexpr uint16_t MESH_COMPACT = 1 << 0;
+constexpr size_t SECTOR_TABLE_SIZE = 8;
+constexpr size_t SECTOR_SIZE = 12;
+constexpr unsigned MAX_SECTOR_SHIFT = 15;
+constexpr size_t TRIGGER_TABLE_SIZE = 4;
+constexpr size_t TRIGGER_SIZE = 28;
+
+// Must match VertexClip, VertexKey and VertexBinding in src/vertexanim.hh
+constexpr size_t VERTEX_ANIMATION_TABLE_SIZE = 4;
+constexpr size_t VERTEX_CLIP_SIZE = 12;
+constexpr size_t VERTEX_KEY_SIZE = 4;
+constexpr size_t VERTEX_BINDING_SIZE = 4;
+// Deltas << shift go to the GTE's 16 bits IR registers
+constexpr unsigned VERTEX_KEY_MAX_SHIFT = 8;
+
+// Must match CompactMesh, CompactRun and CompactTri in src/mesh.hh
+constexpr size_t COMPACT_MESH_SIZE = 12;
+constexpr size_t COMPACT_RUN_SIZE = 8;
+constexpr unsigned COMPACT_MAX_SHIFT = 2;
+constexpr size_t TRI_SIZE = 52;
+
+// Renderer::ORDERING_TABLE_SIZE, BUMP_ALLOCATOR_SIZE, the depth lookup, the recorded frames and the texture
+// LOD tables, for the RAM estimate
+constexpr size_t RENDERER_STATIC_SIZE =
+    2 * (1024 + 1) * 4 + 2 * 8096 * 24 + 1024 * 2 + 2 * 4096 * 4 + 2 * 32 * TEXTURE_LOD_SIZE;
+
+uint16_t read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t read32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24); }
+void write16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+void write32(uint8_t* p, uint32_t v) {
+    write16(p, v);
+    write16(p + 2, v >> 16);
+}
+
+// A Tri, kept as raw bytes with accessors for the fields the tool touches
+struct Tri {
+    uint8_t raw[TRI_SIZE];
+
+    int32_t coord(unsigned vertex, unsigned axis) const { return int16_t(read16(raw + vertex * 6 + axis * 2)); }
+    uint16_t tpage() const { return read16(raw + 44); }
+    uint16_t clutX() const { return read16(raw + 46); }
+    uint16_t clutY() const { return read16(raw + 48); }
+    uint16_t flags() const { return read16(raw + 50); }
+    uint16_t material() const { return flags() & TRI_MATERIAL_MASK; }
+    void setFlags(uint16_t flags) { write16(raw + 50, flags); }
+    unsigned u(unsigned vertex) const { return raw[36 + vertex * 2]; }
+    unsigned v(unsigned vertex) const { return raw[37 + vertex * 2]; }
+
+    bool uniformColor() const { return memcmp(raw + 24, raw + 28, 4) == 0 && memcmp(raw + 24, raw + 32, 4) == 0; }
+
+    int64_t edgeLengthSq(unsigned a, unsigned b) const {
+        int64_t result = 0;
+        for (unsigned axis = 0; axis < 3; axis++) {
+            int64_t d = coord(a, axis) - coord(b, axis);
+            result += d * d;
+        }
+        return result;
+    }
+
+    bool degenerate() const {
+        int64_t e1[3], e2[3];
+        for (unsigned axis = 0; axis < 3; axis++) {
+            e1[axis] = coord(1, axis) - coord(0, axis);
+            e2[axis] = coord(2, axis) - coord(0, axis);
+        }
+        int64_t cx = e1[1] * e2[2] - e1[2] * e2[1];
+        int64_t cy = e1[2] * e2[0] - e1[0] * e2[2];
+        int64_t cz = e1[0] * e2[1] - e1[1] * e2[0];
+        return cx == 0 && cy == 0 && cz == 0;
+    }
+
+    // Cyclic rotation keeps the winding, so backface culling is unaffected.
+    // Vertex n takes the position, color (or normal) and UV of vertex (n + steps) % 3.
+    void rotate(unsigned steps) {
+        if (steps == 0) return;
+        bool lit = flags() & TRI_LIT;
+        // Untextured LIT triangles keep their base color where the UVs would be
+        bool uvs = !(lit && (flags() & TRI_UNTEXTURED));
+        uint8_t copy[TRI_SIZE];
+        memcpy(copy, raw, TRI_SIZE);
+        for (unsigned n = 0; n < 3; n++) {
+            unsigned from = (n + steps) % 3;
+            memcpy(raw + n * 6, copy + from * 6, 6);  // v0, v1, v2
+            if (lit) {
+                memcpy(raw + 18 + n * 6, copy + 18 + from * 6, 6);  // normals, over normal and the colors
+            } else {
+                memcpy(raw + 24 + n * 4, copy + 24 + from * 4, 4);  // colorA, colorB, colorC
+            }
+            if (uvs) memcpy(raw + 36 + n * 2, copy + 36 + from * 2, 2);  // uvA, uvB, uvC (uvC padding stays put)
+        }
+    }
+};
+
+// Vertex animation of an object, whatever its mesh: the position of every corner of its triangles at every
+// key, in object space. The triangles themselves are the pose at frame 0.
+struct VertexAnimation {
+    uint16_t flags = 0;
+    std::vector<uint16_t> frames;
+    // x, y, z per key, for the corner tri * 3 + vertex
+    std::vector<std::vector<int32_t>> corners;
+};
+
+struct GameObject {
+    uint8_t raw[GAMEOBJECT_SIZE];
+    std::vector<Tri> tris;
+    VertexAnimation animation;
+
+    bool animated() const { return !animation.frames.empty(); }
+};
+
+struct Blob {
+    uint8_t raw[12];  // navmesh (8 bytes), atlas, clut or section table entry
+    std::vector<uint8_t> data;
+};
+
+struct Pack {
+    uint8_t header[HEADER_SIZE];
+    std::vector<GameObject> objects;
+    std::vector<Blob> navmeshes, atlases, cluts;
+    std::vector<Blob> sections;  // version 2 and up, kept as they are but for MESH, SECT and VANI
+    // Sectors are undone when parsing, everything is world relative until buildSectors
+    unsigned sectorShift = 0;
+    int32_t start[3];
+};
+
+struct Options {
+    bool sort = true;
+    bool rotate = true;
+    bool flatten = true;
+    bool textureLod = true;
+    bool instance = true;
+    bool compact = false;
+    int sectorShift = -1;  // keeps the input's sectors
+    bool dropDegenerate = true;
+};
+
+struct Stats {
+    size_t triangles = 0;
+    size_t degenerate = 0;
+    size_t rotated = 0;
+    size_t flattened = 0;
+    size_t meshes = 0;
+    size_t compactMeshes = 0;
+    size_t meshBytes = 0;
+    size_t meshTriangles = 0;
+    size_t lodPages = 0;
+    size_t lodLevels = 0;
+    size_t lodBytes = 0;
+    size_t stateChanges = 0;
+    size_t materialRuns = 0;
+    size_t navmeshTriangles = 0;
+    size_t sectors = 0;
+    size_t textureBytes = 0;
+    size_t clutBytes = 0;
+    size_t fileBytes = 0;
+    size_t vertexClips = 0;
+    size_t vertexAnimationBytes = 0;
+};
+
+bool inRange(const std::vector<uint8_t>& file, size_t offset, size_t size) {
+    return offset <= file.size() && size <= file.size() - offset;
+}
+
+size_t compactTriSize(uint16_t material) {
+    return ((material & TRI_FLAT) ? 4 : 12) + 6 + ((material & TRI_UNTEXTURED) ? 2 : 6);
+}
+
+// Where the vertices of a CompactMesh can be: steps of 1 << shift from lo, up to limits steps away
+struct CompactGrid {
+    // x and y get 11 bits, z 10
+    static constexpr int32_t limits[3] = {2047, 2047, 1023};
+    int32_t lo[3];
+    unsigned shift;
+
+    int32_t step(int32_t coord, unsigned axis) const {
+        return std::min((coord - lo[axis] + ((1 << shift) >> 1)) >> shift, limits[axis]);
+    }
+    int32_t snap(int32_t coord, unsigned axis) const { return lo[axis] + (step(coord, axis) << shift); }
+};
+
+// Grid of the triangles and of the poses of their animation as a CompactMesh, false when they don't fit one.
+// Positions read back from a compact mesh fall on the grid they get again.
+bool compactGrid(const std::vector<Tri>& tris, const VertexAnimation* animation, CompactGrid& grid) {
+    if (tris.empty()) return false;
+    int32_t lo[3] = {INT16_MAX, INT16_MAX, INT16_MAX}, hi[3] = {INT16_MIN, INT16_MIN, INT16_MIN};
+    for (size_t i = 0; i < tris.size(); i++) {
+        const Tri& tri = tris[i];
+        if (tri.flags() & TRI_LIT) return false;
+        for (unsigned vertex = 0; vertex < 3; vertex++) {
+            for (unsigned axis = 0; axis < 3; axis++) {
+                lo[axis] = std::min(lo[axis], tri.coord(vertex, axis));
+                hi[axis] = std::max(hi[axis], tri.coord(vertex, axis));
+            }
+            if (!animation) continue;
+            const auto& poses = animation->corners[i * 3 + vertex];
+            for (size_t n = 0; n < poses.size(); n++) {
+                lo[n % 3] = std::min(lo[n % 3], poses[n]);
+                hi[n % 3] = std::max(hi[n % 3], poses[n]);
+            }
+        }
+    }
+
+    auto fits = [&](unsigned s) {
+        for (unsigned axis = 0; axis < 3; axis++) {
+            if ((hi[axis] - lo[axis]) >> s > CompactGrid::limits[axis]) return false;
+        }
+        return true;
+    };
+    grid.shift = 0;
+    while (grid.shift <= COMPACT_MAX_SHIFT && !fits(grid.shift)) grid.shift++;
+    if (grid.shift > COMPACT_MAX_SHIFT) return false;
+    for (unsigned axis = 0; axis < 3; axis++) grid.lo[axis] = lo[axis];
+    return true;
+}
+
+// Encodes the triangles as a CompactMesh, false when they don't fit one. The poses of an animation are
+// quantized like the vertices, only corners moving alike share a vertex, and tracks gets the steps of
+// every vertex: x, y, z at frame 0 then at every key.
+bool encodeCompact(const std::vector<Tri>& tris, std::vector<uint8_t>& out, const VertexAnimation* animation = nullptr,
+                   std::vector<std::vector<int32_t>>* tracks = nullptr) {
+    CompactGrid grid;
+    if (!compactGrid(tris, animation, grid)) return false;
+    auto quantize = [&grid](int32_t coord, unsigned axis) { return grid.step(coord, axis); };
+    std::vector<uint32_t> vertices;
+    std::vector<std::vector<int32_t>> vertexTracks;
+    auto vertexIndex = [&](const Tri& tri, unsigned vertex, size_t corner) {
+        std::vector<int32_t> track(3);
+        for (unsigned axis = 0; axis < 3; axis++) track[axis] = quantize(tri.coord(vertex, axis), axis);
+        if (animation) {
+            for (size_t n = 0; n < animation->corners[corner].size(); n++) {
+                track.push_back(quantize(animation->corners[corner][n], n % 3));
+            }
+        }
+        uint32_t packed = track[0] | (track[2] & 0x1f) << 11 | track[1] << 16 | (track[2] >> 5) << 27;
+        for (size_t n = 0; n < vertices.size(); n++) {
+            if (vertices[n] == packed && vertexTracks[n] == track) return n;
+        }
+        vertices.push_back(packed);
+        vertexTracks.push_back(track);
+        return vertices.size() - 1;
+    };
+
+    std::vector<uint8_t> runs;
+    size_t runCount = 0, runStart = 0;
+    for (size_t i = 0; i < tris.size(); i++) {
+        const Tri& tri = tris[i];
+        const Tri* previous = i ? &tris[i - 1] : nullptr;
+        if (!previous || tri.material() != previous->material() || tri.tpage() != previous->tpage() ||
+            tri.clutX() != previous->clutX() || tri.clutY() != previous->clutY() ||
+            read16(&runs[runStart]) == UINT16_MAX) {
+            runStart = runs.size();
+            runCount++;
+            runs.resize(runStart + COMPACT_RUN_SIZE);
+            runs[runStart + 2] = tri.material();
+            runs[runStart + 3] = tri.clutX();
+            write16(&runs[runStart + 4], tri.tpage());
+            write16(&runs[runStart + 6], tri.clutY());
+        }
+        write16(&runs[runStart], read16(&runs[runStart]) + 1);
+
+        uint8_t record[24] = {};
+        size_t colors = (tri.material() & TRI_FLAT) ? 4 : 12;
+        memcpy(record, tri.raw + 24, colors);
+        for (unsigned vertex = 0; vertex < 3; vertex++) {
+            write16(record + colors + vertex * 2, vertexIndex(tri, vertex, i * 3 + vertex));
+        }
+        if (!(tri.material() & TRI_UNTEXTURED)) memcpy(record + colors + 6, tri.raw + 36, 6);
+        runs.insert(runs.end(), record, record + compactTriSize(tri.material()));
+    }
+    if (vertices.size() > UINT16_MAX || runCount > UINT16_MAX) return false;
+
+    out.assign(COMPACT_MESH_SIZE, 0);
+    for (unsigned axis = 0; axis < 3; axis++) write16(&out[axis * 2], grid.lo[axis]);
+    out[6] = grid.shift;
+    write16(&out[8], vertices.size());
+    write16(&out[10], runCount);
+    for (auto vertex : vertices) {
+        out.resize(out.size() + 4);
+        write32(&out[out.size() - 4], vertex);
+    }
+    out.insert(out.end(), runs.begin(), runs.end());
+    if (tracks) tracks->swap(vertexTracks);
+    return true;
+}
+
+// Where the corners of a compact mesh read back as Tri come from, to decode the animations of its vertices
+struct CompactLayout {
+    std::vector<uint16_t> corners;  // vertex of every corner, tri * 3 + vertex
+    uint16_t vertexCount = 0;
+    unsigned shift = 0;
+};
+
+// Back to Tri, with the quantized positions and without the fields compact meshes drop
+bool decodeCompact(const std::vector<uint8_t>& file, size_t offset, uint16_t count, std::vector<Tri>& tris,
+                   CompactLayout& layout) {
+    if (!inRange(file, offset, COMPACT_MESH_SIZE)) return false;
+    const uint8_t* mesh = &file[offset];
+    unsigned shift = mesh[6];
+    uint16_t vertexCount = read16(mesh + 8), runCount = read16(mesh + 10);
+    layout.corners.clear();
+    layout.vertexCount = vertexCount;
+    layout.shift = shift;
+    size_t cursor = offset + COMPACT_MESH_SIZE;
+    if (!inRange(file, cursor, vertexCount * 4)) return false;
+    const uint8_t* vertices = &file[cursor];
+    cursor += vertexCount * 4;
+
+    tris.clear();
+    for (uint16_t run = 0; run < runCount; run++) {
+        if (!inRange(file, cursor, COMPACT_RUN_SIZE)) return false;
+        const uint8_t* header = &file[cursor];
+        uint16_t material = header[2];
+        size_t size = compactTriSize(material);
+        cursor += COMPACT_RUN_SIZE;
+        if (!inRange(file, cursor, read16(header) * size)) return false;
+        for (uint16_t i = 0; i < read16(header); i++, cursor += size) {
+            const uint8_t* record = &file[cursor];
+            size_t colors = (material & TRI_FLAT) ? 4 : 12;
+            Tri tri = {};
+            for (unsigned vertex = 0; vertex < 3; vertex++) {
+                uint16_t index = read16(record + colors + vertex * 2);
+                if (index >= vertexCount) return false;
+                layout.corners.push_back(index);
+                uint32_t packed = read32(vertices + index * 4);
+                uint32_t q[3] = {packed & 0x7ff, (packed >> 16) & 0x7ff,
+                                 ((packed >> 11) & 0x1f) | ((packed >> 22) & 0x3e0)};
+                for (unsigned axis = 0; axis < 3; axis++) {
+                    write16(tri.raw + vertex * 6 + axis * 2, int16_t(read16(mesh + axis * 2)) + (q[axis] << shift));
+                }
+                memcpy(tri.raw + 24 + vertex * 4, record + ((material & TRI_FLAT) ? 0 : vertex * 4), 4);
+            }
+            if (!(material & TRI_UNTEXTURED)) memcpy(tri.raw + 36, record + colors + 6, 6);
+            write16(tri.raw + 44, read16(header + 4));
+            write16(tri.raw + 46, header[3]);
+            write16(tri.raw + 48, read16(header + 6));
+            tri.setFlags(material);
+            tris.push_back(tri);
+        }
+    }
+    return tris.size() == count;
+}
+
+// Moves the boxes of the TRIG section by (x, z)
+bool moveTriggers(Pack& pack, int32_t x, int32_t z) {
+    for (auto& section : pack.sections) {
+        if (memcmp(section.raw, "TRIG", 4) != 0) continue;
+        auto& data = section.data;
+        if (!inRange(data, 0, TRIGGER_TABLE_SIZE)) return false;
+        uint16_t count = read16(&data[0]);
+        if (!inRange(data, TRIGGER_TABLE_SIZE, size_t(count) * TRIGGER_SIZE)) return false;
+        for (uint16_t i = 0; i < count; i++) {
+            uint8_t* box = &data[TRIGGER_TABLE_SIZE + i * TRIGGER_SIZE];
+            for (unsigned corner = 0; corner < 2; corner++) {
+                write32(box + corner * 12, read32(box + corner * 12) + x);
+                write32(box + corner * 12 + 8, read32(box + corner * 12 + 8) + z);
+            }
+        }
+    }
+    return true;
+}
+
+// Moves the objects, navmeshes, triggers and player start of a SECT section back to world relative positions. The
+// navmeshes of the sectors are merged into one, without the copies of the triangles several sectors share.
+bool readSectors(const Blob& grid, Pack& pack) {
+    const auto& data = grid.data;
+    if (!inRange(data, 0, SECTOR_TABLE_SIZE)) return false;
+    uint16_t count = read16(&data[0]);
+    unsigned shift = data[2];
+    uint16_t startSector = read16(&data[4]);
+    if (shift == 0 || shift > MAX_SECTOR_SHIFT || startSector >= count ||
+        !inRange(data, SECTOR_TABLE_SIZE, size_t(count) * SECTOR_SIZE)) {
+        return false;
+    }
+
+    std::vector<std::vector<int32_t>> triangles;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t* entry = &data[SECTOR_TABLE_SIZE + i * SECTOR_SIZE];
+        int32_t x = int16_t(read16(entry)) * (int32_t(1) << shift);
+        int32_t z = int16_t(read16(entry + 2)) * (int32_t(1) << shift);
+        uint16_t firstObject = read16(entry + 4), objectCount = read16(entry + 6);
+        uint16_t firstNavmesh = read16(entry + 8), navmeshCount = read16(entry + 10);
+        if (firstObject + objectCount > pack.objects.size() || firstNavmesh + navmeshCount > pack.navmeshes.size()) {
+            return false;
+        }
+        for (uint16_t n = firstObject; n < firstObject + objectCount; n++) {
+            uint8_t* raw = pack.objects[n].raw;
+            write32(raw + 4, read32(raw + 4) + x);
+            write32(raw + 12, read32(raw + 12) + z);
+        }
+        for (uint16_t n = firstNavmesh; n < firstNavmesh + navmeshCount; n++) {
+            auto& navmesh = pack.navmeshes[n].data;
+            for (size_t offset = 0; offset + NAVMESH_TRI_SIZE <= navmesh.size(); offset += NAVMESH_TRI_SIZE) {
+                std::vector<int32_t> tri(9);
+                for (unsigned k = 0; k < 9; k++) tri[k] = int32_t(read32(&navmesh[offset + k * 4]));
+                for (unsigned vertex = 0; vertex < 3; vertex++) {
+                    tri[vertex * 3] += x;
+                    tri[vertex * 3 + 2] += z;
+                }
+                if (std::find(triangles.begin(), triangles.end(), tri) == triangles.end()) triangles.push_back(tri);
+            }
+        }
+        if (i == startSector) {
+            pack.start[0] += x;
+            pack.start[2] += z;
+            if (!moveTriggers(pack, x, z)) return false;
+        }
+    }
+
+    pack.navmeshes.clear();
+    if (!triangles.empty()) {
+        Blob navmesh = {};
+        write16(navmesh.raw + 4, triangles.size());
+        navmesh.data.resize(triangles.size() * NAVMESH_TRI_SIZE);
+        for (size_t t = 0; t < triangles.size(); t++) {
+            for (unsigned k = 0; k < 9; k++) write32(&navmesh.data[t * NAVMESH_TRI_SIZE + k * 4], triangles[t][k]);
+        }
+        pack.navmeshes.push_back(navmesh);
+    }
+    write16(pack.header + 6, pack.navmeshes.size());
+    pack.sectorShift = shift;
+    return true;
+}
+
+// Decodes the VANI section to positions per corner, see VertexAnimation. The clips of the objects whose
+// mesh was compact are over its vertices, layouts has the vertex of every corner.
+bool readVertexAnimations(const Blob& section, Pack& pack, const std::vector<CompactLayout>& layouts) {
+    const auto& data = section.data;
+    if (!inRange(data, 0, VERTEX_ANIMATION_TABLE_SIZE)) return false;
+    uint16_t clipCount = read16(&data[0]), bindingCount = read16(&data[2]);
+    size_t bindings = VERTEX_ANIMATION_TABLE_SIZE + clipCount * VERTEX_CLIP_SIZE;
+    if (!inRange(data, bindings, size_t(bindingCount) * VERTEX_BINDING_SIZE)) return false;
+
+    for (uint16_t i = 0; i < bindingCount; i++) {
+        uint16_t object = read16(&data[bindings + i * VERTEX_BINDING_SIZE]);
+        uint16_t clipIndex = read16(&data[bindings + i * VERTEX_BINDING_SIZE + 2]);
+        if (object >= pack.objects.size() || clipIndex >= clipCount) return false;
+        GameObject& obj = pack.objects[object];
+        const CompactLayout& layout = layouts[object];
+        bool compact = !layout.corners.empty();
+
+        const uint8_t* clip = &data[VERTEX_ANIMATION_TABLE_SIZE + clipIndex * VERTEX_CLIP_SIZE];
+        uint32_t keys = read32(clip);
+        uint16_t keyCount = read16(clip + 4), vertexCount = read16(clip + 6);
+        size_t stride = VERTEX_KEY_SIZE + ((vertexCount * 3 + 3) & ~size_t(3));
+        if (obj.animated() || vertexCount != (compact ? layout.vertexCount : obj.tris.size() * 3) ||
+            !inRange(data, keys, keyCount * stride)) {
+            return false;
+        }
+        if (keyCount == 0) continue;
+
+        VertexAnimation& animation = obj.animation;
+        animation.flags = read16(clip + 10);
+        animation.corners.assign(obj.tris.size() * 3, std::vector<int32_t>(keyCount * 3));
+        std::vector<int32_t> moved(vertexCount * 3, 0);
+        for (uint16_t key = 0; key < keyCount; key++) {
+            const uint8_t* entry = &data[keys + key * stride];
+            if (key && read16(entry) < animation.frames.back()) return false;
+            animation.frames.push_back(read16(entry));
+            for (size_t n = 0; n < moved.size(); n++) moved[n] += int8_t(entry[VERTEX_KEY_SIZE + n]) * (1 << entry[2]);
+            for (size_t corner = 0; corner < animation.corners.size(); corner++) {
+                size_t vertex = compact ? layout.corners[corner] : corner;
+                for (unsigned axis = 0; axis < 3; axis++) {
+                    animation.corners[corner][key * 3 + axis] =
+                        obj.tris[corner / 3].coord(corner % 3, axis) + moved[vertex * 3 + axis] * (1 << layout.shift);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Delta encodes the keys of a VertexClip, see src/vertexanim.hh. Every track holds x, y, z of a vertex at
+// frame 0 then at every key, the poses the runtime decodes stay within [lo, hi] and are moved to object
+// space by << scale from origin to compute radius. Keys moving a vertex further than the deltas reach, see
+// vertexAnimationsFit, are caught up with by the next ones.
+void encodeVertexKeys(const std::vector<std::vector<int32_t>>& tracks, const std::vector<uint16_t>& frames,
+                      const int32_t lo[3], const int32_t hi[3], const int32_t origin[3], unsigned scale,
+                      std::vector<uint8_t>& out, uint16_t& radius) {
+    size_t values = tracks.size() * 3;
+    std::vector<int32_t> current(values);
+    for (size_t n = 0; n < values; n++) current[n] = tracks[n / 3][n % 3];
+    uint64_t maxLengthSq = 0;
+    auto grow = [&]() {
+        for (size_t n = 0; n < values; n += 3) {
+            uint64_t lengthSq = 0;
+            for (unsigned axis = 0; axis < 3; axis++) {
+                int64_t coord = origin[axis] + int64_t(current[n + axis]) * (1 << scale);
+                lengthSq += coord * coord;
+            }
+            maxLengthSq = std::max(maxLengthSq, lengthSq);
+        }
+    };
+    grow();
+
+    size_t stride = VERTEX_KEY_SIZE + ((values + 3) & ~size_t(3));
+    out.assign(frames.size() * stride, 0);
+    for (size_t key = 0; key < frames.size(); key++) {
+        auto target = [&](size_t n) { return tracks[n / 3][(key + 1) * 3 + n % 3]; };
+        int32_t largest = 0;
+        for (size_t n = 0; n < values; n++) largest = std::max(largest, std::abs(target(n) - current[n]));
+        unsigned shift = 0;
+        while (largest > (127 << shift) && shift < VERTEX_KEY_MAX_SHIFT) shift++;
+
+        // Deltas from the pose decoded so far, so the rounding errors don't add up
+        uint8_t* entry = &out[key * stride];
+        write16(entry, frames[key]);
+        entry[2] = shift;
+        for (size_t n = 0; n < values; n++) {
+            int32_t delta = std::clamp((target(n) - current[n] + ((1 << shift) >> 1)) >> shift, -128, 127);
+            while (delta > -128 && current[n] + delta * (1 << shift) > hi[n % 3]) delta--;
+            while (delta < 127 && current[n] + delta * (1 << shift) < lo[n % 3]) delta++;
+            current[n] += delta * (1 << shift);
+            entry[VERTEX_KEY_SIZE + n] = uint8_t(int8_t(delta));
+        }
+        grow();
+    }
+
+    // Rounded up like the loader's, the poses in between the keys are within the same sphere
+    uint64_t root = uint64_t(std::sqrt(double(maxLengthSq)));
+    while (root * root > maxLengthSq) root--;
+    if (root * root < maxLengthSq) root++;
+    radius = uint16_t(std::min(root, uint64_t(UINT16_MAX)));
+}
+
+// Whether the animations fit clips over Tri meshes: no more corners than a clip counts, and no key moving
+// one further than the deltas reach. Compact meshes have less than 2048 steps to move across.
+bool vertexAnimationsFit(const Pack& pack) {
+    for (auto& obj : pack.objects) {
+        auto& corners = obj.animation.corners;
+        if (corners.size() > UINT16_MAX) return false;
+        for (size_t corner = 0; corner < corners.size(); corner++) {
+            for (size_t n = 0; n < corners[corner].size(); n++) {
+                int32_t from = n < 3 ? obj.tris[corner / 3].coord(corner % 3, n) : corners[corner][n - 3];
+                if (std::abs(corners[corner][n] - from) > (127 << VERTEX_KEY_MAX_SHIFT)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool parse(const std::vector<uint8_t>& file, Pack& pack) {
+    if (!inRange(file, 0, HEADER_SIZE) || memcmp(file.data(), "SP", 2) != 0) {
+        fprintf(stderr, "not a splashpack\n");
+        return false;
+    }
+    memcpy(pack.header, file.data(), HEADER_SIZE);
+    for (unsigned axis = 0; axis < 3; axis++) pack.start[axis] = int16_t(read16(pack.header + 12 + axis * 2));
+    uint16_t version = read16(pack.header + 2);
+    if (version < 1 || version > SUPPORTED_VERSION) {
+        fprintf(stderr, "unsupported splashpack version %u\n", version);
+        return false;
+    }
+
+    size_t cursor = HEADER_SIZE;
+    pack.objects.resize(read16(pack.header + 4));
+    for (auto& obj : pack.objects) {
+        if (!inRange(file, cursor, GAMEOBJECT_SIZE)) return false;
+        memcpy(obj.raw, &file[cursor], GAMEOBJECT_SIZE);
+        cursor += GAMEOBJECT_SIZE;
+    }
+
+    // With a MESH section the object holds a mesh index instead of the triangles offset
+    std::vector<CompactLayout> layouts(pack.objects.size());
+    auto readTris = [&](const Blob* meshes) {
+        for (auto& obj : pack.objects) {
+            uint32_t offset = read32(obj.raw);
+            uint16_t count = read16(obj.raw + 52);
+            if (meshes) {
+                if (meshes->data.size() < 4 || offset >= read16(meshes->data.data()) ||
+                    !inRange(meshes->data, 4 + offset * MESH_SIZE, MESH_SIZE)) {
+                    return false;
+                }
+                const uint8_t* mesh = &meshes->data[4 + offset * MESH_SIZE];
+                offset = read32(mesh);
+                count = read16(mesh + 4);
+                write16(obj.raw + 52, count);
+                if (read16(mesh + 6) & MESH_COMPACT) {
+                    CompactLayout& layout = layouts[&obj - pack.objects.data()];
+                    if (!decodeCompact(file, offset, count, obj.tris, layout)) return false;
+                    continue;
+                }
+            }
+            if (!inRange(file, offset, size_t(count) * TRI_SIZE)) return false;
+            obj.tris.resize(count);
+            for (uint16_t i = 0; i < count; i++) memcpy(obj.tris[i].raw, &file[offset + i * TRI_SIZE], TRI_SIZE);
+        }
+        return true;
+    };
+
+    // offsetAt is where the data offset sits in the table entry
+    auto readBlobs = [&](std::vector<Blob>& blobs, uint16_t count, size_t entrySize, auto dataSize,
+                         size_t offsetAt = 0) {
+        blobs.resize(count);
+        for (auto& blob : blobs) {
+            if (!inRange(file, cursor, entrySize)) return false;
+            memcpy(blob.raw, &file[cursor], entrySize);
+            cursor += entrySize;
+            uint32_t offset = read32(blob.raw + offsetAt);
+            size_t size = dataSize(blob.raw);
+            if (!inRange(file, offset, size)) return false;
+            blob.data.assign(file.begin() + offset, file.begin() + offset + size);
+        }
+        return true;
+    };
+
+    bool ok = readBlobs(pack.navmeshes, read16(pack.header + 6), NAVMESH_SIZE,
+                        [](const uint8_t* e) { return size_t(read16(e + 4)) * NAVMESH_TRI_SIZE; }) &&
+              readBlobs(pack.atlases, read16(pack.header + 8), ATLAS_SIZE,
+                        [](const uint8_t* e) { return size_t(read16(e + 4)) * read16(e + 6) * 2; }) &&
+              readBlobs(pack.cluts, read16(pack.header + 10), CLUT_SIZE,
+                        [](const uint8_t* e) { return size_t(read16(e + 8)) * 2; });
+    if (!ok || version < 2) return ok && readTris(nullptr);
+
+    if (!inRange(file, cursor, SECTION_TABLE_SIZE)) return false;
+    uint16_t sectionCount = read16(&file[cursor]);
+    cursor += SECTION_TABLE_SIZE;
+    if (!readBlobs(
+            pack.sections, sectionCount, SECTION_SIZE, [](const uint8_t* e) { return size_t(read32(e + 8)); }, 4)) {
+        return false;
+    }
+
+    // So are the sectors, from world relative positions
+    auto grid = std::find_if(pack.sections.begin(), pack.sections.end(),
+                             [](const Blob& section) { return memcmp(section.raw, "SECT", 4) == 0; });
+    if (grid != pack.sections.end()) {
+        if (!readSectors(*grid, pack)) return false;
+        pack.sections.erase(grid);
+    }
+
+    // The mesh table is rebuilt when writing the pack
+    auto meshes = std::find_if(pack.sections.begin(), pack.sections.end(),
+                               [](const Blob& section) { return memcmp(section.raw, "MESH", 4) == 0; });
+    if (meshes == pack.sections.end()) {
+        if (!readTris(nullptr)) return false;
+    } else {
+        Blob table = *meshes;
+        pack.sections.erase(meshes);
+        if (!readTris(&table)) return false;
+    }
+
+    // And so are the vertex animations, which follow the triangles from there
+    auto animations = std::find_if(pack.sections.begin(), pack.sections.end(),
+                                   [](const Blob& section) { return memcmp(section.raw, "VANI", 4) == 0; });
+    if (animations == pack.sections.end()) return true;
+    Blob section = *animations;
+    pack.sections.erase(animations);
+    return readVertexAnimations(section, pack, layouts);
+}
+
+size_t countMaterialRuns(const std::vector<Tri>& tris) {
+    size_t runs = tris.empty() ? 0 : 1;
+    for (size_t i = 1; i < tris.size(); i++) {
+        if (tris[i].material() != tris[i - 1].material()) runs++;
+    }
+    return runs;
+}
+
+size_t countStateChanges(const std::vector<Tri>& tris) {
+    size_t changes = 0;
+    for (size_t i = 1; i < tris.size(); i++) {
+        if (tris[i].tpage() != tris[i - 1].tpage() || tris[i].clutX() != tris[i - 1].clutX() ||
+            tris[i].clutY() != tris[i - 1].clutY()) {
+            changes++;
+        }
+    }
+    return changes;
+}
+
+void optimize(Pack& pack, const Options& options, Stats& stats) {
+    for (auto& obj : pack.objects) {
+        // The corners of an animation go wherever their triangle goes
+        auto& corners = obj.animation.corners;
+        if (options.dropDegenerate && !obj.animated()) {
+            size_t count = obj.tris.size();
+            auto degenerate = [](const Tri& tri) { return tri.degenerate(); };
+            obj.tris.erase(std::remove_if(obj.tris.begin(), obj.tris.end(), degenerate), obj.tris.end());
+            stats.degenerate += count - obj.tris.size();
+        }
+
+        // Compact meshes only keep positions on their grid, where the longest edge may be another one. It is
+        // picked there, or cooking the pack again would rotate the triangles once more.
+        CompactGrid grid;
+        bool snapped = options.compact && compactGrid(obj.tris, obj.animated() ? &obj.animation : nullptr, grid);
+        std::vector<Tri> kept;
+        std::vector<std::vector<int32_t>> keptCorners;
+        kept.reserve(obj.tris.size());
+        for (size_t i = 0; i < obj.tris.size(); i++) {
+            Tri& tri = obj.tris[i];
+            unsigned steps = 0;
+            if (options.rotate) {
+                Tri stored = tri;
+                for (unsigned vertex = 0; snapped && vertex < 3; vertex++) {
+                    for (unsigned axis = 0; axis < 3; axis++) {
+                        write16(stored.raw + vertex * 6 + axis * 2, grid.snap(tri.coord(vertex, axis), axis));
+                    }
+                }
+                int64_t d0 = stored.edgeLengthSq(0, 1);
+                int64_t d1 = stored.edgeLengthSq(1, 2);
+                int64_t d2 = stored.edgeLengthSq(2, 0);
+                steps = (d0 >= d1 && d0 >= d2) ? 0 : (d1 >= d2 ? 1 : 2);
+                if (steps) stats.rotated++;
+                tri.rotate(steps);
+            }
+            if (options.flatten && !(tri.flags() & (TRI_FLAT | TRI_LIT)) && tri.uniformColor()) {
+                stats.flattened++;
+                tri.setFlags(tri.flags() | TRI_FLAT);
+            }
+            kept.push_back(tri);
+            if (obj.animated()) {
+                for (unsigned n = 0; n < 3; n++) keptCorners.push_back(corners[i * 3 + (n + steps) % 3]);
+            }
+        }
+        if (options.sort) {
+            std::vector<size_t> order(kept.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&kept](size_t i, size_t j) {
+                const Tri &a = kept[i], &b = kept[j];
+                if (a.material() != b.material()) return a.material() < b.material();
+                if (a.tpage() != b.tpage()) return a.tpage() < b.tpage();
+                if (a.clutY() != b.clutY()) return a.clutY() < b.clutY();
+                return a.clutX() < b.clutX();
+            });
+            std::vector<Tri> sorted;
+            std::vector<std::vector<int32_t>> sortedCorners;
+            for (size_t i : order) {
+                sorted.push_back(kept[i]);
+                if (!obj.animated()) continue;
+                sortedCorners.insert(sortedCorners.end(), &keptCorners[i * 3], &keptCorners[i * 3] + 3);
+            }
+            kept.swap(sorted);
+            keptCorners.swap(sortedCorners);
+        }
+        obj.tris.swap(kept);
+        corners.swap(keptCorners);
+        write16(obj.raw + 52, obj.tris.size());
+    }
+
+    uint16_t flags = read16(pack.header + 26);
+    if (options.rotate) flags |= FLAG_LONGEST_EDGE_FIRST;
+    write16(pack.header + 26, flags);
+}
+
+// Splits the objects and navmeshes in sectors, see the SECT section in src/splashpack.cpp. Each sector is
+// centered on (x, z) << shift. With shift 0 the pack has no sectors. Fails when the player start or a
+// sector doesn't fit in its 16 bits fields.
+bool buildSectors(Pack& pack, unsigned shift, Stats& stats) {
+    auto writeStart = [&pack](int32_t x, int32_t z) {
+        int32_t local[3] = {pack.start[0] - x, pack.start[1], pack.start[2] - z};
+        for (unsigned axis = 0; axis < 3; axis++) {
+            if (local[axis] < INT16_MIN || local[axis] > INT16_MAX) return false;
+            write16(pack.header + 12 + axis * 2, local[axis]);
+        }
+        return true;
+    };
+    pack.sectorShift = shift;
+    if (shift == 0) return writeStart(0, 0);
+
+    int64_t half = int64_t(1) << (shift - 1);
+    auto cellOf = [&](int64_t coord) { return int32_t((coord + half) >> shift); };
+
+    struct Cell {
+        std::vector<size_t> objects;
+        std::map<size_t, Blob> navmeshes;  // by source navmesh, so they keep their order
+    };
+    std::map<std::pair<int32_t, int32_t>, Cell> cells;  // by (z, x), so rows of sectors are contiguous
+
+    // Instances of a mesh stay next to each other inside of a sector, the loader shares their bounds
+    std::vector<size_t> meshKey(pack.objects.size());
+    for (size_t i = 0; i < pack.objects.size(); i++) {
+        auto& tris = pack.objects[i].tris;
+        meshKey[i] = i;
+        for (size_t j = 0; j < i; j++) {
+            auto& other = pack.objects[j].tris;
+            if (other.size() == tris.size() &&
+                (tris.empty() || memcmp(other.data(), tris.data(), tris.size() * TRI_SIZE) == 0)) {
+                meshKey[i] = meshKey[j];
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < pack.objects.size(); i++) {
+        uint8_t* raw = pack.objects[i].raw;
+        int32_t x = read32(raw + 4), z = read32(raw + 12);
+        int32_t cx = cellOf(x), cz = cellOf(z);
+        cells[{cz, cx}].objects.push_back(i);
+        write32(raw + 4, x - (cx << shift));
+        write32(raw + 12, z - (cz << shift));
+    }
+
+    // A navmesh triangle goes to every sector its bounds overlap, so the navmesh of the sector the camera is in
+    // covers all of it
+    for (size_t source = 0; source < pack.navmeshes.size(); source++) {
+        auto& navmesh = pack.navmeshes[source].data;
+        for (size_t offset = 0; offset + NAVMESH_TRI_SIZE <= navmesh.size(); offset += NAVMESH_TRI_SIZE) {
+            int32_t lo[2] = {INT32_MAX, INT32_MAX}, hi[2] = {INT32_MIN, INT32_MIN};
+            for (unsigned vertex = 0; vertex < 3; vertex++) {
+                for (unsigned axis = 0; axis < 2; axis++) {
+                    int32_t coord = read32(&navmesh[offset + vertex * 12 + axis * 8]);
+                    lo[axis] = std::min(lo[axis], coord);
+                    hi[axis] = std::max(hi[axis], coord);
+                }
+            }
+            for (int32_t cz = cellOf(lo[1]); cz <= cellOf(hi[1]); cz++) {
+                for (int32_t cx = cellOf(lo[0]); cx <= cellOf(hi[0]); cx++) {
+                    Blob& blob = cells[{cz, cx}].navmeshes[source];
+                    size_t at = blob.data.size();
+                    blob.data.insert(blob.data.end(), navmesh.begin() + offset,
+                                     navmesh.begin() + offset + NAVMESH_TRI_SIZE);
+                    for (unsigned vertex = 0; vertex < 3; vertex++) {
+                        uint8_t* x = &blob.data[at + vertex * 12];
+                        write32(x, read32(x) - (cx << shift));
+                        write32(x + 8, read32(x + 8) - (cz << shift));
+                    }
+                }
+            }
+        }
+    }
+
+    int32_t startX = cellOf(pack.start[0]), startZ = cellOf(pack.start[2]);
+    cells[{startZ, startX}];
+    if (cells.size() > UINT16_MAX) return false;
+
+    Blob grid;
+    memcpy(grid.raw, "SECT", 4);
+    grid.data.resize(SECTOR_TABLE_SIZE);
+    write16(&grid.data[0], cells.size());
+    grid.data[2] = shift;
+    std::vector<GameObject> objects;
+    std::vector<Blob> navmeshes;
+    for (auto& [key, cell] : cells) {
+        auto [cz, cx] = key;
+        if (cx < INT16_MIN || cx > INT16_MAX || cz < INT16_MIN || cz > INT16_MAX) return false;
+        if (cx == startX && cz == startZ) write16(&grid.data[4], (grid.data.size() - SECTOR_TABLE_SIZE) / SECTOR_SIZE);
+
+        std::stable_sort(cell.objects.begin(), cell.objects.end(),
+                         [&](size_t a, size_t b) { return meshKey[a] < meshKey[b]; });
+        uint8_t entry[SECTOR_SIZE];
+        write16(entry, cx);
+        write16(entry + 2, cz);
+        write16(entry + 4, objects.size());
+        write16(entry + 6, cell.objects.size());
+        write16(entry + 8, navmeshes.size());
+        write16(entry + 10, cell.navmeshes.size());
+        grid.data.insert(grid.data.end(), entry, entry + SECTOR_SIZE);
+
+        for (size_t i : cell.objects) objects.push_back(pack.objects[i]);
+        for (auto& [source, blob] : cell.navmeshes) {
+            // In a fixed order, as merging the sectors back loses the original one
+            std::vector<std::vector<int32_t>> tris(blob.data.size() / NAVMESH_TRI_SIZE, std::vector<int32_t>(9));
+            for (size_t t = 0; t < tris.size(); t++) {
+                for (unsigned k = 0; k < 9; k++) tris[t][k] = int32_t(read32(&blob.data[t * NAVMESH_TRI_SIZE + k * 4]));
+            }
+            std::sort(tris.begin(), tris.end());
+            for (size_t t = 0; t < tris.size(); t++) {
+                for (unsigned k = 0; k < 9; k++) write32(&blob.data[t * NAVMESH_TRI_SIZE + k * 4], tris[t][k]);
+            }
+            memset(blob.raw, 0, sizeof(blob.raw));
+            write16(blob.raw + 4, blob.data.size() / NAVMESH_TRI_SIZE);
+            navmeshes.push_back(blob);
+        }
+    }
+    if (objects.size() > UINT16_MAX || navmeshes.size() > UINT16_MAX) return false;
+    write32(grid.raw + 8, grid.data.size());
+
+    if (!moveTriggers(pack, -(startX << shift), -(startZ << shift))) return false;
+    pack.objects.swap(objects);
+    pack.navmeshes.swap(navmeshes);
+    // First, so the layout doesn't depend on which sections came with the input
+    pack.sections.insert(pack.sections.begin(), grid);
+    stats.sectors = cells.size();
+    write16(pack.header + 6, pack.navmeshes.size());
+    // SECT came with version 4
+    write16(pack.header + 2, std::max(read16(pack.header + 2), uint16_t(4)));
+    return writeStart(startX << shift, startZ << shift);
+}
+
+// What the GPU sees once the pack is loaded, and which parts of it are taken
+struct Vram {
+    std::vector<uint16_t> pixels = std::vector<uint16_t>(VRAM_WIDTH * VRAM_HEIGHT);
+    std::vector<uint8_t> used = std::vector<uint8_t>(VRAM_WIDTH * VRAM_HEIGHT);
+    // Sums of used over the rectangle from the origin, one row and column larger than VRAM
+    std::vector<uint32_t> usedSums;
+
+    void mark(unsigned x, unsigned y, unsigned w, unsigned h) {
+        for (unsigned row = y; row < std::min(y + h, VRAM_HEIGHT); row++) {
+            for (unsigned col = x; col < std::min(x + w, VRAM_WIDTH); col++) used[row * VRAM_WIDTH + col] = 1;
+        }
+        usedSums.clear();
+    }
+
+    bool isFree(unsigned x, unsigned y, unsigned w, unsigned h) {
+        constexpr unsigned stride = VRAM_WIDTH + 1;
+        if (usedSums.empty()) {
+            usedSums.assign(stride * (VRAM_HEIGHT + 1), 0);
+            for (unsigned row = 0; row < VRAM_HEIGHT; row++) {
+                for (unsigned col = 0; col < VRAM_WIDTH; col++) {
+                    usedSums[(row + 1) * stride + col + 1] = used[row * VRAM_WIDTH + col] +
+                                                             usedSums[row * stride + col + 1] +
+                                                             usedSums[(row + 1) * stride + col] -
+                                                             usedSums[row * stride + col];
+                }
+            }
+        }
+        return usedSums[(y + h) * stride + x + w] - usedSums[y * stride + x + w] - usedSums[(y + h) * stride + x] +
+                   usedSums[y * stride + x] ==
+               0;
+    }
+};
+
+// Texel u, v of a texture page, as an index or a 15 bits color depending on its color mode
+uint16_t pageTexel(const Vram& vram, uint16_t source, unsigned u, unsigned v) {
+    unsigned mode = (source >> 7) & 3;
+    unsigned x = (source & 0xf) * 64;
+    unsigned y = ((source >> 4) & 1) * 256 + v;
+    if (mode == 0) return (vram.pixels[y * VRAM_WIDTH + (x + u / 4) % VRAM_WIDTH] >> (u % 4 * 4)) & 0xf;
+    if (mode == 1) return (vram.pixels[y * VRAM_WIDTH + (x + u / 2) % VRAM_WIDTH] >> (u % 2 * 8)) & 0xff;
+    return vram.pixels[y * VRAM_WIDTH + (x + u) % VRAM_WIDTH];
+}
+
+// One texel out of four. Indices can't be blended, as they may go through different CLUTs,
+// so the most common one wins. Colors are averaged, 0 being transparent.
+uint16_t reduceTexels(unsigned mode, const uint16_t (&texels)[4]) {
+    if (mode < 2) {
+        unsigned best = 0, bestCount = 0;
+        for (unsigned i = 0; i < 4; i++) {
+            unsigned count = std::count(texels, texels + 4, texels[i]);
+            if (count > bestCount) {
+                best = i;
+                bestCount = count;
+            }
+        }
+        return texels[best];
+    }
+    unsigned opaque = 0, r = 0, g = 0, b = 0, stp = 0;
+    for (auto texel : texels) {
+        if (texel == 0) continue;
+        opaque++;
+        r += texel & 0x1f;
+        g += (texel >> 5) & 0x1f;
+        b += (texel >> 10) & 0x1f;
+        stp |= texel & 0x8000;
+    }
+    if (opaque < 2) return 0;
+    uint16_t color = (r / opaque) | (g / opaque) << 5 | (b / opaque) << 10 | stp;
+    return color ? color : 0x8000;
+}
+
+struct PageUse {
+    uint16_t source;
+    size_t triangles = 0;
+    unsigned uMin = 255, uMax = 0, vMin = 255, vMax = 0;
+    double worldArea = 0, uvArea = 0;
+    std::vector<uint16_t> texels;  // the current level, 256 >> level texels square
+    uint8_t entry[TEXTURE_LOD_SIZE] = {};
+    unsigned levels = 0;
+};
+
+bool hasSection(const Pack& pack, const char* tag) {
+    for (auto& section : pack.sections) {
+        if (memcmp(section.raw, tag, 4) == 0) return true;
+    }
+    return false;
+}
+
+// Adds half resolution copies of the texture pages in free VRAM as new atlases, and the TLOD
+// section telling the renderer where they are and from which distance to use them
+void buildTextureLods(Pack& pack, Stats& stats) {
+    if (hasSection(pack, "TLOD")) return;
+
+    Vram vram;
+    // psyqo's double buffered 320 wide framebuffers and its system font
+    vram.mark(0, 0, 320, VRAM_HEIGHT);
+    vram.mark(960, 448, 64, 64);
+    for (auto& atlas : pack.atlases) {
+        unsigned w = read16(atlas.raw + 4), h = read16(atlas.raw + 6), x = read16(atlas.raw + 8), y = read16(atlas.raw + 10);
+        for (unsigned row = 0; row < h && y + row < VRAM_HEIGHT; row++) {
+            for (unsigned col = 0; col < w && x + col < VRAM_WIDTH; col++) {
+                vram.pixels[(y + row) * VRAM_WIDTH + x + col] = read16(&atlas.data[(row * w + col) * 2]);
+            }
+        }
+        vram.mark(x, y, w, h);
+    }
+    for (auto& clut : pack.cluts) vram.mark(read16(clut.raw + 4) * 16, read16(clut.raw + 6), read16(clut.raw + 8), 1);
+
+    std::vector<PageUse> pages;
+    for (auto& obj : pack.objects) {
+        for (auto& tri : obj.tris) {
+            uint16_t source = tri.tpage() & TPAGE_SOURCE_MASK;
+            if ((tri.flags() & TRI_UNTEXTURED) || ((source >> 7) & 3) == 3) continue;
+            auto page = std::find_if(pages.begin(), pages.end(), [&](const PageUse& p) { return p.source == source; });
+            if (page == pages.end()) {
+                pages.emplace_back();
+                page = pages.end() - 1;
+                page->source = source;
+            }
+            page->triangles++;
+            double e1[3], e2[3];
+            for (unsigned axis = 0; axis < 3; axis++) {
+                e1[axis] = tri.coord(1, axis) - tri.coord(0, axis);
+                e2[axis] = tri.coord(2, axis) - tri.coord(0, axis);
+            }
+            page->worldArea += std::sqrt(std::pow(e1[1] * e2[2] - e1[2] * e2[1], 2) +
+                                         std::pow(e1[2] * e2[0] - e1[0] * e2[2], 2) +
+                                         std::pow(e1[0] * e2[1] - e1[1] * e2[0], 2)) / 2;
+            double du1 = double(tri.u(1)) - tri.u(0), dv1 = double(tri.v(1)) - tri.v(0);
+            double du2 = double(tri.u(2)) - tri.u(0), dv2 = double(tri.v(2)) - tri.v(0);
+            page->uvArea += std::fabs(du1 * dv2 - du2 * dv1) / 2;
+            for (unsigned n = 0; n < 3; n++) {
+                page->uMin = std::min(page->uMin, tri.u(n));
+                page->uMax = std::max(page->uMax, tri.u(n));
+                page->vMin = std::min(page->vMin, tri.v(n));
+                page->vMax = std::max(page->vMax, tri.v(n));
+            }
+        }
+    }
+
+    // Pages outside of the uploaded textures, or without a texel density to go by, are left alone
+    pages.erase(std::remove_if(pages.begin(), pages.end(),
+                               [&](const PageUse& page) {
+                                   if (page.uvArea <= 0 || page.worldArea <= 0) return true;
+                                   unsigned mode = (page.source >> 7) & 3;
+                                   unsigned x = (page.source & 0xf) * 64 + (page.uMin >> (2 - mode));
+                                   unsigned y = ((page.source >> 4) & 1) * 256 + page.vMin;
+                                   for (auto& atlas : pack.atlases) {
+                                       unsigned ax = read16(atlas.raw + 8), ay = read16(atlas.raw + 10);
+                                       if (x >= ax && x < ax + read16(atlas.raw + 4) && y >= ay &&
+                                           y < ay + read16(atlas.raw + 6)) {
+                                           return false;
+                                       }
+                                   }
+                                   return true;
+                               }),
+                pages.end());
+    if (pages.empty()) return;
+    std::stable_sort(pages.begin(), pages.end(),
+                     [](const PageUse& a, const PageUse& b) { return a.triangles > b.triangles; });
+
+    for (auto& page : pages) {
+        page.texels.resize(256 * 256);
+        for (unsigned v = 0; v < 256; v++) {
+            for (unsigned u = 0; u < 256; u++) page.texels[v * 256 + u] = pageTexel(vram, page.source, u, v);
+        }
+    }
+
+    // Every page gets its first level before any gets its second one, the free VRAM goes to the most used pages
+    for (unsigned level = 1; level <= TEXTURE_LOD_MAX_LEVELS; level++) {
+        for (auto& page : pages) {
+            if (page.levels != level - 1) continue;
+            unsigned mode = (page.source >> 7) & 3;
+            unsigned size = 256 >> level;
+            std::vector<uint16_t> texels(size * size);
+            for (unsigned v = 0; v < size; v++) {
+                for (unsigned u = 0; u < size; u++) {
+                    const uint16_t* from = &page.texels[v * 2 * size * 2 + u * 2];
+                    uint16_t quad[4] = {from[0], from[1], from[size * 2], from[size * 2 + 1]};
+                    texels[v * size + u] = reduceTexels(mode, quad);
+                }
+            }
+            page.texels.swap(texels);
+
+            // Only the part the triangles sample is copied, anywhere it fits in a single texture page
+            unsigned texelsPerWord = 4 >> mode;
+            unsigned u0 = page.uMin >> level, v0 = page.vMin >> level;
+            unsigned width = (page.uMax >> level) - u0 + 1, height = (page.vMax >> level) - v0 + 1;
+            unsigned words = (width + texelsPerWord - 1) / texelsPerWord;
+            bool placed = false;
+            unsigned x = 0, y = 0;
+            for (y = 0; y + height <= VRAM_HEIGHT && !placed; y += 4) {
+                if (y % 256 + height > 256) continue;
+                for (x = 0; x + words <= VRAM_WIDTH; x += 4) {
+                    if (x % 64 * texelsPerWord + width > 256) continue;
+                    if (vram.isFree(x, y, words, height)) {
+                        placed = true;
+                        break;
+                    }
+                }
+            }
+            if (!placed) continue;
+            y -= 4;
+
+            Blob atlas;
+            atlas.data.resize(words * height * 2);
+            for (unsigned row = 0; row < height; row++) {
+                for (unsigned word = 0; word < words; word++) {
+                    uint16_t value = 0;
+                    for (unsigned i = 0; i < texelsPerWord; i++) {
+                        unsigned u = u0 + word * texelsPerWord + i;
+                        if (u >= size) break;
+                        value |= page.texels[(v0 + row) * size + u] << (i * (16 / texelsPerWord));
+                    }
+                    write16(&atlas.data[(row * words + word) * 2], value);
+                    vram.pixels[(y + row) * VRAM_WIDTH + x + word] = value;
+                }
+            }
+            memset(atlas.raw, 0, sizeof(atlas.raw));
+            write16(atlas.raw + 4, words);
+            write16(atlas.raw + 6, height);
+            write16(atlas.raw + 8, x);
+            write16(atlas.raw + 10, y);
+            pack.atlases.push_back(atlas);
+            vram.mark(x, y, words, height);
+
+            // A level is used once its texels, 1 << level of the original ones, shrink to a pixel or less
+            double texelSize = std::sqrt(page.worldArea / page.uvArea);
+            double distance = std::min(PROJECTION_H * texelSize * (1 << level), 65535.0);
+            uint8_t* entry = page.entry + 4 + (level - 1) * 6;
+            write16(entry, uint16_t(distance));
+            write16(entry + 2, (x / 64) | (y / 256) << 4);
+            entry[4] = uint8_t(x % 64 * texelsPerWord - u0);
+            entry[5] = uint8_t(y % 256 - v0);
+            page.levels = level;
+            stats.lodLevels++;
+            stats.lodBytes += atlas.data.size();
+        }
+    }
+
+    Blob section;
+    memcpy(section.raw, "TLOD", 4);
+    section.data.resize(4);
+    for (auto& page : pages) {
+        if (page.levels == 0) continue;
+        write16(page.entry, page.source);
+        write16(page.entry + 2, page.levels);
+        section.data.insert(section.data.end(), page.entry, page.entry + TEXTURE_LOD_SIZE);
+        stats.lodPages++;
+    }
+    if (stats.lodPages == 0) return;
+    write16(&section.data[0], stats.lodPages);
+    write32(section.raw + 8, section.data.size());
+    pack.sections.push_back(section);
+    write16(pack.header + 8, pack.atlases.size());
+    // The section table came with version 2
+    write16(pack.header + 2, std::max(read16(pack.header + 2), uint16_t(2)));
+}
+
+void gatherStats(const Pack& pack, Stats& stats) {
+    stats.triangles = stats.stateChanges = stats.materialRuns = stats.navmeshTriangles = stats.textureBytes = stats.clutBytes = 0;
+    for (auto& obj : pack.objects) {
+        stats.triangles += obj.tris.size();
+        stats.stateChanges += countStateChanges(obj.tris);
+        stats.materialRuns += countMaterialRuns(obj.tris);
+    }
+    for (auto& navmesh : pack.navmeshes) stats.navmeshTriangles += read16(navmesh.raw + 4);
+    for (auto& atlas : pack.atlases) stats.textureBytes += atlas.data.size();
+    for (auto& clut : pack.cluts) stats.clutBytes += clut.data.size();
+}
+
+// Encodes the animations of the objects over their cooked mesh to a VANI section, objects animated alike
+// sharing a clip. False when no object is animated.
+bool buildVertexAnimations(const Pack& pack, const std::vector<size_t>& meshOf,
+                           const std::vector<std::vector<uint8_t>>& compactMeshes,
+                           const std::vector<std::vector<std::vector<int32_t>>>& compactTracks,
+                           std::vector<Blob>& sections, Stats& stats) {
+    std::vector<std::vector<uint8_t>> clips;  // clip entry, keysOffset left to 0, then its keys
+    std::vector<uint8_t> bindings;
+    for (size_t i = 0; i < pack.objects.size(); i++) {
+        auto& obj = pack.objects[i];
+        if (!obj.animated()) continue;
+        const VertexAnimation& animation = obj.animation;
+        const auto& compact = compactMeshes[meshOf[i]];
+
+        std::vector<std::vector<int32_t>> tracks;
+        int32_t lo[3] = {INT16_MIN, INT16_MIN, INT16_MIN}, hi[3] = {INT16_MAX, INT16_MAX, INT16_MAX};
+        int32_t origin[3] = {0, 0, 0};
+        unsigned scale = 0;
+        if (!compact.empty()) {
+            tracks = compactTracks[meshOf[i]];
+            const int32_t limits[3] = {2047, 2047, 1023};
+            for (unsigned axis = 0; axis < 3; axis++) {
+                lo[axis] = 0;
+                hi[axis] = limits[axis];
+                origin[axis] = int16_t(read16(&compact[axis * 2]));
+            }
+            scale = compact[6];
+        } else {
+            for (size_t corner = 0; corner < animation.corners.size(); corner++) {
+                std::vector<int32_t> track(3);
+                for (unsigned axis = 0; axis < 3; axis++) track[axis] = obj.tris[corner / 3].coord(corner % 3, axis);
+                track.insert(track.end(), animation.corners[corner].begin(), animation.corners[corner].end());
+                tracks.push_back(track);
+            }
+        }
+
+        std::vector<uint8_t> clip(VERTEX_CLIP_SIZE);
+        std::vector<uint8_t> keys;
+        uint16_t radius;
+        encodeVertexKeys(tracks, animation.frames, lo, hi, origin, scale, keys, radius);
+        write16(&clip[4], animation.frames.size());
+        write16(&clip[6], tracks.size());
+        write16(&clip[8], radius);
+        write16(&clip[10], animation.flags);
+        clip.insert(clip.end(), keys.begin(), keys.end());
+
+        auto same = std::find(clips.begin(), clips.end(), clip);
+        uint8_t binding[VERTEX_BINDING_SIZE];
+        write16(binding, i);
+        write16(binding + 2, same - clips.begin());
+        bindings.insert(bindings.end(), binding, binding + VERTEX_BINDING_SIZE);
+        if (same == clips.end()) clips.push_back(clip);
+    }
+    if (clips.empty()) return false;
+
+    Blob section;
+    memcpy(section.raw, "VANI", 4);
+    section.data.resize(VERTEX_ANIMATION_TABLE_SIZE);
+    write16(&section.data[0], clips.size());
+    write16(&section.data[2], bindings.size() / VERTEX_BINDING_SIZE);
+    size_t keysOffset = VERTEX_ANIMATION_TABLE_SIZE + clips.size() * VERTEX_CLIP_SIZE + bindings.size();
+    for (auto& clip : clips) {
+        write32(&clip[0], keysOffset);
+        section.data.insert(section.data.end(), clip.begin(), clip.begin() + VERTEX_CLIP_SIZE);
+        keysOffset += clip.size() - VERTEX_CLIP_SIZE;
+    }
+    section.data.insert(section.data.end(), bindings.begin(), bindings.end());
+    for (auto& clip : clips) section.data.insert(section.data.end(), clip.begin() + VERTEX_CLIP_SIZE, clip.end());
+    write32(section.raw + 8, section.data.size());
+    sections.push_back(section);
+    stats.vertexClips = clips.size();
+    stats.vertexAnimationBytes = section.data.size();
+    return true;
+}
+
+// Same layout as the exporter: header, tables, then the data in table order
+std::vector<uint8_t> serialize(Pack& pack, const Options& options, Stats& stats) {
+    // Objects with the same triangles become instances of one mesh, the first of them has its data
+    std::vector<size_t> meshOf(pack.objects.size());
+    std::vector<size_t> meshObjects;
+    for (size_t i = 0; i < pack.objects.size(); i++) {
+        auto& tris = pack.objects[i].tris;
+        auto same = std::find_if(meshObjects.begin(), meshObjects.end(), [&](size_t other) {
+            auto& otherTris = pack.objects[other].tris;
+            return options.instance && !pack.objects[i].animated() && !pack.objects[other].animated() &&
+                   otherTris.size() == tris.size() &&
+                   (tris.empty() || memcmp(otherTris.data(), tris.data(), tris.size() * TRI_SIZE) == 0);
+        });
+        meshOf[i] = same - meshObjects.begin();
+        if (same == meshObjects.end()) meshObjects.push_back(i);
+    }
+    stats.meshes = meshObjects.size();
+
+    std::vector<std::vector<uint8_t>> compactMeshes(meshObjects.size());
+    // Steps of the vertices of the compact meshes of animated objects
+    std::vector<std::vector<std::vector<int32_t>>> compactTracks(meshObjects.size());
+    for (size_t mesh = 0; mesh < meshObjects.size(); mesh++) {
+        auto& obj = pack.objects[meshObjects[mesh]];
+        auto& tris = obj.tris;
+        if (options.compact && encodeCompact(tris, compactMeshes[mesh], obj.animated() ? &obj.animation : nullptr,
+                                             &compactTracks[mesh])) {
+            stats.compactMeshes++;
+            stats.meshBytes += compactMeshes[mesh].size();
+        } else {
+            compactMeshes[mesh].clear();
+            stats.meshBytes += tris.size() * TRI_SIZE;
+        }
+        stats.meshTriangles += tris.size();
+    }
+    bool useMeshTable = meshObjects.size() < pack.objects.size() || stats.compactMeshes > 0;
+
+    std::vector<Blob> sections = pack.sections;
+    if (buildVertexAnimations(pack, meshOf, compactMeshes, compactTracks, sections, stats)) {
+        // VANI came with version 7
+        write16(pack.header + 2, std::max(read16(pack.header + 2), uint16_t(7)));
+    }
+    if (useMeshTable) {
+        // MESH came with version 3, the section table with version 2
+        write16(pack.header + 2, std::max(read16(pack.header + 2), uint16_t(3)));
+        Blob table;
+        memcpy(table.raw, "MESH", 4);
+        table.data.resize(4 + meshObjects.size() * MESH_SIZE);
+        write16(&table.data[0], meshObjects.size());
+        write32(table.raw + 8, table.data.size());
+        sections.push_back(table);
+    }
+
+    bool hasSectionTable = read16(pack.header + 2) >= 2;
+    std::vector<uint8_t> out(HEADER_SIZE + pack.objects.size() * GAMEOBJECT_SIZE + pack.navmeshes.size() * NAVMESH_SIZE +
+                             pack.atlases.size() * ATLAS_SIZE + pack.cluts.size() * CLUT_SIZE +
+                             (hasSectionTable ? SECTION_TABLE_SIZE + sections.size() * SECTION_SIZE : 0));
+    auto append = [&out](const uint8_t* data, size_t size) {
+        size_t offset = out.size();
+        out.insert(out.end(), data, data + size);
+        out.resize((out.size() + 3) & ~size_t(3));
+        return uint32_t(offset);
+    };
+
+    memcpy(out.data(), pack.header, HEADER_SIZE);
+    size_t cursor = HEADER_SIZE;
+    std::vector<uint32_t> meshOffsets(meshObjects.size());
+    for (size_t i = 0; i < pack.objects.size(); i++) {
+        auto& obj = pack.objects[i];
+        size_t mesh = meshOf[i];
+        if (meshObjects[mesh] == i && !compactMeshes[mesh].empty()) {
+            meshOffsets[mesh] = append(compactMeshes[mesh].data(), compactMeshes[mesh].size());
+        } else if (meshObjects[mesh] == i) {
+            std::vector<uint8_t> tris(obj.tris.size() * TRI_SIZE);
+            for (size_t n = 0; n < obj.tris.size(); n++) memcpy(&tris[n * TRI_SIZE], obj.tris[n].raw, TRI_SIZE);
+            meshOffsets[mesh] = append(tris.data(), tris.size());
+        }
+        if (useMeshTable) {
+            uint8_t* entry = &sections.back().data[4 + mesh * MESH_SIZE];
+            write32(entry, meshOffsets[mesh]);
+            write16(entry + 4, obj.tris.size());
+            write16(entry + 6, compactMeshes[mesh].empty() ? 0 : MESH_COMPACT);
+            write32(obj.raw, mesh);
+        } else {
+            write32(obj.raw, meshOffsets[mesh]);
+        }
+        memcpy(&out[cursor], obj.raw, GAMEOBJECT_SIZE);
+        cursor += GAMEOBJECT_SIZE;
+    }
+    auto appendBlobs = [&](std::vector<Blob>& blobs, size_t entrySize, size_t offsetAt = 0) {
+        for (auto& blob : blobs) {
+            write32(blob.raw + offsetAt, append(blob.data.data(), blob.data.size()));
+            memcpy(&out[cursor], blob.raw, entrySize);
+            cursor += entrySize;
+        }
+    };
+    appendBlobs(pack.navmeshes, NAVMESH_SIZE);
+    appendBlobs(pack.atlases, ATLAS_SIZE);
+    appendBlobs(pack.cluts, CLUT_SIZE);
+    if (hasSectionTable) {
+        write16(&out[cursor], sections.size());
+        write16(&out[cursor + 2], 0);
+        cursor += SECTION_TABLE_SIZE;
+        appendBlobs(sections, SECTION_SIZE, 4);
+    }
+    return out;
+}
+
+void printStats(const char* label, const Pack& pack, const Stats& stats) {
+    // Runtime RAM: the pack itself (embedded in the executable), the loader's
+    // pointer vectors and the renderer's ordering tables and bump allocators
+    size_t heap = (pack.objects.size() + pack.navmeshes.size()) * 4;
+    printf("%-8s objects %4zu  triangles %6zu  material runs %5zu  tpage/clut changes %5zu  navmesh triangles %5zu\n",
+           label, pack.objects.size(), stats.triangles, stats.materialRuns, stats.stateChanges, stats.navmeshTriangles);
+    printf("%-8s texture %7zu B  clut %6zu B  file %7zu B  RAM footprint %7zu B\n", "", stats.textureBytes,
+           stats.clutBytes, stats.fileBytes, stats.fileBytes + heap + RENDERER_STATIC_SIZE);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    const char* input = nullptr;
+    const char* output = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-sort") == 0) {
+            options.sort = false;
+        } else if (strcmp(argv[i], "--no-rotate") == 0) {
+            options.rotate = false;
+        } else if (strcmp(argv[i], "--no-flat") == 0) {
+            options.flatten = false;
+        } else if (strcmp(argv[i], "--no-texture-lod") == 0) {
+            options.textureLod = false;
+        } else if (strcmp(argv[i], "--no-instance") == 0) {
+            options.instance = false;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            options.compact = true;
+        } else if (strcmp(argv[i], "--sectors") == 0 && i + 1 < argc) {
+            options.sectorShift = atoi(argv[++i]);
+            if (options.sectorShift < 0 || options.sectorShift > int(MAX_SECTOR_SHIFT)) {
+                input = nullptr;
+                break;
+            }
+        } else if (strcmp(argv[i], "--keep-degenerate") == 0) {
+            options.dropDegenerate = false;
+        } else if (!input) {
+            input = argv[i];
+        } else if (!output) {
+            output = argv[i];
+        } else {
+            input = nullptr;
+            break;
+        }
+    }
+    if (!input) {
+        fprintf(stderr,
+                "usage: %s [--no-sort] [--no-rotate] [--no-flat] [--no-texture-lod] [--no-instance] [--compact] "
+                "[--sectors SHIFT] [--keep-degenerate] in.bin [out.bin]\n",
+                argv[0]);
+        return 1;
+    }
+
+    FILE* f = fopen(input, "rb");
+    if (!f) {
+        perror(input);
+        return 1;
+    }
+    std::vector<uint8_t> file;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) file.insert(file.end(), buffer, buffer + n);
+    fclose(f);
+
+    Pack pack;
+    if (!parse(file, pack)) {
+        fprintf(stderr, "%s: unable to parse\n", input);
+        return 1;
+    }
+
+    printf("%s\n", input);
+    Stats before;
+    gatherStats(pack, before);
+    before.fileBytes = file.size();
+    printStats("before", pack, before);
+
+    if (!output) return 0;
+
+    if (options.sectorShift > 0 && hasSection(pack, "HIER")) {
+        fprintf(stderr, "%s: objects with a parent or a track can't be split in sectors\n", input);
+        return 1;
+    }
+
+    if (!vertexAnimationsFit(pack)) {
+        fprintf(stderr, "%s: a vertex animation has too many vertices, or moves one too far between two keys\n", input);
+        return 1;
+    }
+
+    Stats after;
+    optimize(pack, options, after);
+    if (!buildSectors(pack, options.sectorShift >= 0 ? options.sectorShift : pack.sectorShift, after)) {
+        fprintf(stderr, "%s: the level doesn't fit in sectors of this size\n", input);
+        return 1;
+    }
+    if (options.textureLod) buildTextureLods(pack, after);
+    auto cooked = serialize(pack, options, after);
+    gatherStats(pack, after);
+    after.fileBytes = cooked.size();
+    printStats("after", pack, after);
+    printf("%-8s dropped %zu degenerate triangle(s), rotated %zu, flattened %zu\n", "", after.degenerate, after.rotated,
+           after.flattened);
+    printf("%-8s %zu mesh(es) for %zu object(s), %zu compact, %zu B of mesh data, %.1f B per triangle (Tri %zu)\n",
+           "", after.meshes, pack.objects.size(), after.compactMeshes, after.meshBytes,
+           after.meshTriangles ? double(after.meshBytes) / after.meshTriangles : 0.0, TRI_SIZE);
+    if (after.sectors) {
+        printf("%-8s %zu sector(s) of %.3f units\n", "", after.sectors, (1u << pack.sectorShift) / 4096.0);
+    }
+    if (after.vertexClips) {
+        printf("%-8s %zu vertex animation clip(s), %zu B\n", "", after.vertexClips, after.vertexAnimationBytes);
+    }
+    if (options.textureLod) {
+        printf("%-8s texture LOD: %zu page(s), %zu level(s), %zu B of VRAM\n", "", after.lodPages, after.lodLevels,
+               after.lodBytes);
+    }
+
+    f = fopen(output, "wb");
+    if (!f || fwrite(cooked.data(), 1, cooked.size(), f) != cooked.size()) {
+        perror(output);
+        if (f) fclose(f);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}